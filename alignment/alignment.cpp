@@ -3363,26 +3363,29 @@ void Alignment::createBootstrapAlignment(Alignment *aln, IntVector* pattern_freq
 
 	IntVector site_vec;
     if (!spec) {
-		// standard bootstrap
+		// standard bootstrap: the replicate only reweights the patterns of aln,
+		// thus take over the patterns with positive weight in their original order
+		// instead of copying and hashing every resampled site
         int added_sites = 0;
-        IntVector sample;
-        random_resampling(nsite, sample);
-        for (size_t site = 0; site < nsite; ++site) {
-            for (int rep = 0; rep < sample[site]; ++rep) {
-                int ptn_id = aln->getPatternID(site);
-                Pattern pat = aln->at(ptn_id);
-                int nptn = getNPattern();
-                addPattern(pat, added_sites);
-                if (!aln->site_state_freq.empty() && getNPattern() > nptn) {
-                    // a new pattern is added, copy state frequency vector
-                    double *state_freq = new double[num_states];
-                    memcpy(state_freq, aln->site_state_freq[ptn_id], num_states*sizeof(double));
-                    site_state_freq.push_back(state_freq);
-                }
-                if (pattern_freq) ((*pattern_freq)[ptn_id])++;
-                added_sites++;
+        IntVector ptn_weight;
+        aln->resamplePatternWeights(ptn_weight);
+        reserve(aln->getNPattern() - count(ptn_weight.begin(), ptn_weight.end(), 0));
+        for (size_t ptn_id = 0; ptn_id < ptn_weight.size(); ++ptn_id) {
+            if (ptn_weight[ptn_id] == 0)
+                continue;
+            push_back(aln->at(ptn_id));
+            back().frequency = ptn_weight[ptn_id];
+            pattern_index[back()] = size()-1;
+            for (int rep = 0; rep < ptn_weight[ptn_id]; ++rep)
+                site_pattern[added_sites++] = size()-1;
+            if (!aln->site_state_freq.empty()) {
+                double *state_freq = new double[num_states];
+                memcpy(state_freq, aln->site_state_freq[ptn_id], num_states*sizeof(double));
+                site_state_freq.push_back(state_freq);
             }
         }
+        if (pattern_freq)
+            *pattern_freq = ptn_weight;
         if (added_sites < nsite)
             site_pattern.resize(added_sites);
     } else if (strncmp(spec, "GENESITE,", 9) == 0) {
@@ -3463,6 +3466,16 @@ void Alignment::createBootstrapAlignment(Alignment *aln, IntVector* pattern_freq
 //    buildSeqStates();
 }
 
+void Alignment::resamplePatternWeights(IntVector &ptn_weight) {
+    size_t nsite = getNSite();
+    IntVector sample;
+    random_resampling(nsite, sample);
+    ptn_weight.clear();
+    ptn_weight.resize(getNPattern(), 0);
+    for (size_t site = 0; site < nsite; ++site)
+        ptn_weight[getPatternID(site)] += sample[site];
+}
+
 void Alignment::createBootstrapAlignment(IntVector &pattern_freq, const char *spec) {
 	int nptn = getNPattern();
     pattern_freq.resize(nptn, 0);
@@ -4922,6 +4935,20 @@ void Alignment::getPatternFreq(int *freq) {
         freq[cnt] = (*it).frequency;
 }
 
+void Alignment::setPatternFreq(IntVector &freq) {
+    ASSERT(freq.size() == getNPattern());
+    int cnt = 0;
+    for (iterator it = begin(); it < end(); it++, cnt++)
+        (*it).frequency = freq[cnt];
+    countConstSite();
+    // parsimony weights are taken from ordered_pattern, rebuild it on demand
+    ordered_pattern.clear();
+    if (pars_lower_bound) {
+        delete [] pars_lower_bound;
+        pars_lower_bound = NULL;
+    }
+}
+
 //added by MA
 void Alignment::multinomialProb(Alignment refAlign, double &prob)
 {
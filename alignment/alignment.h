@@ -378,6 +378,14 @@ public:
      */
     virtual void getPatternFreq(int *freq);
 
+    /**
+     * replace the site-pattern frequencies in place, e.g. by bootstrap weights.
+     * Patterns, their order and site_pattern stay unchanged; the constant-site
+     * counts and the parsimony pattern order are updated to the new frequencies
+     * @param freq vector of site-pattern frequencies
+     */
+    virtual void setPatternFreq(IntVector &freq);
+
     /**
             @param i sequence index
             @return sequence name
@@ -493,9 +501,17 @@ public:
             	to randomly draw b1 sites from the first l1 sites, etc. Note that l1+l2+...+lk
             	must equal m, where m is the alignment length. Otherwise, an error will occur.
             	If spec == NULL, a standard procedure is applied, i.e., randomly draw m sites.
+            	The patterns are then those of aln with a positive resampled frequency, in the same order.
      */
     virtual void createBootstrapAlignment(Alignment *aln, IntVector* pattern_freq = NULL, const char *spec = NULL);
 
+    /**
+            resample the sites by a standard bootstrap (or jackknife) and count the draws per pattern,
+            consuming the random stream like createBootstrapAlignment(aln) without spec
+            @param[out] ptn_weight number of times each pattern is drawn
+     */
+    void resamplePatternWeights(IntVector &ptn_weight);
+
     /**
             resampling pattern frequency by a non-parametric bootstrap 
             @param pattern_freq (OUT) resampled pattern frequencies
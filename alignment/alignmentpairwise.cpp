@@ -30,13 +30,11 @@ AlignmentPairwise::AlignmentPairwise()
     num_states_squared = 0;
     STATE_UNKNOWN      = 0;
     trans_size         = 0;
-    trans_mat          = nullptr;
     sum_trans_mat      = nullptr;
-    trans_derv1        = nullptr;
-    trans_derv2        = nullptr;
     sum_derv1          = nullptr;
     sum_derv2          = nullptr;
     sum_trans          = nullptr;
+    trans_buffer       = nullptr;
     pairCount = 0;
     derivativeCalculationCount = 0;
     costCalculationCount = 0;
@@ -64,13 +62,12 @@ void AlignmentPairwise::setTree(PhyloTree* atree) {
         && rate!=nullptr && rate->getPtnCat(0) >= 0) {
         total_size *= rate->getNDiscreteRate();
     }
-    trans_mat     = new double[trans_size];
     sum_trans_mat = new double[trans_size];
     sum_trans     = new double[trans_size];
     sum_derv1     = new double[trans_size];
     sum_derv2     = new double[trans_size];
-    trans_derv1   = new double[trans_size];
-    trans_derv2   = new double[trans_size];
+    int ncat      = (rate==nullptr) ? 1 : max(rate->getNDiscreteRate(), 1);
+    trans_buffer  = new double[trans_size * 3 * ncat];
     total_size    = num_states_squared;
     pair_freq     = new double[total_size];
     
@@ -219,15 +216,20 @@ double AlignmentPairwise::computeFunction(double value) {
     
     // categorized rates
     if (site_rate->getPtnCat(0) >= 0) {
+        double cat_times[ncat];
+        vector<TransMatrixPtr> cached_mats(ncat);
+        for (int cat = 0; cat < ncat; cat++)
+            cat_times[cat] = value*site_rate->getRate(cat);
+        tree->getModelFactory()->getTransMatrices(ncat, cat_times, cached_mats.data(), 0, trans_buffer);
         for (int cat = 0; cat < ncat; cat++) {
-            tree->getModelFactory()->computeTransMatrix(value*site_rate->getRate(cat), trans_mat);
+            const double *mat = cached_mats[cat].get();
             double *pair_pos = pair_freq + cat*trans_size;
             for (int i = 0; i < trans_size; i++)
                 if (pair_pos[i] > Params::getInstance().min_branch_length) {
-                    if (trans_mat[i] <= 0) {
+                    if (mat[i] <= 0) {
                       throw "Negative transition probability";
                     }
-                    lh -= pair_pos[i] * log(trans_mat[i]);
+                    lh -= pair_pos[i] * log(mat[i]);
                 }
         }
         return lh;
@@ -238,9 +240,10 @@ double AlignmentPairwise::computeFunction(double value) {
     else {
         tree->getModelFactory()->computeTransMatrix(value * site_rate->getRate(0), sum_trans_mat);
         for (int cat = 1; cat < ncat; cat++) {
-            tree->getModelFactory()->computeTransMatrix(value * site_rate->getRate(cat), trans_mat);
+            TransMatrixPtr cached_mat = tree->getModelFactory()->getTransMatrix(value * site_rate->getRate(cat), 0, trans_buffer);
+            const double *mat = cached_mat.get();
             for (int i = 0; i < trans_size; i++)
-                sum_trans_mat[i] += trans_mat[i];
+                sum_trans_mat[i] += mat[i];
         }
     }
     for (int i = 0; i < trans_size; i++) {
@@ -294,18 +297,23 @@ void AlignmentPairwise::computeFuncDerv(double value, double &df, double &ddf) {
     
     // categorized rates
     if (site_rate->getPtnCat(0) >= 0) {
+        double cat_times[ncat];
+        vector<TransMatrixPtr> cached_dervs(ncat);
+        for (int cat = 0; cat < ncat; cat++)
+            cat_times[cat] = value*site_rate->getRate(cat);
+        tree->getModelFactory()->getTransDervs(ncat, cat_times, cached_dervs.data(), 0, trans_buffer);
         for (int cat = 0; cat < ncat; cat++) {
             double rate_val = site_rate->getRate(cat);
             double derv1 = 0.0, derv2 = 0.0;
-            tree->getModelFactory()->computeTransDerv(value*rate_val, trans_mat, trans_derv1, trans_derv2);
+            const double *mat = cached_dervs[cat].get(), *mat_derv1 = mat + trans_size, *mat_derv2 = mat_derv1 + trans_size;
             double *pair_pos = pair_freq + cat*trans_size;
             for (int i = 0; i < trans_size; i++) if (pair_pos[i] > 0) {
-                if (trans_mat[i] <= 0) {
+                if (mat[i] <= 0) {
                     throw "Negative transition probability";
                 }
-                double d1 = trans_derv1[i] / trans_mat[i];
+                double d1 = mat_derv1[i] / mat[i];
                 derv1 += pair_pos[i] * d1;
-                derv2 += pair_pos[i] * (trans_derv2[i]/trans_mat[i] - d1 * d1);
+                derv2 += pair_pos[i] * (mat_derv2[i]/mat[i] - d1 * d1);
             }
             df -= derv1 * rate_val;
             ddf -= derv2 * rate_val * rate_val;
@@ -317,20 +325,27 @@ void AlignmentPairwise::computeFuncDerv(double value, double &df, double &ddf) {
     memset(sum_derv1, 0, sizeof(double) * trans_size);
     memset(sum_derv2, 0, sizeof(double) * trans_size);
 
+    double cat_rates[ncat], cat_times[ncat];
+    vector<TransMatrixPtr> cached_dervs(ncat);
     for (int cat = 0; cat < ncat; cat++) {
-        double rate_val = site_rate->getRate(cat);
-        double prop_val = site_rate->getProp(cat);
+        cat_rates[cat] = site_rate->getRate(cat);
         if (tree->getModelFactory()->site_rate->getGammaShape() == 0.0)
         {
-            rate_val = 1.0;
+            cat_rates[cat] = 1.0;
         }
+        cat_times[cat] = value * cat_rates[cat];
+    }
+    tree->getModelFactory()->getTransDervs(ncat, cat_times, cached_dervs.data(), 0, trans_buffer);
+    for (int cat = 0; cat < ncat; cat++) {
+        double rate_val = cat_rates[cat];
+        double prop_val = site_rate->getProp(cat);
         double coeff1 = rate_val * prop_val;
         double coeff2 = rate_val * coeff1;
-        tree->getModelFactory()->computeTransDerv(value * rate_val, trans_mat, trans_derv1, trans_derv2);
+        const double *mat = cached_dervs[cat].get(), *mat_derv1 = mat + trans_size, *mat_derv2 = mat_derv1 + trans_size;
         for (int i = 0; i < trans_size; i++) {
-            sum_trans[i] += trans_mat[i] * prop_val;
-            sum_derv1[i] += trans_derv1[i] * coeff1;
-            sum_derv2[i] += trans_derv2[i] * coeff2;
+            sum_trans[i] += mat[i] * prop_val;
+            sum_derv1[i] += mat_derv1[i] * coeff1;
+            sum_derv2[i] += mat_derv2[i] * coeff2;
         }
     }
     
@@ -430,9 +445,7 @@ AlignmentPairwise::~AlignmentPairwise()
     delete [] sum_derv2;
     delete [] sum_derv1;
     delete [] sum_trans;
-    delete [] trans_derv2;
-    delete [] trans_derv1;
+    delete [] trans_buffer;
     delete [] sum_trans_mat;
-    delete [] trans_mat;
     delete [] pair_freq;
 }
@@ -125,13 +125,12 @@ protected:
                               //size is num_states_squared times 1 (or by the number
                               //of categories).
     int        trans_size;    //number of elements (rows x columns) in transition matrices
-    double*    trans_mat;     //used in computeFunction(),
     double*    sum_trans_mat; //used in computeFunction()
-    double*    trans_derv1;   //used in computeFuncDerv()
-    double*    trans_derv2;   //used in computeFuncDerv()
     double*    sum_derv1;     //used in computeFuncDerv()
     double*    sum_derv2;     //used in computeFuncDerv()
     double*    sum_trans;     //used in computeFuncDerv()
+    double*    trans_buffer;  //matrices (and derivatives) of all categories if they are
+                              //not cached, used in computeFunction() and computeFuncDerv()
 
     int        seq_id1;
     int        seq_id2;
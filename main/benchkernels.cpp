@@ -0,0 +1,337 @@
+/*
+ * benchkernels.cpp
+ * Micro-benchmark of the likelihood kernels on synthetic data (bench_kernels target)
+ */
+
+#include "benchkernels.h"
+#include "tree/phylotree.h"
+#include "model/modelfactory.h"
+#include "utils/timeutil.h"
+#include "vectorclass/instrset.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/** options of the kernel benchmark */
+struct KernelBenchOptions {
+    IntVector states;
+    IntVector cats;
+    vector<LikelihoodKernel> kernels;
+    IntVector safe;
+    IntVector threads;
+    int taxa;
+    int patterns;
+    int reps;
+    int seed;
+    string out_file;
+};
+
+static void printKernelBenchmarkUsage(char *prog) {
+    cout << "Usage: " << prog << " [OPTIONS]" << endl
+    << "Time the likelihood kernels on random alignments and trees, no input files needed." << endl
+    << "Each option takes a comma-separated list, all combinations are benchmarked." << endl
+    << "  --states LIST        Number of states: 2, 4, 20 or 61 (default: 2,4,20,61)" << endl
+    << "  --cats LIST          Number of Gamma rate categories (default: 1,4)" << endl
+    << "  --isa LIST           SIMD kernels: SSE, AVX, FMA, AVX512 (default: all supported)" << endl
+    << "  --safe LIST          0: normal, 1: -safe numerics (default: 0,1)" << endl
+    << "  --threads LIST       Number of threads (default: 1)" << endl
+    << "  --taxa NUM           Number of taxa (default: 16)" << endl
+    << "  --patterns NUM       Number of alignment patterns (default: 4096)" << endl
+    << "  --reps NUM           Number of timed calls per kernel (default: 10)" << endl
+    << "  --seed NUM           Random number seed (default: 1)" << endl
+    << "  -o FILE              Tab-separated results (default: bench_kernels.tsv)" << endl;
+}
+
+static void parseKernelBenchmarkArg(int argc, char *argv[], KernelBenchOptions &opt) {
+    opt.states = {2, 4, 20, 61};
+    opt.cats = {1, 4};
+    opt.safe = {0, 1};
+    opt.threads = {1};
+    opt.taxa = 16;
+    opt.patterns = 4096;
+    opt.reps = 10;
+    opt.seed = 1;
+    opt.out_file = "bench_kernels.tsv";
+
+    // all kernels compiled into this binary and supported by the CPU
+    int instruction_set = instrset_detect();
+    bool has_fma3 = (instruction_set >= LK_AVX) && hasFMA3();
+    opt.kernels.push_back(LK_SSE2);
+#if !defined(BINARY32) && !defined(__NOAVX__)
+    if (instruction_set >= LK_AVX)
+        opt.kernels.push_back(LK_AVX);
+    if (has_fma3)
+        opt.kernels.push_back(LK_AVX_FMA);
+#ifdef __AVX512KERNEL
+    if (instruction_set >= LK_AVX512)
+        opt.kernels.push_back(LK_AVX512);
+#endif
+#endif
+    vector<LikelihoodKernel> supported = opt.kernels;
+
+    for (int cnt = 1; cnt < argc; cnt++) {
+        try {
+            IntVector *list = NULL;
+            if (strcmp(argv[cnt], "--states") == 0)
+                list = &opt.states;
+            else if (strcmp(argv[cnt], "--cats") == 0)
+                list = &opt.cats;
+            else if (strcmp(argv[cnt], "--safe") == 0)
+                list = &opt.safe;
+            else if (strcmp(argv[cnt], "--threads") == 0)
+                list = &opt.threads;
+            if (list) {
+                if (cnt+1 >= argc)
+                    throw string("Use ") + argv[cnt] + " LIST";
+                list->clear();
+                convert_int_vec(argv[++cnt], *list);
+                continue;
+            }
+            if (strcmp(argv[cnt], "--isa") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --isa SSE,AVX,FMA,AVX512";
+                StrVector names;
+                convert_string_vec(argv[cnt], names);
+                opt.kernels.clear();
+                for (auto name : names) {
+                    LikelihoodKernel lk;
+                    if (name == "SSE")
+                        lk = LK_SSE2;
+                    else if (name == "AVX")
+                        lk = LK_AVX;
+                    else if (name == "FMA")
+                        lk = LK_AVX_FMA;
+                    else if (name == "AVX512")
+                        lk = LK_AVX512;
+                    else
+                        throw "Use --isa SSE,AVX,FMA,AVX512";
+                    if (find(supported.begin(), supported.end(), lk) == supported.end())
+                        outWarning(name + " kernel not supported by this CPU or binary, skipped");
+                    else
+                        opt.kernels.push_back(lk);
+                }
+                continue;
+            }
+            if (strcmp(argv[cnt], "--taxa") == 0) {
+                if (++cnt >= argc)
+                    throw "Use --taxa NUM";
+                opt.taxa = convert_int(argv[cnt]);
+                if (opt.taxa < 4)
+                    throw "At least 4 taxa needed";
+                continue;
+            }
+            if (strcmp(argv[cnt], "--patterns") == 0) {
+                if (++cnt >= argc)
+                    throw "Use --patterns NUM";
+                opt.patterns = convert_int(argv[cnt]);
+                if (opt.patterns < 1)
+                    throw "Positive --patterns needed";
+                continue;
+            }
+            if (strcmp(argv[cnt], "--reps") == 0) {
+                if (++cnt >= argc)
+                    throw "Use --reps NUM";
+                opt.reps = convert_int(argv[cnt]);
+                if (opt.reps < 1)
+                    throw "Positive --reps needed";
+                continue;
+            }
+            if (strcmp(argv[cnt], "--seed") == 0) {
+                if (++cnt >= argc)
+                    throw "Use --seed NUM";
+                opt.seed = convert_int(argv[cnt]);
+                continue;
+            }
+            if (strcmp(argv[cnt], "-o") == 0) {
+                if (++cnt >= argc)
+                    throw "Use -o FILE";
+                opt.out_file = argv[cnt];
+                continue;
+            }
+            if (strcmp(argv[cnt], "-h") == 0 || strcmp(argv[cnt], "--help") == 0) {
+                printKernelBenchmarkUsage(argv[0]);
+                exit(EXIT_SUCCESS);
+            }
+            throw string("Invalid \"") + argv[cnt] + "\" option.";
+        } catch (const char *str) {
+            outError(str);
+        } catch (string str) {
+            outError(str);
+        }
+    }
+    for (int nstates : opt.states)
+        if (nstates != 2 && nstates != 4 && nstates != 20 && nstates != 61)
+            outError("Number of states must be 2, 4, 20 or 61");
+    for (int ncat : opt.cats)
+        if (ncat < 1)
+            outError("Number of categories must be positive");
+}
+
+/**
+ create random sequences with the given number of distinct site patterns
+ @param nstates number of states
+ @param[out] seq_type sequence type for Alignment::buildPattern()
+ @return alignment without a file
+ */
+static Alignment *createRandomAlignment(int nstates, int ntaxa, int npatterns, string &seq_type) {
+    StrVector alphabet;
+    switch (nstates) {
+    case 2: seq_type = "BIN"; alphabet = {"0", "1"}; break;
+    case 4: seq_type = "DNA"; alphabet = {"A", "C", "G", "T"}; break;
+    case 20:
+        seq_type = "AA";
+        for (const char *aa = "ARNDCQEGHILKMFPSTWYV"; *aa; aa++)
+            alphabet.push_back(string(1, *aa));
+        break;
+    default:
+        // sense codons of the standard genetic code
+        seq_type = "CODON";
+        const char *nt = "ACGT";
+        for (int i = 0; i < 64; i++) {
+            string codon = {nt[i/16], nt[(i/4)%4], nt[i%4]};
+            if (codon != "TAA" && codon != "TAG" && codon != "TGA")
+                alphabet.push_back(codon);
+        }
+        break;
+    }
+    Alignment *aln = new Alignment;
+    StrVector sequences(ntaxa);
+    for (int seq = 0; seq < ntaxa; seq++) {
+        aln->getSeqNames().push_back("T" + convertIntToString(seq+1));
+        for (int site = 0; site < npatterns; site++)
+            sequences[seq] += alphabet[random_int(alphabet.size())];
+    }
+    int nsite = sequences[0].length();
+    aln->buildPattern(sequences, (char*)seq_type.c_str(), ntaxa, nsite);
+    aln->countConstSite();
+    return aln;
+}
+
+/** run the kernels of one tree and write one result line per kernel */
+static void timeKernels(PhyloTree *tree, int reps, ostream &out, const string &config) {
+    // an internal branch, so that branch and derivative kernels see two partial_lh vectors
+    BranchVector branches;
+    tree->getInnerBranches(branches);
+    ASSERT(!branches.empty());
+    PhyloNode *dad = (PhyloNode*)branches[0].first;
+    PhyloNeighbor *dad_branch = (PhyloNeighbor*)dad->findNeighbor(branches[0].second);
+    tree->clearAllPartialLH();
+    tree->computeLikelihoodBranch(dad_branch, dad);
+
+    // all partial_lh vectors towards the branch plus the branch likelihood
+    double begin_time = getRealTime();
+    for (int rep = 0; rep < reps; rep++) {
+        tree->clearAllPartialLH();
+        tree->computeLikelihoodBranch(dad_branch, dad);
+    }
+    double full_time = (getRealTime() - begin_time) / reps;
+
+    begin_time = getRealTime();
+    for (int rep = 0; rep < reps; rep++)
+        tree->computeLikelihoodBranch(dad_branch, dad);
+    double branch_time = (getRealTime() - begin_time) / reps;
+
+    // theta is computed once per branch and reused by the Newton-Raphson iterations
+    double df, ddf;
+    tree->theta_computed = false;
+    tree->computeLikelihoodDerv(dad_branch, dad, &df, &ddf);
+    begin_time = getRealTime();
+    for (int rep = 0; rep < reps; rep++)
+        tree->computeLikelihoodDerv(dad_branch, dad, &df, &ddf);
+    double derv_time = (getRealTime() - begin_time) / reps;
+
+    // nominal costs per pattern and category of the internal-node kernels:
+    // partial: two children and the eigenvector transform (3 n^2 multiply-adds), reads two and writes one vector
+    // branch: dad*node*exp(eigenvalue*t) (3n), reads two vectors; derivatives: 3 dot products with theta (6n), reads theta
+    double nstates = tree->aln->num_states;
+    double ncat_mix = tree->getRate()->getNRate() * (tree->getModelFactory()->fused_mix_rate ? 1 : tree->getModel()->getNMixtures());
+    double npattern = tree->aln->getNPattern();
+    double num_partial = tree->leafNum - 2;
+    double partial_time = max(full_time - branch_time, 0.0) / num_partial;
+    struct { const char *name; double time, flops, bytes; } results[] = {
+        {"partial", partial_time, 6*nstates*nstates + nstates, 3*nstates*sizeof(double)},
+        {"branch", branch_time, 3*nstates, 2*nstates*sizeof(double)},
+        {"derv", derv_time, 6*nstates, nstates*sizeof(double)}
+    };
+    for (auto &res : results) {
+        double work = npattern * ncat_mix;
+        out << res.name << "\t" << config << "\t" << res.time
+            << "\t" << ((res.time > 0.0) ? npattern / res.time : 0.0)
+            << "\t" << ((res.time > 0.0) ? work * res.flops / res.time * 1e-9 : 0.0)
+            << "\t" << ((res.time > 0.0) ? work * res.bytes / res.time * 1e-9 : 0.0) << endl;
+    }
+}
+
+int runKernelBenchmark(int argc, char *argv[]) {
+    // default parameters of IQ-TREE, the alignment is created below
+    char *default_argv[] = {argv[0], (char*)"-s", (char*)"bench_kernels", (char*)"-quiet"};
+    parseArg(4, default_argv, Params::getInstance());
+    Params::getInstance().ignore_checkpoint = true;
+    // the benchmark changes the kernel and scaling of its trees, the global parameters keep the defaults
+    Params params = Params::getInstance();
+
+    KernelBenchOptions opt;
+    parseKernelBenchmarkArg(argc, argv, opt);
+    init_random(opt.seed);
+
+    const char *kernel_names[] = {"x86", "SSE", "SSE2", "SSE3", "SSSE3", "SSE4.1", "SSE4.2", "AVX", "FMA", "AVX512"};
+    ofstream out;
+    out.exceptions(ios::failbit | ios::badbit);
+    try {
+        out.open(opt.out_file.c_str());
+    } catch (ios::failure) {
+        outError(ERR_WRITE_OUTPUT, opt.out_file);
+    }
+    out << "kernel\tstates\tcats\tisa\tsafe\tthreads\ttaxa\tpatterns\tsec_per_call\tpatterns_per_sec\tgflops\tgbytes_per_sec" << endl;
+    out.precision(6);
+
+    for (int nstates : opt.states) {
+        string seq_type;
+        Alignment *aln = createRandomAlignment(nstates, opt.taxa, opt.patterns, seq_type);
+        for (int ncat : opt.cats) {
+            string model_name = (nstates == 2) ? "GTR2" : (nstates == 4) ? "GTR" : (nstates == 20) ? "LG" : "GY";
+            if (ncat > 1)
+                model_name += "+G" + convertIntToString(ncat);
+            for (LikelihoodKernel lk : opt.kernels) {
+                // memory alignment and padding depend on the kernel, so the tree is built again
+                params.SSE = lk;
+                PhyloTree *tree = new PhyloTree(aln);
+                tree->setParams(&params);
+                tree->generateRandomTree(YULE_HARDING);
+                tree->setAlignment(aln);
+                ModelsBlock *models_block = readModelsDefinition(params);
+                tree->setModelFactory(new ModelFactory(params, model_name, tree, models_block));
+                delete models_block;
+                tree->setModel(tree->getModelFactory()->model);
+                tree->setRate(tree->getModelFactory()->site_rate);
+                for (int safe : opt.safe) {
+                    params.lk_safe_scaling = safe;
+                    for (int threads : opt.threads) {
+#ifdef _OPENMP
+                        omp_set_num_threads(threads);
+#else
+                        threads = 1;
+#endif
+                        tree->setLikelihoodKernel(lk);
+                        tree->setNumThreads(threads);
+                        tree->initializeAllPartialLh();
+                        stringstream config;
+                        config << nstates << "\t" << ncat << "\t" << kernel_names[lk] << "\t" << tree->safe_numeric
+                            << "\t" << tree->num_threads << "\t" << opt.taxa << "\t" << aln->getNPattern();
+                        cout << model_name << " " << kernel_names[lk] << (tree->safe_numeric ? " safe" : "")
+                            << " " << tree->num_threads << " threads ..." << endl;
+                        timeKernels(tree, opt.reps, out, config.str());
+                        tree->deleteAllPartialLh();
+                    }
+                }
+                delete tree;
+            }
+        }
+        delete aln;
+    }
+    out.close();
+    cout << "Results written to " << opt.out_file << endl;
+    return EXIT_SUCCESS;
+}
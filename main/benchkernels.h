@@ -0,0 +1,19 @@
+/*
+ * benchkernels.h
+ * Micro-benchmark of the likelihood kernels on synthetic data (bench_kernels target)
+ */
+
+#ifndef BENCHKERNELS_H_
+#define BENCHKERNELS_H_
+
+/**
+ main function of the bench_kernels executable: time the partial likelihood,
+ branch likelihood and derivative kernels on random alignments and trees
+ across number of states, rate categories, SIMD kernels, -safe and threads
+ @param argc number of arguments
+ @param argv benchmark options, see printKernelBenchmarkUsage()
+ @return exit code
+ */
+int runKernelBenchmark(int argc, char *argv[]);
+
+#endif
@@ -52,6 +52,9 @@
 #include "nclextra/msetsblock.h"
 #include "nclextra/myreader.h"
 #include "phyloanalysis.h"
+#ifdef IQTREE_BENCH_KERNELS
+#include "benchkernels.h"
+#endif
 #include "tree/matree.h"
 //#include "ngs.h"
 #include "obsolete/parsmultistate.h"
@@ -2304,6 +2307,14 @@ int main(){
 */
 
 
+#ifdef IQTREE_BENCH_KERNELS
+/** main function of the bench_kernels target, see benchkernels.cpp */
+int main(int argc, char *argv[]) {
+    MPIHelper::getInstance().init(argc, argv);
+    atexit(funcExit);
+    return runKernelBenchmark(argc, argv);
+}
+#else
 int main(int argc, char *argv[]) {
 
     /*
@@ -2727,3 +2738,4 @@ int main(int argc, char *argv[]) {
     
     return EXIT_SUCCESS;
 }
+#endif // IQTREE_BENCH_KERNELS
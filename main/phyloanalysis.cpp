@@ -60,6 +60,7 @@
 #include "utils/timeutil.h"
 #include "tree/upperbounds.h"
 #include "utils/MPIHelper.h"
+#include "utils/profiler.h"
 #include "timetree.h"
 
 #ifdef USE_BOOSTER
@@ -855,6 +856,9 @@ void printOutfilesInfo(Params &params, IQTree &tree) {
         cout << "  All intermediate trees:        " << params.out_prefix << ".treels"
                 << endl;
 
+    if (params.profile)
+        cout << "  Hot-path profile:              " << params.out_prefix << ".profile.json" << endl;
+
     if (params.writeDistImdTrees) {
         tree.intermediateTrees.printTrees(string("ditrees"));
         cout << "  Distinct intermediate trees:   " << params.out_prefix <<  ".ditrees" << endl;
@@ -1732,6 +1736,7 @@ void pruneTaxa(Params &params, IQTree &iqtree, double *pattern_lh, NodeVector &p
     double mytime;
 
     if (params.aLRT_threshold <= 100 && (params.aLRT_replicates > 0 || params.localbp_replicates > 0)) {
+        ProfilePhaseScope profile_phase(PROF_PHASE_SUPPORT);
         mytime = getCPUTime();
         cout << "Testing tree branches by SH-like aLRT with " << params.aLRT_replicates << " replicates..." << endl;
         iqtree.setRootNode(params.root);
@@ -2144,7 +2149,10 @@ void startTreeReconstruction(Params &params, IQTree* &iqtree, ModelCheckpoint &m
        // FOR TUNG: swapping the order cause bug for -m TESTLINK
 //    iqtree.initSettings(params);
 
-    runModelFinder(params, *iqtree, model_info);
+    {
+        ProfilePhaseScope profile_phase(PROF_PHASE_MODELFINDER);
+        runModelFinder(params, *iqtree, model_info);
+    }
 }
         
 /**
@@ -2172,6 +2180,7 @@ void optimizeConTree(Params &params, IQTree *tree) {
 }
 
 void runTreeReconstruction(Params &params, IQTree* &iqtree) {
+    ProfilePhaseScope profile_phase(PROF_PHASE_SEARCH);
 
     //    string dist_file;
     params.startCPUTime = getCPUTime();
@@ -2306,6 +2315,8 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
 
 //#if defined __APPLE__ || defined __MACH__
         cout << "NOTE: " << (mem_required / 1048576) << " MB RAM (" << (mem_required / 1073741824) << " GB) is required!" << endl;
+        if (params.site_repeat > 0)
+            cout << "NOTE: --site-repeat saves computation but not memory, its repeat classes are included above" << endl;
 //#else
 //        cout << "NOTE: " << ((double) mem_size / 1000.0) / 1000 << " MB RAM is required!" << endl;
 //#endif
@@ -2325,6 +2336,9 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
     }
 
 
+    if (params.kernel_schedule_bench)
+        iqtree->benchmarkKernelSchedule();
+
 #ifdef _OPENMP
     if (iqtree->num_threads <= 0) {
         int bestThreads = iqtree->testNumThreads();
@@ -2579,6 +2593,9 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
 
     cout << "BEST SCORE FOUND : " << iqtree->getCurScore() << endl;
 
+    if (params.float_lh_check)
+        iqtree->checkFloatLh();
+
     if (params.write_candidate_trees) {
         printTrees(iqtree->getBestTrees(), params, ".imd_trees");
     }
@@ -2608,6 +2625,7 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
     
     /****** perform SH-aLRT test ******************/
     if ((params.aLRT_replicates > 0 || params.localbp_replicates > 0 || params.aLRT_test || params.aBayes_test) && !params.pll) {
+        ProfilePhaseScope profile_phase(PROF_PHASE_SUPPORT);
         double mytime = getRealTime();
         params.aLRT_replicates = max(params.aLRT_replicates, params.localbp_replicates);
         cout << endl;
@@ -2652,6 +2670,7 @@ void runTreeReconstruction(Params &params, IQTree* &iqtree) {
         iqtree->writeUFBootTrees(params);
 
     if (params.gbo_replicates && params.online_bootstrap && !iqtree->isSuperTreeUnlinked()) {
+        ProfilePhaseScope profile_phase(PROF_PHASE_UFBOOT);
         
         cout << endl << "Computing " << RESAMPLE_NAME << " consensus tree..." << endl;
         string splitsfile = params.out_prefix;
@@ -3134,7 +3153,17 @@ void runStandardBootstrap(Params &params, Alignment *alignment, IQTree *tree) {
     
     // 2018-06-21: bug fix: alignment might be changed by -m ...MERGE
     alignment = tree->aln;
-    
+
+    // --boot-reweight: replicates reuse the patterns of alignment with resampled frequencies,
+    // other resampling schemes and outputs of the replicate alignment need a new alignment
+    bool reweight = params.bootstrap_reweight && !alignment->isSuperAlignment() && !params.bootstrap_spec &&
+        params.jackknife_prop == 0.0 && !params.print_bootaln && !params.print_boot_site_freq && !params.print_tree_lh;
+    if (params.bootstrap_reweight && !reweight)
+        outWarning("--boot-reweight ignored for partitions, jackknife, -bsam, -wba, -wbsf and -wt");
+    IntVector orig_ptn_freq;
+    if (reweight)
+        alignment->getPatternFreq(orig_ptn_freq);
+
     // do bootstrap analysis
     for (int sample = bootSample; sample < params.num_bootstrap_samples; sample++) {
         cout << endl << "===> START " << RESAMPLE_NAME_UPPER << " REPLICATE NUMBER "
@@ -3146,13 +3175,20 @@ void runStandardBootstrap(Params &params, Alignment *alignment, IQTree *tree) {
         init_random(params.ran_seed + sample);
 
         Alignment* bootstrap_alignment;
-        cout << "Creating " << RESAMPLE_NAME << " alignment (seed: " << params.ran_seed+sample << ")..." << endl;
-
-        if (alignment->isSuperAlignment())
-            bootstrap_alignment = new SuperAlignment;
-        else
-            bootstrap_alignment = new Alignment;
-        bootstrap_alignment->createBootstrapAlignment(alignment, NULL, params.bootstrap_spec);
+        if (reweight) {
+            cout << "Reweighting alignment patterns (seed: " << params.ran_seed+sample << ")..." << endl;
+            IntVector ptn_weight;
+            alignment->resamplePatternWeights(ptn_weight);
+            alignment->setPatternFreq(ptn_weight);
+            bootstrap_alignment = alignment;
+        } else {
+            cout << "Creating " << RESAMPLE_NAME << " alignment (seed: " << params.ran_seed+sample << ")..." << endl;
+            if (alignment->isSuperAlignment())
+                bootstrap_alignment = new SuperAlignment;
+            else
+                bootstrap_alignment = new Alignment;
+            bootstrap_alignment->createBootstrapAlignment(alignment, NULL, params.bootstrap_spec);
+        }
 
         // restore randstream
         finish_random();
@@ -3239,7 +3275,8 @@ void runStandardBootstrap(Params &params, Alignment *alignment, IQTree *tree) {
         bootstrap_alignment = boot_tree->aln;
         delete boot_tree;
         // fix bug: bootstrap_alignment might be changed
-        delete bootstrap_alignment;
+        if (bootstrap_alignment != alignment)
+            delete bootstrap_alignment;
 
         // clear all checkpointed information
         tree->getCheckpoint()->keepKeyPrefix("iqtree");
@@ -3248,6 +3285,8 @@ void runStandardBootstrap(Params &params, Alignment *alignment, IQTree *tree) {
         tree->getCheckpoint()->dump(true);
     }
 
+    if (reweight)
+        alignment->setPatternFreq(orig_ptn_freq);
 
     if (params.consensus_type == CT_CONSENSUS_TREE && MPIHelper::getInstance().isMaster()) {
 
@@ -3282,6 +3321,7 @@ void runStandardBootstrap(Params &params, Alignment *alignment, IQTree *tree) {
 
             cout << endl << "===> ASSIGN " << RESAMPLE_NAME_UPPER
                 << " SUPPORTS TO THE TREE FROM ORIGINAL ALIGNMENT" << endl << endl;
+            ProfilePhaseScope profile_phase(PROF_PHASE_SUPPORT);
             MExtTree ext_tree;
             assignBootstrapSupport(boottrees_name.c_str(), 0, 1e6,
                     treefile_name.c_str(), false, treefile_name.c_str(),
@@ -3722,6 +3762,9 @@ void doSymTest(Alignment *alignment, Params &params) {
 void runPhyloAnalysis(Params &params, Checkpoint *checkpoint) {
     Alignment *alignment;
 
+    // start the clock of the profile report
+    Profiler::getInstance().setEnabled(params.profile);
+
     checkpoint->putBool("finished", false);
     checkpoint->setDumpInterval(params.checkpoint_dump_interval);
 
@@ -3905,6 +3948,11 @@ void runPhyloAnalysis(Params &params, Checkpoint *checkpoint) {
             ((PhyloSuperTreePlen*) tree)->printNNIcasesNUM();
         }
     }
+    if (params.profile && MPIHelper::getInstance().isMaster()) {
+        string profile_file = string(params.out_prefix) + ".profile.json";
+        Profiler::getInstance().writeJSON(profile_file.c_str(), tree->num_threads);
+    }
+
     // 2015-09-22: bug fix, move this line to before deleting tree
     alignment = tree->aln;
     delete tree;
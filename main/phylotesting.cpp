@@ -12,6 +12,8 @@
 #endif
 #include <iqtree_config.h>
 #include <numeric>
+#include <mutex>
+#include <condition_variable>
 #include "tree/phylotree.h"
 #include "tree/iqtree.h"
 #include "tree/phylosupertree.h"
@@ -1503,7 +1505,7 @@ void fixPartitions(PhyloSuperTree* super_tree) {
 string CandidateModel::evaluate(Params &params,
     ModelCheckpoint &in_model_info, ModelCheckpoint &out_model_info,
     ModelsBlock *models_block,
-    int &num_threads, int brlen_type)
+    int &num_threads, int brlen_type, int layout_threads)
 {
     //string model_name = name;
     Alignment *in_aln = aln;
@@ -1529,6 +1531,8 @@ string CandidateModel::evaluate(Params &params,
     iqtree->setLikelihoodKernel(params.SSE);
     iqtree->optimize_by_newton = params.optimize_by_newton;
     iqtree->setNumThreads(num_threads);
+    if (layout_threads > num_threads)
+        iqtree->setPatternLayoutThreads(layout_threads);
 
     iqtree->setCheckpoint(&in_model_info);
 #ifdef _OPENMP
@@ -2426,6 +2430,25 @@ void CandidateModelSet::filterSubst(int finished_model) {
             at(model).setFlag(MF_IGNORED);
 }
 
+/** state of a candidate model evaluated concurrently by CandidateModelSet::test() */
+enum ModelGroupState {
+    MG_WAITING, // not yet evaluated
+    MG_RUNNING, // evaluated by a thread group
+    MG_DONE,    // evaluated by a thread group, result not yet taken
+    MG_MAIN     // evaluated by the main loop
+};
+
+/** result of a candidate model evaluated by a thread group */
+struct ModelGroupResult {
+    ModelGroupResult() : state(MG_WAITING), start_model(0) {}
+    ModelGroupState state;
+    /** number of models finished by the main loop when the evaluation started */
+    int start_model;
+    CandidateModel info;
+    ModelCheckpoint out_model_info;
+    string tree_string;
+};
+
 CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, ModelCheckpoint &model_info,
     ModelsBlock *models_block, int num_threads, int brlen_type,
     string set_name, string in_model_name, bool merge_phase)
@@ -2479,6 +2502,18 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
     //    ssize = adjust->sample_size;
 	if (params.model_test_sample_size)
 		ssize = params.model_test_sample_size;
+
+    // number of thread groups evaluating models concurrently
+    int group_threads = params.model_group_threads;
+    int num_groups = 1;
+#ifdef _OPENMP
+    // only the SIMD kernels sum up per pattern block, independent of the number of threads
+    if (group_threads > 0 && num_threads >= 2*group_threads && !params.model_test_and_tree &&
+        !in_tree->aln->isSuperAlignment() && size() > 1 && params.SSE >= LK_SSE2 &&
+        !params.tree_freq_file && !params.site_freq_file)
+        num_groups = min(num_threads / group_threads, (int)size());
+#endif
+
 	if (set_name == "") {
         cout << "ModelFinder will test up to " << size() << " ";
         if (do_modelomatic)
@@ -2486,6 +2521,9 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
         else
             cout << getSeqTypeName(in_tree->aln->seq_type);
         cout << " models (sample size: " << ssize << ") ..." << endl;
+        if (num_groups > 1)
+            cout << "Evaluating models concurrently in " << num_groups << " groups of "
+                << group_threads << " thread(s)" << endl;
         if (params.model_test_and_tree == 0)
             cout << " No. Model         -LnL         df  AIC          AICc         BIC" << endl;
 	}
@@ -2524,14 +2562,114 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
     }
     
     
+    // With thread groups, the main loop below still finishes the models one after another,
+    // while the other groups evaluate the next models ahead. A model starts from the parameters
+    // of the best model so far in model_info, so a result is only taken if no better model was found
+    // between its start and its turn, otherwise the main loop evaluates it again.
+    // Filtered models wait for the filter, XXX+R[k] waits for XXX+R[k-1].
+    // A group lays out the pattern blocks of its kernels for num_threads, so its results are the
+    // same as those of a run without groups. Models only the main loop can run (MG_MAIN), and
+    // heterotachy models whose kernels do not sum up per block, are evaluated with all threads
+    // once the groups are idle. Threads wait for each other on group_cond.
+    vector<ModelGroupResult> group_results;
+    IntVector prev_k_model;
+    int finished_models = 0, last_best_model = -1, num_running = 0;
+    bool rates_filtered = false, subst_filtered = false, models_done = false, main_all_threads = false;
+    std::mutex group_mutex;
+    std::condition_variable group_cond;
+    if (num_groups > 1) {
+        group_results.resize(size());
+        prev_k_model.resize(size(), -1);
+        for (model = 0; model < size(); model++) {
+            if (at(model).subst_name == "" || posRateHeterotachy(at(model).getName()) != string::npos) {
+                // only known once the substitution models are finished
+                group_results[model].state = MG_MAIN;
+            } else if (model > 0) {
+                ModelCheckpoint prev_ckp;
+                at(model-1).saveCheckpoint(&prev_ckp);
+                CandidateModel prev_info;
+                if (prev_info.restoreCheckpointRminus1(&prev_ckp, &at(model)))
+                    prev_k_model[model] = model-1;
+            }
+        }
+    }
+
     //------------- MAIN FOR LOOP GOING THROUGH ALL MODELS TO BE TESTED ---------//
 
+#ifdef _OPENMP
+    if (num_groups > 1)
+        omp_set_nested(true);
+#pragma omp parallel num_threads(num_groups) if(num_groups > 1) private(model)
+#endif
+    {
+#ifdef _OPENMP
+    if (omp_get_thread_num() > 0) {
+        // thread group: evaluate the next model that can start
+        int eval_threads = group_threads;
+        while (true) {
+            ModelGroupResult *result = NULL;
+            ModelCheckpoint in_model_info;
+            {
+            std::unique_lock<std::mutex> lock(group_mutex);
+            while (!models_done && !result) {
+                for (int next = finished_models; !main_all_threads && next < size(); next++) {
+                    if (group_results[next].state != MG_WAITING || at(next).hasFlag(MF_IGNORED))
+                        continue;
+                    if ((next > rate_block && !rates_filtered) || (next > subst_block && !subst_filtered))
+                        break;
+                    if (prev_k_model[next] >= finished_models)
+                        continue;
+                    result = &group_results[next];
+                    result->state = MG_RUNNING;
+                    num_running++;
+                    result->start_model = finished_models;
+                    result->info = at(next);
+                    in_model_info = model_info;
+                    break;
+                }
+                // woken up when the main loop finished a model or the groups may run again
+                if (!result)
+                    group_cond.wait(lock);
+            }
+            }
+            if (!result)
+                break;
+            in_model_info.setFileName("");
+            result->info.set_name = set_name;
+            result->tree_string = result->info.evaluate(params,
+                in_model_info, result->out_model_info, models_block, eval_threads, brlen_type, num_threads);
+            {
+            std::lock_guard<std::mutex> lock(group_mutex);
+            result->state = MG_DONE;
+            num_running--;
+            }
+            group_cond.notify_all();
+        }
+    } else
+#endif
+    {
 	for (model = 0; model < size(); model++) {
-        if (model == rate_block+1)
+        bool ignored, main_only = false;
+        {
+        std::lock_guard<std::mutex> lock(group_mutex);
+        if (num_groups > 1)
+            main_only = (group_results[model].state == MG_MAIN);
+        if (model == rate_block+1) {
             filterRates(rate_block); // auto filter rate models
-        if (model == subst_block+1)
+            rates_filtered = true;
+        }
+        if (model == subst_block+1) {
             filterSubst(subst_block); // auto filter substitution model
-        if (at(model).hasFlag(MF_IGNORED)) {
+            subst_filtered = true;
+        }
+        ignored = at(model).hasFlag(MF_IGNORED);
+        if (ignored)
+            finished_models = model+1;
+        }
+        // the filters or the finished model may let the groups start further models
+        if (num_groups > 1)
+            group_cond.notify_all();
+        if (ignored) {
             model_scores.push_back(DBL_MAX);
             continue;
         }
@@ -2560,13 +2698,69 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
         ModelCheckpoint out_model_info;
 		//CandidateModel info;
 		//info.set_name = set_name;
-        at(model).set_name = set_name;
         string tree_string;
+        bool evaluated = false;
+
+        if (num_groups > 1) {
+            // take the result of the thread group if its start values are still those of the best model
+            ModelGroupResult &result = group_results[model];
+            ModelGroupState state;
+            {
+            std::unique_lock<std::mutex> lock(group_mutex);
+            while (result.state == MG_RUNNING)
+                group_cond.wait(lock);
+            state = result.state;
+            if (state == MG_WAITING)
+                result.state = MG_MAIN;
+            }
+            if (state == MG_DONE && last_best_model < result.start_model) {
+                at(model) = result.info;
+                tree_string = result.tree_string;
+                out_model_info.putSubCheckpoint(&result.out_model_info, "");
+                std::lock_guard<std::mutex> lock(group_mutex);
+                at(model).saveCheckpoint(&model_info);
+                evaluated = true;
+            }
+        }
 
         /***** main call to estimate model parameters ******/
-        tree_string = at(model).evaluate(params,
-            model_info, out_model_info, models_block, num_threads, brlen_type);
+        if (!evaluated) {
+            at(model).set_name = set_name;
+            int eval_threads = (num_groups > 1 && !main_only) ? group_threads : num_threads;
+            if (num_groups > 1 && main_only) {
+                // stop the groups from taking new models and wait for the running ones
+                std::unique_lock<std::mutex> lock(group_mutex);
+                main_all_threads = true;
+                while (num_running > 0)
+                    group_cond.wait(lock);
+            }
+            // a model the groups gave up on is evaluated like in a group, see above
+            if (num_groups > 1) {
+                // restoring from a checkpoint changes its state, so read from a copy while the groups copy model_info
+                ModelCheckpoint in_model_info;
+                {
+                std::lock_guard<std::mutex> lock(group_mutex);
+                in_model_info = model_info;
+                }
+                in_model_info.setFileName("");
+                tree_string = at(model).evaluate(params,
+                    in_model_info, out_model_info, models_block, eval_threads, brlen_type, num_threads);
+                std::lock_guard<std::mutex> lock(group_mutex);
+                at(model).saveCheckpoint(&model_info);
+            } else
+                tree_string = at(model).evaluate(params,
+                    model_info, out_model_info, models_block, eval_threads, brlen_type, num_threads);
+            if (num_groups > 1 && main_only) {
+                {
+                std::lock_guard<std::mutex> lock(group_mutex);
+                main_all_threads = false;
+                }
+                group_cond.notify_all();
+            }
+        }
 
+        {
+        std::lock_guard<std::mutex> lock(group_mutex);
         at(model).computeICScores(ssize);
         at(model).setFlag(MF_DONE);
 
@@ -2616,6 +2810,7 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
             if (params.model_test_criterion == MTC_AIC) {
                 model_info.putSubCheckpoint(&out_model_info, "");
                 best_aln = at(model).aln;
+                last_best_model = model;
             }
         }
 		if (at(model).AICc_score < best_score_AICc) {
@@ -2627,6 +2822,7 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
             if (params.model_test_criterion == MTC_AICC) {
                 model_info.putSubCheckpoint(&out_model_info, "");
                 best_aln = at(model).aln;
+                last_best_model = model;
             }
         }
 
@@ -2639,6 +2835,7 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
             if (params.model_test_criterion == MTC_BIC) {
                 model_info.putSubCheckpoint(&out_model_info, "");
                 best_aln = at(model).aln;
+                last_best_model = model;
             }
         }
 
@@ -2685,9 +2882,23 @@ CandidateModel CandidateModelSet::test(Params &params, PhyloTree* in_tree, Model
                 at(next).setFlag(MF_IGNORED);
             }
         }
-
+        finished_models = model+1;
+        }
+        if (num_groups > 1)
+            group_cond.notify_all();
 
 	}
+    {
+    std::lock_guard<std::mutex> lock(group_mutex);
+    models_done = true;
+    }
+    group_cond.notify_all();
+    }
+    }
+#ifdef _OPENMP
+    if (num_groups > 1)
+        omp_set_nested(false);
+#endif
 
     ASSERT(model_scores.size() == size());
 
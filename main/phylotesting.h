@@ -73,11 +73,13 @@ public:
      @param models_block models block
      @param num_thread number of threads
      @param brlen_type BRLEN_OPTIMIZE | BRLEN_FIX | BRLEN_SCALE | TOPO_UNLINKED
+     @param layout_threads number of threads the kernels lay out the patterns for, if more than
+            num_threads, to get the same results as with layout_threads threads
      @return tree string
      */
     string evaluate(Params &params,
                     ModelCheckpoint &in_model_info, ModelCheckpoint &out_model_info,
-                    ModelsBlock *models_block, int &num_threads, int brlen_type);
+                    ModelsBlock *models_block, int &num_threads, int brlen_type, int layout_threads = 0);
     
     /**
      evaluate concatenated alignment
@@ -41,6 +41,7 @@
 //#include "ngs.h"
 #include <string>
 #include "utils/timeutil.h"
+#include "utils/profiler.h"
 #include "nclextra/myreader.h"
 #include <sstream>
 
@@ -1373,17 +1374,15 @@ bool ModelFactory::isUnstableParameters() {
 
 void ModelFactory::startStoringTransMatrix() {
     if (!store_trans_matrix) return;
+    if (!trans_cache.isEnabled())
+        trans_cache.init(model->num_states * model->num_states, Params::getInstance().trans_cache_mem);
     is_storing = true;
 }
 
 void ModelFactory::stopStoringTransMatrix() {
     if (!store_trans_matrix) return;
     is_storing = false;
-    if (!empty()) {
-        for (iterator it = begin(); it != end(); it++)
-            delete it->second;
-        clear();
-    }
+    trans_cache.clear();
 }
 
 
@@ -1395,55 +1394,157 @@ double ModelFactory::computeTrans(double time, int state1, int state2, double &d
     return model->computeTrans(time, state1, state2, derv1, derv2);
 }
 
+/**
+    @return the cache key of a transition matrix
+*/
+static inline TransMatrixKey getTransMatrixKey(ModelSubst *model, double time, int mixture) {
+    TransMatrixKey key;
+    key.version = model->getRateMatrixVersion(mixture);
+    key.mixture = mixture;
+    memcpy(&key.time_bits, &time, sizeof(double));
+    return key;
+}
+
+/**
+    @param buffer caller memory for the matrices or NULL
+    @param size number of entries
+    @return a pointer to buffer that does not own it, or to newly allocated memory if buffer is NULL
+*/
+static inline TransMatrixPtr newTransMatrix(double *buffer, size_t size) {
+    if (buffer)
+        return TransMatrixPtr(TransMatrixPtr(), buffer);
+    return TransMatrixPtr(new double[size], std::default_delete<double[]>());
+}
+
+TransMatrixPtr ModelFactory::getTransMatrix(double time, int mixture, double *buffer) {
+    double start_time = Profiler::getInstance().startTime();
+    bool use_cache = isCachingTransMatrix();
+    TransMatrixPtr mat;
+    TransMatrixKey key;
+    if (use_cache) {
+        key = getTransMatrixKey(model, time, mixture);
+        mat = trans_cache.find(key, false);
+        if (mat) {
+            Profiler::getInstance().addSince(PROF_TRANS_MATRIX_HIT, 1, 0, start_time);
+            return mat;
+        }
+    }
+    // a cached matrix must outlive the caller's buffer
+    mat = newTransMatrix(use_cache ? NULL : buffer, model->num_states * model->num_states);
+    model->computeTransMatrix(time, (double*)mat.get(), mixture);
+    if (use_cache)
+        trans_cache.insert(key, mat, false);
+    Profiler::getInstance().addSince(PROF_TRANS_MATRIX_MISS, 1, 0, start_time);
+    return mat;
+}
+
+TransMatrixPtr ModelFactory::getTransDerv(double time, int mixture, double *buffer) {
+    double start_time = Profiler::getInstance().startTime();
+    bool use_cache = isCachingTransMatrix();
+    int mat_size = model->num_states * model->num_states;
+    TransMatrixPtr mat;
+    TransMatrixKey key;
+    if (use_cache) {
+        key = getTransMatrixKey(model, time, mixture);
+        mat = trans_cache.find(key, true);
+        if (mat) {
+            Profiler::getInstance().addSince(PROF_TRANS_MATRIX_HIT, 1, 0, start_time);
+            return mat;
+        }
+    }
+    // 3 matricies, a cached entry must outlive the caller's buffer
+    mat = newTransMatrix(use_cache ? NULL : buffer, mat_size * 3);
+    double *trans_entry = (double*)mat.get();
+    model->computeTransDerv(time, trans_entry, trans_entry+mat_size, trans_entry+(mat_size*2), mixture);
+    if (use_cache)
+        trans_cache.insert(key, mat, true);
+    Profiler::getInstance().addSince(PROF_TRANS_MATRIX_MISS, 1, 0, start_time);
+    return mat;
+}
+
+void ModelFactory::getTransMatrices(int num_times, double *times, TransMatrixPtr *mats, int mixture, double *buffer) {
+    getTransBatch(num_times, times, mats, mixture, false, buffer);
+}
+
+void ModelFactory::getTransDervs(int num_times, double *times, TransMatrixPtr *mats, int mixture, double *buffer) {
+    getTransBatch(num_times, times, mats, mixture, true, buffer);
+}
+
+void ModelFactory::getTransBatch(int num_times, double *times, TransMatrixPtr *mats, int mixture, bool need_derv,
+    double *buffer)
+{
+    double start_time = Profiler::getInstance().startTime();
+    size_t entry_size = model->num_states * model->num_states * (need_derv ? 3 : 1);
+    int k;
+    if (!isCachingTransMatrix()) {
+        TransMatrixPtr block_ptr = newTransMatrix(buffer, num_times * entry_size);
+        double *block = (double*)block_ptr.get();
+        if (need_derv)
+            model->computeTransDervBatch(num_times, times, block, mixture);
+        else
+            model->computeTransMatrixBatch(num_times, times, block, mixture);
+        for (k = 0; k < num_times; k++)
+            mats[k] = TransMatrixPtr(block_ptr, block + k*entry_size);
+        Profiler::getInstance().addSince(PROF_TRANS_MATRIX_MISS, num_times, 0, start_time);
+        return;
+    }
+    int num_miss = 0;
+    int miss_id[num_times];
+    double miss_times[num_times];
+    for (k = 0; k < num_times; k++) {
+        mats[k] = trans_cache.find(getTransMatrixKey(model, times[k], mixture), need_derv);
+        if (!mats[k]) {
+            miss_id[num_miss] = k;
+            miss_times[num_miss++] = times[k];
+        }
+    }
+    if (num_miss < num_times)
+        Profiler::getInstance().add(PROF_TRANS_MATRIX_HIT, num_times - num_miss, 0, 0.0);
+    if (num_miss == 0)
+        return;
+    // all missing matrices share one block owned by the cache, each entry refers into it
+    TransMatrixPtr block_ptr = newTransMatrix(NULL, num_miss * entry_size);
+    double *block = (double*)block_ptr.get();
+    if (need_derv)
+        model->computeTransDervBatch(num_miss, miss_times, block, mixture);
+    else
+        model->computeTransMatrixBatch(num_miss, miss_times, block, mixture);
+    for (k = 0; k < num_miss; k++) {
+        mats[miss_id[k]] = TransMatrixPtr(block_ptr, block + k*entry_size);
+        trans_cache.insert(getTransMatrixKey(model, miss_times[k], mixture), mats[miss_id[k]], need_derv);
+    }
+    Profiler::getInstance().addSince(PROF_TRANS_MATRIX_MISS, num_miss, 0, start_time);
+}
+
 void ModelFactory::computeTransMatrix(double time, double *trans_matrix, int mixture) {
-    if (!store_trans_matrix || !is_storing || model->isSiteSpecificModel()) {
+    if (!isCachingTransMatrix()) {
+        double start_time = Profiler::getInstance().startTime();
         model->computeTransMatrix(time, trans_matrix, mixture);
+        Profiler::getInstance().addSince(PROF_TRANS_MATRIX_MISS, 1, 0, start_time);
         return;
     }
     int mat_size = model->num_states * model->num_states;
-    iterator ass_it = find(round(time * 1e6));
-    if (ass_it == end()) {
-        // allocate memory for 3 matricies
-        double *trans_entry = new double[mat_size * 3];
-        trans_entry[mat_size] = trans_entry[mat_size+1] = 0.0;
-        model->computeTransMatrix(time, trans_entry, mixture);
-        ass_it = insert(value_type(round(time * 1e6), trans_entry)).first;
-    } else {
-        //if (verbose_mode >= VB_MAX)
-            //cout << "ModelFactory bingo" << endl;
-    }
-
-    memcpy(trans_matrix, ass_it->second, mat_size * sizeof(double));
+    TransMatrixPtr mat = getTransMatrix(time, mixture);
+    memcpy(trans_matrix, mat.get(), mat_size * sizeof(double));
 }
 
 void ModelFactory::computeTransDerv(double time, double *trans_matrix,
     double *trans_derv1, double *trans_derv2, int mixture) {
-    if (!store_trans_matrix || !is_storing || model->isSiteSpecificModel()) {
+    if (!isCachingTransMatrix()) {
+        double start_time = Profiler::getInstance().startTime();
         model->computeTransDerv(time, trans_matrix, trans_derv1, trans_derv2, mixture);
+        Profiler::getInstance().addSince(PROF_TRANS_MATRIX_MISS, 1, 0, start_time);
         return;
     }
     int mat_size = model->num_states * model->num_states;
-    iterator ass_it = find(round(time * 1e6));
-    if (ass_it == end()) {
-        // allocate memory for 3 matricies
-        double *trans_entry = new double[mat_size * 3];
-        trans_entry[mat_size] = trans_entry[mat_size+1] = 0.0;
-        model->computeTransDerv(time, trans_entry, trans_entry+mat_size, trans_entry+(mat_size*2), mixture);
-        ass_it = insert(value_type(round(time * 1e6), trans_entry)).first;
-    } else if (ass_it->second[mat_size] == 0.0 && ass_it->second[mat_size+1] == 0.0) {
-        double *trans_entry = ass_it->second;
-        model->computeTransDerv(time, trans_entry, trans_entry+mat_size, trans_entry+(mat_size*2), mixture);
-    }
-    memcpy(trans_matrix, ass_it->second, mat_size * sizeof(double));
-    memcpy(trans_derv1, ass_it->second + mat_size, mat_size * sizeof(double));
-    memcpy(trans_derv2, ass_it->second + (mat_size*2), mat_size * sizeof(double));
+    TransMatrixPtr mat = getTransDerv(time, mixture);
+    memcpy(trans_matrix, mat.get(), mat_size * sizeof(double));
+    memcpy(trans_derv1, mat.get() + mat_size, mat_size * sizeof(double));
+    memcpy(trans_derv2, mat.get() + (mat_size*2), mat_size * sizeof(double));
 }
 
 ModelFactory::~ModelFactory()
 {
-    for (iterator it = begin(); it != end(); it++)
-        delete it->second;
-    clear();
 }
 
 /************* FOLLOWING SERVE FOR JOINT OPTIMIZATION OF MODEL AND RATE PARAMETERS *******/
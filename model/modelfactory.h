@@ -26,6 +26,7 @@
 #include "nclextra/modelsblock.h"
 #include "utils/checkpoint.h"
 #include "alignment/alignment.h"
+#include "transmatrixcache.h"
 
 const double MIN_BRLEN_SCALE = 0.01;
 const double MAX_BRLEN_SCALE = 100.0;
@@ -56,11 +57,11 @@ string::size_type posPOMO(string &model_name);
 /**
 Store the transition matrix corresponding to evolutionary time so that one must not compute again. 
 For efficiency purpose esp. for protein (20x20) or codon (61x61).
-The values of the map contain 3 matricies consecutively: transition matrix, 1st, and 2nd derivative
+The cached entries contain 3 matricies consecutively: transition matrix, 1st, and 2nd derivative
 
 	@author BUI Quang Minh <minh.bui@univie.ac.at>
 */
-class ModelFactory : public unordered_map<int, double*>, public Optimization, public CheckpointFactory
+class ModelFactory : public Optimization, public CheckpointFactory
 {
 public:
 
@@ -129,6 +130,49 @@ public:
 	*/
 	void computeTransMatrix(double time, double *trans_matrix, int mixture = 0);
 
+	/**
+		get the transition probability matrix from the cache, computing it on a miss. Thread-safe.
+		@param time time between two events
+		@param mixture (optional) class for mixture model
+		@param buffer (optional) num_states * num_states entries to compute the matrix into if the cache
+			is not used, the matrix is allocated otherwise
+		@return num_states * num_states matrix, valid as long as the pointer (and buffer) is held
+	*/
+	TransMatrixPtr getTransMatrix(double time, int mixture = 0, double *buffer = NULL);
+
+	/**
+		get the transition probability matrix and its derivative 1 and 2 from the cache,
+		computing them on a miss. Thread-safe.
+		@param time time between two events
+		@param mixture (optional) class for mixture model
+		@param buffer (optional) 3 * num_states * num_states entries to compute the matrices into
+			if the cache is not used
+		@return the 3 matrices of num_states * num_states consecutively,
+			valid as long as the pointer (and buffer) is held
+	*/
+	TransMatrixPtr getTransDerv(double time, int mixture = 0, double *buffer = NULL);
+
+	/**
+		get the transition probability matrices for many times at once, e.g. all rate categories of a branch.
+		Matrices not in the cache are computed in one batch by the model. Thread-safe.
+		@param num_times number of times
+		@param times times between two events
+		@param[out] mats num_times matrices, as in getTransMatrix()
+		@param mixture (optional) class for mixture model
+		@param buffer (optional) num_times matrices to compute into if the cache is not used
+	*/
+	void getTransMatrices(int num_times, double *times, TransMatrixPtr *mats, int mixture = 0, double *buffer = NULL);
+
+	/**
+		get the transition probability matrices and derivatives for many times at once. Thread-safe.
+		@param num_times number of times
+		@param times times between two events
+		@param[out] mats num_times entries, as in getTransDerv()
+		@param mixture (optional) class for mixture model
+		@param buffer (optional) num_times entries of 3 matrices to compute into if the cache is not used
+	*/
+	void getTransDervs(int num_times, double *times, TransMatrixPtr *mats, int mixture = 0, double *buffer = NULL);
+
 	/**
 		Wrapper for computing the transition probability between two states.
 		@param time time between two events
@@ -212,10 +256,15 @@ public:
 	bool fused_mix_rate;
 
 	/**
-		TRUE to store transition matrix into this hash table for computation efficiency
+		TRUE to store transition matrix into trans_cache for computation efficiency
 	*/
 	bool store_trans_matrix;
 
+	/**
+		cache of transition matrices, used while is_storing
+	*/
+	TransMatrixCache trans_cache;
+
 	/**
 		TRUE for storing process
 	*/
@@ -266,6 +315,19 @@ public:
 
 protected:
 
+	/**
+		common part of getTransMatrices() and getTransDervs()
+		@param need_derv true to get the derivatives as well
+	*/
+	void getTransBatch(int num_times, double *times, TransMatrixPtr *mats, int mixture, bool need_derv, double *buffer);
+
+	/**
+		@return TRUE if transition matrices are currently taken from and stored into trans_cache
+	*/
+	bool isCachingTransMatrix() {
+		return store_trans_matrix && is_storing && !model->isSiteSpecificModel();
+	}
+
 	/**
 		this function is served for the multi-dimension optimization. It should pack the model parameters
 		into a vector that is index from 1 (NOTE: not from 0)
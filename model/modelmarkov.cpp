@@ -24,6 +24,8 @@
 #include "modelunrest.h"
 #include <Eigen/Eigenvalues>
 #include <unsupported/Eigen/MatrixFunctions>
+#include "vectorclass/vectorclass.h"
+#include "vectorclass/vectormath_exp.h"
 using namespace Eigen;
 
 
@@ -522,6 +524,77 @@ void ModelMarkov::computeTransMatrix(double time, double *trans_matrix, int mixt
 //	delete [] exptime;
 }
 
+/**
+    compute exp(eigenvalue * time) for all times and eigenvalues, 4 at a time with vectorclass
+    @param num_times number of times
+    @param times the evolutionary times (already divided by total_num_subst)
+    @param eval eigenvalues
+    @param num_states number of eigenvalues
+    @param[out] eval_exp num_times rows of num_states values
+*/
+static void computeEigenExpBatch(int num_times, double *times, double *eval, int num_states, double *eval_exp) {
+    int size = num_times * num_states;
+    for (int k = 0; k < num_times; k++)
+        for (int i = 0; i < num_states; i++)
+            eval_exp[k*num_states+i] = eval[i] * times[k];
+    for (int i = 0; i < size; i += 4) {
+        Vec4d arg;
+        arg.load_partial(min(4, size-i), eval_exp+i);
+        exp(arg).store_partial(min(4, size-i), eval_exp+i);
+    }
+}
+
+void ModelMarkov::computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture) {
+    if (!is_reversible) {
+        ModelSubst::computeTransMatrixBatch(num_times, times, trans_matrices, mixture);
+        return;
+    }
+    double evol_times[num_times];
+    for (int k = 0; k < num_times; k++)
+        evol_times[k] = times[k] / total_num_subst;
+    Matrix<double,Dynamic,Dynamic,RowMajor> eval_exp(num_times, num_states);
+    computeEigenExpBatch(num_times, evol_times, eigenvalues, num_states, eval_exp.data());
+
+    // eigenvectors scaled by exp(eval*t) of all times stacked on top of each other,
+    // so that one product with the inverse eigenvectors gives all matrices consecutively
+    Map<Matrix<double,Dynamic,Dynamic,RowMajor>,Aligned> evectors(eigenvectors, num_states, num_states);
+    Map<Matrix<double,Dynamic,Dynamic,RowMajor>,Aligned> inv_evectors(inv_eigenvectors, num_states, num_states);
+    Matrix<double,Dynamic,Dynamic,RowMajor> scaled(num_times*num_states, num_states);
+    for (int k = 0; k < num_times; k++)
+        scaled.middleRows(k*num_states, num_states) = evectors * eval_exp.row(k).asDiagonal();
+    Map<Matrix<double,Dynamic,Dynamic,RowMajor> > map_trans(trans_matrices, num_times*num_states, num_states);
+    map_trans.noalias() = scaled * inv_evectors;
+}
+
+void ModelMarkov::computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture) {
+    if (!is_reversible) {
+        ModelSubst::computeTransDervBatch(num_times, times, trans_dervs, mixture);
+        return;
+    }
+    double evol_times[num_times];
+    for (int k = 0; k < num_times; k++)
+        evol_times[k] = times[k] / total_num_subst;
+    Matrix<double,Dynamic,Dynamic,RowMajor> eval_exp(num_times, num_states);
+    computeEigenExpBatch(num_times, evol_times, eigenvalues, num_states, eval_exp.data());
+
+    // per time: eigenvectors scaled by exp(eval*t), eval*exp(eval*t) and eval^2*exp(eval*t) on top of each
+    // other, the product with the inverse eigenvectors gives P(t) and both derivatives consecutively
+    Map<Array<double,1,Dynamic> > eval(eigenvalues, num_states);
+    Map<Matrix<double,Dynamic,Dynamic,RowMajor>,Aligned> evectors(eigenvectors, num_states, num_states);
+    Map<Matrix<double,Dynamic,Dynamic,RowMajor>,Aligned> inv_evectors(inv_eigenvectors, num_states, num_states);
+    Matrix<double,Dynamic,Dynamic,RowMajor> scaled(3*num_states, num_states);
+    for (int k = 0; k < num_times; k++) {
+        Array<double,1,Dynamic> exp_derv0 = eval_exp.row(k).array();
+        Array<double,1,Dynamic> exp_derv1 = exp_derv0 * eval;
+        Array<double,1,Dynamic> exp_derv2 = exp_derv1 * eval;
+        scaled.topRows(num_states) = evectors * exp_derv0.matrix().asDiagonal();
+        scaled.middleRows(num_states, num_states) = evectors * exp_derv1.matrix().asDiagonal();
+        scaled.bottomRows(num_states) = evectors * exp_derv2.matrix().asDiagonal();
+        Map<Matrix<double,Dynamic,Dynamic,RowMajor> > map_dervs(trans_dervs + k*3*num_states*num_states, 3*num_states, num_states);
+        map_dervs.noalias() = scaled * inv_evectors;
+    }
+}
+
 double ModelMarkov::computeTrans(double time, int state1, int state2) {
 
     if (is_reversible) {
@@ -923,6 +996,35 @@ double ModelMarkov::targetFunk(double x[]) {
 
 }
 
+bool ModelMarkov::computeGradient(double x[], double dfx[], double &fx) {
+	if (!phylo_tree || phylo_tree->getModel() != this || !phylo_tree->isAnalyticGradientWanted(getNDim()))
+		return false;
+	fx = targetFunk(x);
+	if (fx >= 1.0e+30)
+		return false;
+	LikelihoodSensitivity sens;
+	phylo_tree->computeLikelihoodSensitivity(sens);
+	// the transition matrices are cheap to recompute, so central differences are used on them
+	int ndim = getNDim();
+	for (int dim = 1; dim <= ndim; dim++) {
+		double temp = x[dim];
+		double h = getGradientStep(temp);
+		x[dim] = temp + h;
+		getVariables(x);
+		decomposeRateMatrix();
+		double lh_plus = phylo_tree->computeLinearLikelihood(sens);
+		x[dim] = temp - h;
+		getVariables(x);
+		decomposeRateMatrix();
+		double lh_minus = phylo_tree->computeLinearLikelihood(sens);
+		x[dim] = temp;
+		dfx[dim] = -(lh_plus - lh_minus) / (2.0*h);
+	}
+	getVariables(x);
+	decomposeRateMatrix();
+	return true;
+}
+
 bool ModelMarkov::isUnstableParameters() {
 	int nrates = getNumRateEntries();
 	int i;
@@ -1178,6 +1280,8 @@ void ModelMarkov::decomposeRateMatrixNonrev() {
 void ModelMarkov::decomposeRateMatrix(){
 	int i, j, k = 0;
 
+    newRateMatrixVersion();
+
     if (!is_reversible) {
         decomposeRateMatrixNonrev();
         return;
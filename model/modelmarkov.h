@@ -283,6 +283,27 @@ public:
 	virtual void computeTransDerv(double time, double *trans_matrix, 
 		double *trans_derv1, double *trans_derv2, int mixture = 0);
 
+	/**
+		compute the transition probability matrices for many times at once. For reversible models
+		exp(eigenvalue*time) is computed SIMD-wide for all times and the eigenvector products
+		of all times form one matrix product.
+		@param num_times number of times
+		@param times times between two events
+        @param mixture (optional) class for mixture model
+		@param trans_matrices (OUT) num_times consecutive transition matrices
+	*/
+	virtual void computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture = 0);
+
+	/**
+		compute the transition probability matrices and the derivative 1 and 2 for many times at once,
+		for reversible models with one small matrix product per time
+		@param num_times number of times
+		@param times times between two events
+        @param mixture (optional) class for mixture model
+		@param trans_dervs (OUT) for every time the transition matrix, 1st and 2nd derivative consecutively
+	*/
+	virtual void computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture = 0);
+
 	/**
 		@return the number of dimensions
 	*/
@@ -302,6 +323,16 @@ public:
 	*/
 	virtual double targetFunk(double x[]);
 
+	/**
+		analytic derivative of targetFunk from the derivatives of the log-likelihood by the
+		transition matrices, see PhyloTree::computeLikelihoodSensitivity()
+		@param x the input vector x
+		@param dfx (OUT) the derivative at x
+		@param fx (OUT) the function value at x
+		@return false if not supported for this model
+	*/
+	virtual bool computeGradient(double x[], double dfx[], double &fx);
+
 	/**
 	 * setup the bounds for joint optimization with BFGS
 	 */
@@ -1487,6 +1487,16 @@ void ModelMixture::computeTransDerv(double time, double *trans_matrix,
     at(mixture)->computeTransDerv(time, trans_matrix, trans_derv1, trans_derv2);
 }
 
+void ModelMixture::computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture) {
+    ASSERT(mixture < getNMixtures());
+    at(mixture)->computeTransMatrixBatch(num_times, times, trans_matrices);
+}
+
+void ModelMixture::computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture) {
+    ASSERT(mixture < getNMixtures());
+    at(mixture)->computeTransDervBatch(num_times, times, trans_dervs);
+}
+
 int ModelMixture::getNDim() {
 //	int dim = (fix_prop) ? 0: (size()-1);
     int dim = 0;
@@ -1635,6 +1645,7 @@ double ModelMixture::optimizeWithEM(double gradient_epsilon) {
     tree->setParams(phylo_tree->params);
     tree->setLikelihoodKernel(phylo_tree->sse);
     tree->setNumThreads(phylo_tree->num_threads);
+    tree->pattern_layout_threads = phylo_tree->pattern_layout_threads;
     
     // initialize model
     ModelFactory *model_fac = new ModelFactory();
@@ -118,6 +118,12 @@ public:
 	 */
     virtual ModelSubst* getMixtureClass(int cat) { return at(cat); }
 
+    /**
+        @param mixture mixture class
+        @return rate matrix version of the mixture class
+    */
+    virtual int64_t getRateMatrixVersion(int mixture = 0) { return at(mixture)->getRateMatrixVersion(); }
+
 	/**
 	 * @param cat mixture class ID
 	 * @param m mixture model class to set
@@ -155,6 +161,17 @@ public:
 	virtual void computeTransDerv(double time, double *trans_matrix, 
 		double *trans_derv1, double *trans_derv2, int mixture = 0);
 
+	/**
+		compute the transition probability matrices of a mixture class for many times at once
+	*/
+	virtual void computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture = 0);
+
+	/**
+		compute the transition probability matrices and the derivative 1 and 2 of a mixture class
+		for many times at once
+	*/
+	virtual void computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture = 0);
+
 	/**
 		@return the number of dimensions
 	*/
@@ -1092,6 +1092,10 @@ void ModelPoMo::set_heterozygosity_boundaries() {
 // anymore.
 
 // TODO DS: The parameter mixture is unused at the moment.
+void ModelPoMo::computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture) {
+  ModelSubst::computeTransMatrixBatch(num_times, times, trans_matrices, mixture);
+}
+
 void ModelPoMo::computeTransMatrix(double time, double *trans_matrix, int mixture) {
   MatrixExpTechnique technique = phylo_tree->params->matrix_exp_technique;
   if (technique == MET_SCALING_SQUARING || !is_reversible) {
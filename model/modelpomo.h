@@ -289,6 +289,12 @@ class ModelPoMo : virtual public ModelMarkov
 	*/
 	virtual void computeTransMatrix(double time, double *trans_matrix, int mixture = 0);
 
+	/**
+     compute the transition probability matrices for many times at once, one by one
+     with computeTransMatrix() as the matrix exponential depends on the technique
+	*/
+	virtual void computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture = 0);
+
     /**
      *  Set the scale factor of the mutation rates to NEW_SCALE.
      *
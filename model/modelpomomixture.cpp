@@ -259,3 +259,8 @@ void ModelPoMoMixture::computeTransMatrix(double time, double *trans_matrix, int
   ASSERT(mixture < getNMixtures());
   at(mixture)->computeTransMatrix(time, trans_matrix);
 }
+
+void ModelPoMoMixture::computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture) {
+  ASSERT(mixture < getNMixtures());
+  at(mixture)->computeTransMatrixBatch(num_times, times, trans_matrices);
+}
@@ -117,6 +117,11 @@ public:
 	*/
 	virtual void decomposeRateMatrix();
 
+    /**
+        @return rate matrix version, decomposeRateMatrix() computes all mixture classes at once
+    */
+    virtual int64_t getRateMatrixVersion(int mixture = 0) { return ModelPoMo::getRateMatrixVersion(); }
+
     /**
      * Report the state frequencies to the output file stream 'out'.
      *
@@ -158,6 +163,11 @@ public:
 	*/
 	virtual void computeTransMatrix(double time, double *trans_matrix, int mixture = 0);
 
+	/**
+     compute the transition probability matrices of a mixture class for many times at once
+	*/
+	virtual void computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture = 0);
+
 protected:
 
     /** normally false, set to true while optimizing rate heterogeneity */
@@ -65,6 +65,20 @@ public:
 	virtual void computeTransDerv(double time, double *trans_matrix, 
 		double *trans_derv1, double *trans_derv2, int mixture = 0);
 
+	/**
+		compute the transition probability matrices for many times, one by one
+	*/
+	virtual void computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture = 0) {
+		ModelSubst::computeTransMatrixBatch(num_times, times, trans_matrices, mixture);
+	}
+
+	/**
+		compute the transition probability matrices and derivatives for many times, one by one
+	*/
+	virtual void computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture = 0) {
+		ModelSubst::computeTransDervBatch(num_times, times, trans_dervs, mixture);
+	}
+
 	/**
 		To AVOID 'hides overloaded virtual functions
 		compute the transition probability between two states
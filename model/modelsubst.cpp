@@ -12,6 +12,18 @@
 #include "modelsubst.h"
 #include "utils/tools.h"
 
+/** last rate matrix version given to any model */
+static int64_t last_rate_matrix_version = 0;
+
+void ModelSubst::newRateMatrixVersion() {
+    int64_t version;
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+    version = ++last_rate_matrix_version;
+    rate_matrix_version = version;
+}
+
 ModelSubst::ModelSubst(int nstates) : Optimization(), CheckpointFactory()
 {
 	num_states = nstates;
@@ -22,6 +34,7 @@ ModelSubst::ModelSubst(int nstates) : Optimization(), CheckpointFactory()
 		state_freq[i] = 1.0 / num_states;
 	freq_type = FREQ_EQUAL;
     fixed_parameters = false;
+    newRateMatrixVersion();
 //    linked_model = NULL;
 }
 
@@ -71,6 +84,20 @@ void ModelSubst::computeTransMatrix(double time, double *trans_matrix, int mixtu
 }
 
 
+void ModelSubst::computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture) {
+	int nstates_sqr = num_states * num_states;
+	for (int i = 0; i < num_times; i++)
+		computeTransMatrix(times[i], trans_matrices + i*nstates_sqr, mixture);
+}
+
+void ModelSubst::computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture) {
+	int nstates_sqr = num_states * num_states;
+	for (int i = 0; i < num_times; i++) {
+		double *trans_matrix = trans_dervs + i*3*nstates_sqr;
+		computeTransDerv(times[i], trans_matrix, trans_matrix + nstates_sqr, trans_matrix + 2*nstates_sqr, mixture);
+	}
+}
+
 double ModelSubst::computeTrans(double time, int state1, int state2) {
 	double expt = exp(-time * num_states / (num_states-1));
 	if (state1 != state2) {
@@ -271,11 +271,44 @@ public:
 	virtual void computeTransDerv(double time, double *trans_matrix, 
 		double *trans_derv1, double *trans_derv2, int mixture = 0);
 
+	/**
+		compute the transition probability matrices for many times at once.
+		The default calls computeTransMatrix() for every time.
+		@param num_times number of times
+		@param times times between two events, e.g. branch lengths times category rates
+        @param mixture (optional) class for mixture model
+		@param trans_matrices (OUT) num_times consecutive transition matrices of num_states * num_states
+	*/
+	virtual void computeTransMatrixBatch(int num_times, double *times, double *trans_matrices, int mixture = 0);
+
+	/**
+		compute the transition probability matrices and the derivative 1 and 2 for many times at once.
+		The default calls computeTransDerv() for every time.
+		@param num_times number of times
+		@param times times between two events, e.g. branch lengths times category rates
+        @param mixture (optional) class for mixture model
+		@param trans_dervs (OUT) for every time 3 consecutive matrices of num_states * num_states:
+			the transition matrix, the 1st and the 2nd derivative
+	*/
+	virtual void computeTransDervBatch(int num_times, double *times, double *trans_dervs, int mixture = 0);
+
 	/**
 		decompose the rate matrix into eigenvalues and eigenvectors
 	*/
 	virtual void decomposeRateMatrix() {}
 
+    /**
+        @param mixture mixture class, ignored by models without mixture classes
+        @return version of the rate matrix of this model or of one of its mixture classes,
+        changed whenever it is decomposed, used to invalidate cached transition matrices.
+        Versions are unique among all models.
+    */
+    virtual int64_t getRateMatrixVersion(int mixture = 0) { return rate_matrix_version; }
+
+    /**
+        start a new rate matrix version, to be called when the eigen system of this model changes
+    */
+    void newRateMatrixVersion();
 
     /** 
         set number of optimization steps
@@ -371,6 +404,9 @@ public:
     /** true to fix parameters, otherwise false */
     bool fixed_parameters;
 
+    /** rate matrix version, see getRateMatrixVersion() */
+    int64_t rate_matrix_version;
+
 	/**
 	 state frequencies
 	 */
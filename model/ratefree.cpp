@@ -224,6 +224,29 @@ double RateFree::targetFunk(double x[]) {
 	return -phylo_tree->computeLikelihood();
 }
 
+bool RateFree::computeGradient(double x[], double dfx[], double &fx) {
+	if (!phylo_tree || !phylo_tree->isAnalyticGradientWanted(getNDim()))
+		return false;
+	fx = targetFunk(x);
+	LikelihoodSensitivity sens;
+	phylo_tree->computeLikelihoodSensitivity(sens);
+	int ndim = getNDim();
+	for (int dim = 1; dim <= ndim; dim++) {
+		double temp = x[dim];
+		double h = getGradientStep(temp);
+		x[dim] = temp + h;
+		getVariables(x);
+		double lh_plus = phylo_tree->computeLinearLikelihood(sens);
+		x[dim] = temp - h;
+		getVariables(x);
+		double lh_minus = phylo_tree->computeLinearLikelihood(sens);
+		x[dim] = temp;
+		dfx[dim] = -(lh_plus - lh_minus) / (2.0*h);
+	}
+	getVariables(x);
+	return true;
+}
+
 
 
 /**
@@ -504,6 +527,7 @@ double RateFree::optimizeWithEM() {
     tree->setParams(phylo_tree->params);
     tree->setLikelihoodKernel(phylo_tree->sse);
     tree->setNumThreads(phylo_tree->num_threads);
+    tree->pattern_layout_threads = phylo_tree->pattern_layout_threads;
 
     // initialize model
     ModelFactory *model_fac = new ModelFactory();
@@ -61,6 +61,16 @@ public:
 	*/
 	virtual double targetFunk(double x[]);
 
+	/**
+		analytic derivative of targetFunk from the derivatives of the log-likelihood by the
+		transition matrices, see PhyloTree::computeLikelihoodSensitivity()
+		@param x the input vector x
+		@param dfx (OUT) the derivative at x
+		@param fx (OUT) the function value at x
+		@return false if not supported for this model
+	*/
+	virtual bool computeGradient(double x[], double dfx[], double &fx);
+
 	/**
 	 * setup the bounds for joint optimization with BFGS
 	 */
@@ -0,0 +1,119 @@
+/*
+ * transmatrixcache.cpp
+ * Bounded, thread-safe cache of transition probability matrices P(t) and their derivatives
+ */
+
+#include "transmatrixcache.h"
+
+/** number of shards, enough to make lock contention between threads rare */
+const size_t TRANS_MATRIX_SHARDS = 64;
+
+int64_t TransMatrixCache::total_mem = 0;
+int64_t TransMatrixCache::max_total_mem = 0;
+
+TransMatrixCache::TransMatrixCache() : shards(TRANS_MATRIX_SHARDS) {
+    mat_size = 0;
+#ifdef _OPENMP
+    for (auto it = shards.begin(); it != shards.end(); it++)
+        omp_init_lock(&it->lock);
+#endif
+}
+
+TransMatrixCache::~TransMatrixCache() {
+    clear();
+#ifdef _OPENMP
+    for (auto it = shards.begin(); it != shards.end(); it++)
+        omp_destroy_lock(&it->lock);
+#endif
+}
+
+int64_t TransMatrixCache::addTotalMem(int64_t bytes) {
+    int64_t mem;
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+    mem = total_mem += bytes;
+    return mem;
+}
+
+int64_t TransMatrixCache::getTotalMem() {
+    return addTotalMem(0);
+}
+
+void TransMatrixCache::init(size_t mat_size, uint64_t max_mem) {
+    clear();
+    max_total_mem = max_mem;
+    // every matrix may hold the two derivatives as well
+    this->mat_size = (max_mem >= 3 * mat_size * sizeof(double)) ? mat_size : 0;
+}
+
+void TransMatrixCache::evictOldest(TransMatrixShard &shard) {
+    auto it = shard.entries.find(shard.order.front());
+    addTotalMem(-getEntryMem(it->second.has_derv));
+    shard.entries.erase(it);
+    shard.order.pop_front();
+}
+
+TransMatrixPtr TransMatrixCache::find(const TransMatrixKey &key, bool need_derv) {
+    TransMatrixPtr mat;
+    if (!mat_size)
+        return mat;
+    TransMatrixShard &shard = getShard(key);
+    lock(shard);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end() && (it->second.has_derv || !need_derv))
+        mat = it->second.mat;
+    unlock(shard);
+    return mat;
+}
+
+void TransMatrixCache::insert(const TransMatrixKey &key, TransMatrixPtr mat, bool has_derv) {
+    if (!mat_size)
+        return;
+    TransMatrixShard &shard = getShard(key);
+    lock(shard);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        // another thread was faster, or the derivatives are added to a matrix
+        if (has_derv && !it->second.has_derv) {
+            addTotalMem(getEntryMem(true) - getEntryMem(false));
+            it->second.mat = mat;
+            it->second.has_derv = true;
+        }
+    } else {
+        // reserve the memory first, so that concurrent inserts cannot all pass the budget
+        int64_t mem = getEntryMem(has_derv);
+        while (addTotalMem(mem) > max_total_mem) {
+            addTotalMem(-mem);
+            if (shard.order.empty()) {
+                // the budget is held by other shards or models
+                unlock(shard);
+                return;
+            }
+            evictOldest(shard);
+        }
+        TransMatrixEntry entry = {mat, has_derv};
+        shard.entries[key] = entry;
+        shard.order.push_back(key);
+    }
+    unlock(shard);
+}
+
+void TransMatrixCache::clear() {
+    for (auto it = shards.begin(); it != shards.end(); it++) {
+        lock(*it);
+        while (!it->order.empty())
+            evictOldest(*it);
+        unlock(*it);
+    }
+}
+
+size_t TransMatrixCache::size() {
+    size_t total = 0;
+    for (auto it = shards.begin(); it != shards.end(); it++) {
+        lock(*it);
+        total += it->entries.size();
+        unlock(*it);
+    }
+    return total;
+}
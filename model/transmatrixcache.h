@@ -0,0 +1,171 @@
+/*
+ * transmatrixcache.h
+ * Bounded, thread-safe cache of transition probability matrices P(t) and their derivatives
+ */
+
+#ifndef TRANSMATRIXCACHE_H
+#define TRANSMATRIXCACHE_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <memory>
+#include "utils/tools.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+    cached matrices: P(t) followed by its 1st and 2nd derivative if they were computed.
+    The memory stays valid as long as a TransMatrixPtr refers to it, even after eviction.
+*/
+typedef std::shared_ptr<const double> TransMatrixPtr;
+
+/** key of a cached matrix */
+struct TransMatrixKey {
+    /** rate matrix version of the model or mixture class, see ModelSubst::getRateMatrixVersion() */
+    int64_t version;
+    /** mixture class */
+    int mixture;
+    /** bits of the time (branch length times rate of the category) */
+    uint64_t time_bits;
+
+    bool operator==(const TransMatrixKey &other) const {
+        return version == other.version && mixture == other.mixture && time_bits == other.time_bits;
+    }
+};
+
+struct TransMatrixKeyHash {
+    size_t operator()(const TransMatrixKey &key) const {
+        uint64_t h = key.time_bits * 0x9E3779B97F4A7C15ULL;
+        h ^= (uint64_t)key.version + 0x7F4A7C15ULL + (h << 6) + (h >> 2);
+        h ^= (uint64_t)key.mixture + (h << 6) + (h >> 2);
+        return (size_t)h;
+    }
+};
+
+/** a cached matrix */
+struct TransMatrixEntry {
+    TransMatrixPtr mat;
+    /** true if mat also holds the 1st and 2nd derivative */
+    bool has_derv;
+};
+
+/**
+    one independently locked part of the cache. The padding of one cache line keeps the
+    members of neighbouring shards on different lines, whatever the alignment of the vector
+*/
+struct TransMatrixShard {
+    unordered_map<TransMatrixKey, TransMatrixEntry, TransMatrixKeyHash> entries;
+    /** keys in insertion order, the oldest one is evicted first */
+    deque<TransMatrixKey> order;
+#ifdef _OPENMP
+    omp_lock_t lock;
+#endif
+    char padding[CACHE_LINE_SIZE];
+};
+
+/**
+    Cache of transition matrices keyed by (rate matrix version, mixture class, time).
+    The time is branch length times the rate of the category, so categories with the same
+    product share a matrix. The key uses the exact bits of the time, hence a cached matrix is
+    identical to a freshly computed one. A change of the rate matrix gives a new version, so
+    stale matrices are never returned and age out of the cache.
+    The cache is split into shards with one lock each. The memory of all caches together, i.e. of
+    all models, is bounded by one process-wide budget; a cache over the budget evicts the oldest
+    matrices of the shard it inserts into, and does not insert if that shard is empty.
+*/
+class TransMatrixCache {
+public:
+
+    TransMatrixCache();
+
+    ~TransMatrixCache();
+
+    /**
+        (re)initialize an empty cache
+        @param mat_size number of entries of one matrix (num_states^2)
+        @param max_mem maximal memory in bytes of the matrices of all caches
+    */
+    void init(size_t mat_size, uint64_t max_mem);
+
+    /**
+        @return true if init() was called with enough memory to cache anything
+    */
+    bool isEnabled() { return mat_size > 0; }
+
+    /**
+        look up a matrix
+        @param key the key
+        @param need_derv true if the derivatives are needed as well
+        @return the matrix or an empty pointer if not cached
+    */
+    TransMatrixPtr find(const TransMatrixKey &key, bool need_derv);
+
+    /**
+        insert a matrix, evicting the oldest matrix of its shard if the shard is full
+        @param key the key
+        @param mat the matrix with mat_size entries, or 3*mat_size entries if has_derv
+        @param has_derv true if mat holds the derivatives
+    */
+    void insert(const TransMatrixKey &key, TransMatrixPtr mat, bool has_derv);
+
+    /**
+        remove all matrices. Pointers handed out before stay valid.
+    */
+    void clear();
+
+    /** @return number of cached matrices */
+    size_t size();
+
+    /** @return memory in bytes of the matrices of all caches */
+    static int64_t getTotalMem();
+
+protected:
+
+    /** @return the shard of a key */
+    TransMatrixShard &getShard(const TransMatrixKey &key) {
+        return shards[TransMatrixKeyHash()(key) % shards.size()];
+    }
+
+    void lock(TransMatrixShard &shard) {
+#ifdef _OPENMP
+        omp_set_lock(&shard.lock);
+#endif
+    }
+
+    void unlock(TransMatrixShard &shard) {
+#ifdef _OPENMP
+        omp_unset_lock(&shard.lock);
+#endif
+    }
+
+    /** @return memory in bytes of an entry */
+    int64_t getEntryMem(bool has_derv) {
+        return mat_size * (has_derv ? 3 : 1) * sizeof(double);
+    }
+
+    /**
+        add to the memory of all caches
+        @return the memory after adding
+    */
+    static int64_t addTotalMem(int64_t bytes);
+
+    /** remove the oldest entry of a locked shard */
+    void evictOldest(TransMatrixShard &shard);
+
+    /** the shards, created by the constructor */
+    vector<TransMatrixShard> shards;
+
+    /** number of entries of one matrix, 0 if the cache is disabled */
+    size_t mat_size;
+
+    /** memory in bytes of the matrices of all caches */
+    static int64_t total_mem;
+
+    /** maximal memory in bytes of the matrices of all caches (-mstore-mem) */
+    static int64_t max_total_mem;
+};
+
+#endif
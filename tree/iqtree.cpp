@@ -34,6 +34,7 @@
 #include "utils/tools.h"
 #include "utils/MPIHelper.h"
 #include "utils/pllnni.h"
+#include "utils/profiler.h"
 
 Params *globalParams;
 Alignment *globalAlignment;
@@ -55,6 +56,7 @@ void IQTree::init() {
     estimate_nni_cutoff = false;
     nni_cutoff = -1e6;
     nni_sort = false;
+    nni_par_trees_cleared = false;
     testNNI = false;
 //    print_tree_lh = false;
 //    write_intermediate_trees = 0;
@@ -100,33 +102,50 @@ void IQTree::setCheckpoint(Checkpoint *checkpoint) {
 
 void IQTree::saveUFBoot(Checkpoint *checkpoint) {
     checkpoint->startStruct("UFBoot");
+    int start = 0, end = boot_samples.size();
     if (MPIHelper::getInstance().isWorker()) {
         CKP_SAVE(sample_start);
         CKP_SAVE(sample_end);
-        checkpoint->startList(boot_samples.size());
-        checkpoint->setListElement(sample_start-1);
-        for (int id = sample_start; id != sample_end; id++) {
-            checkpoint->addListElement();
-            stringstream ss;
-            ss.precision(10);
-            ss << boot_counts[id] << " " << boot_logl[id] << " " << boot_orig_logl[id] << " " << boot_trees[id];
-            checkpoint->put("", ss.str());
-        }
-        checkpoint->endList();
+        start = sample_start;
+        end = sample_end;
     } else {
         CKP_SAVE(logl_cutoff);
         int boot_splits_size = boot_splits.size();
         CKP_SAVE(boot_splits_size);
-        checkpoint->startList(boot_samples.size());
-        for (int id = 0; id != boot_samples.size(); id++) {
-            checkpoint->addListElement();
-            stringstream ss;
-            ss.precision(10);
-            ss << boot_counts[id] << " " << boot_logl[id] << " " << boot_orig_logl[id] << " " << boot_trees[id];
-            checkpoint->put("", ss.str());
+    }
+    // every distinct tree is saved once, the samples refer to it by index
+    IntVector ckp_ids(boot_topologies.size(), -1);
+    IntVector topologies;
+    for (int id = start; id != end; id++)
+        if (boot_tree_ids[id] >= 0 && ckp_ids[boot_tree_ids[id]] < 0) {
+            ckp_ids[boot_tree_ids[id]] = topologies.size();
+            topologies.push_back(boot_tree_ids[id]);
         }
-        checkpoint->endList();
+    int ufboot_topologies = topologies.size();
+    CKP_SAVE(ufboot_topologies);
+    checkpoint->startStruct("Topologies");
+    checkpoint->startList(ufboot_topologies);
+    for (auto it = topologies.begin(); it != topologies.end(); it++) {
+        checkpoint->addListElement();
+        stringstream ss;
+        ss << boot_topology_hashes[*it] << " " << boot_topologies[*it];
+        checkpoint->put("", ss.str());
     }
+    checkpoint->endList();
+    checkpoint->endStruct();
+
+    checkpoint->startList(boot_samples.size());
+    if (MPIHelper::getInstance().isWorker())
+        checkpoint->setListElement(sample_start-1);
+    for (int id = start; id != end; id++) {
+        checkpoint->addListElement();
+        stringstream ss;
+        ss.precision(10);
+        ss << boot_counts[id] << " " << boot_logl[id] << " " << boot_orig_logl[id] << " "
+           << (boot_tree_ids[id] >= 0 ? ckp_ids[boot_tree_ids[id]] : -1);
+        checkpoint->put("", ss.str());
+    }
+    checkpoint->endList();
     checkpoint->endStruct();
 }
 
@@ -134,7 +153,7 @@ void IQTree::saveCheckpoint() {
     stop_rule.saveCheckpoint();
     candidateTrees.saveCheckpoint();
     
-    if (boot_samples.size() > 0 && !boot_trees.front().empty()) {
+    if (boot_samples.size() > 0 && boot_tree_ids.front() >= 0) {
         saveUFBoot(checkpoint);
         // boot_splits
         int id = 0;
@@ -158,19 +177,53 @@ void IQTree::restoreUFBoot(Checkpoint *checkpoint) {
     int sample_start, sample_end;
     CKP_RESTORE(sample_start);
     CKP_RESTORE(sample_end);
+    IntVector ids;
+    restoreBootTopologies(checkpoint, ids);
     checkpoint->setListElement(sample_start-1);
     for (id = sample_start; id != sample_end; id++) {
         checkpoint->addListElement();
         string str;
         checkpoint->getString("", str);
         ASSERT(!str.empty());
+        restoreBootSample(id, str, ids);
+    }
+    checkpoint->endList();
+    checkpoint->endStruct();
+}
+
+void IQTree::restoreBootTopologies(Checkpoint *checkpoint, IntVector &ids) {
+    ids.clear();
+    int ufboot_topologies = 0;
+    if (!CKP_RESTORE(ufboot_topologies))
+        return;
+    checkpoint->startStruct("Topologies");
+    checkpoint->startList(ufboot_topologies);
+    for (int i = 0; i < ufboot_topologies; i++) {
+        checkpoint->addListElement();
+        string str, tree_str;
+        checkpoint->getString("", str);
         stringstream ss(str);
-        ss >> boot_counts[id] >> boot_logl[id] >> boot_orig_logl[id] >> boot_trees[id];
+        uint64_t hash;
+        ss >> hash >> tree_str;
+        ids.push_back(addBootTopology(tree_str, hash));
     }
     checkpoint->endList();
     checkpoint->endStruct();
 }
 
+void IQTree::restoreBootSample(int sample, const string &str, IntVector &ids) {
+    stringstream ss(str);
+    string tree;
+    ss >> boot_counts[sample] >> boot_logl[sample] >> boot_orig_logl[sample] >> tree;
+    if (tree.empty() || tree[0] == '(') {
+        // older checkpoints store the newick string of every sample
+        setBootTree(sample, tree);
+    } else {
+        int id = convert_int(tree.c_str());
+        setBootTreeID(sample, id >= 0 ? ids[id] : -1);
+    }
+}
+
 void IQTree::restoreCheckpoint() {
     PhyloTree::restoreCheckpoint();
     stop_rule.restoreCheckpoint();
@@ -182,17 +235,18 @@ void IQTree::restoreCheckpoint() {
         CKP_RESTORE(logl_cutoff);
         // save boot_samples and boot_trees
         int id = 0;
-        checkpoint->startList(params->gbo_replicates);
-        boot_trees.resize(params->gbo_replicates);
+        IntVector ids;
+        boot_tree_ids.resize(params->gbo_replicates, -1);
         boot_logl.resize(params->gbo_replicates);
         boot_orig_logl.resize(params->gbo_replicates);
         boot_counts.resize(params->gbo_replicates);
+        restoreBootTopologies(checkpoint, ids);
+        checkpoint->startList(params->gbo_replicates);
         for (id = 0; id < params->gbo_replicates; id++) {
             checkpoint->addListElement();
             string str;
             checkpoint->getString("", str);
-            stringstream ss(str);
-            ss >> boot_counts[id] >> boot_logl[id] >> boot_orig_logl[id] >> boot_trees[id];
+            restoreBootSample(id, str, ids);
         }
         checkpoint->endList();
         int boot_splits_size = 0;
@@ -357,23 +411,23 @@ void IQTree::initSettings(Params &params) {
         }
 
         size_t orig_nptn = getAlnNPattern();
-#ifdef BOOT_VAL_FLOAT
-        size_t nptn = get_safe_upper_limit_float(orig_nptn);
-#else
-        size_t nptn = get_safe_upper_limit(orig_nptn);
-#endif
-        BootValType *mem = aligned_alloc<BootValType>(nptn * (size_t)(params.gbo_replicates));
-        memset(mem, 0, nptn * (size_t)(params.gbo_replicates) * sizeof(BootValType));
+        // pad the rows for the vectorized RELL product
+        size_t nptn = ((orig_nptn+63)/64)*64;
+        BootCountType *mem = aligned_alloc<BootCountType>(nptn * (size_t)(params.gbo_replicates));
+        memset(mem, 0, nptn * (size_t)(params.gbo_replicates) * sizeof(BootCountType));
         for (i = 0; i < params.gbo_replicates; i++)
             boot_samples[i] = mem + i*nptn;
+        boot_wide_ptns.clear();
+        boot_wide_counts.clear();
+        IntVector wide_index(orig_nptn, -1);
 
-        if (boot_trees.empty()) {
+        if (boot_tree_ids.empty()) {
             boot_logl.resize(params.gbo_replicates, -DBL_MAX);
             boot_orig_logl.resize(params.gbo_replicates, -DBL_MAX);
-            boot_trees.resize(params.gbo_replicates, "");
+            boot_tree_ids.resize(params.gbo_replicates, -1);
             boot_counts.resize(params.gbo_replicates, 0);
         } else {
-            cout << "CHECKPOINT: " << boot_trees.size() << " UFBoot trees and " << boot_splits.size() << " UFBootSplits restored" << endl;
+            cout << "CHECKPOINT: " << boot_tree_ids.size() << " UFBoot trees and " << boot_splits.size() << " UFBootSplits restored" << endl;
         }
         VerboseMode saved_mode = verbose_mode;
         verbose_mode = VB_QUIET;
@@ -386,15 +440,13 @@ void IQTree::initSettings(Params &params) {
                     bootstrap_alignment = new Alignment;
                 IntVector this_sample;
                 bootstrap_alignment->createBootstrapAlignment(aln, &this_sample, params.bootstrap_spec);
-                for (size_t j = 0; j < orig_nptn; j++)
-                    boot_samples[i][j] = this_sample[j];
+                storeBootSample(i, this_sample, wide_index);
                 bootstrap_alignment->printAlignment(params.aln_output_format, bootaln_name.c_str(), true);
                 delete bootstrap_alignment;
             } else {
                 IntVector this_sample;
                 aln->createBootstrapAlignment(this_sample, params.bootstrap_spec);
-                for (size_t j = 0; j < orig_nptn; j++)
-                    boot_samples[i][j] = this_sample[j];
+                storeBootSample(i, this_sample, wide_index);
             }
         }
         verbose_mode = saved_mode;
@@ -416,7 +468,7 @@ void IQTree::initSettings(Params &params) {
             for (size_t i = 0; i < params.gbo_replicates; i++) {
                 boot_samples_int[i].resize(nptn, 0);
                 for (size_t j = 0; j < orig_nptn; j++)
-                    boot_samples_int[i][j] = boot_samples[i][j];
+                    boot_samples_int[i][j] = getBootSampleCount(i, j);
                }
         }
 
@@ -431,7 +483,124 @@ void IQTree::initSettings(Params &params) {
     }
 }
 
+void IQTree::storeBootSample(int sample, IntVector &pattern_freq, IntVector &wide_index) {
+    BootCountType *counts = boot_samples[sample];
+    for (size_t ptn = 0; ptn < wide_index.size(); ptn++) {
+        if (wide_index[ptn] < 0 && pattern_freq[ptn] > UCHAR_MAX) {
+            // move the pattern into the wide table, with the counts of the previous samples
+            wide_index[ptn] = boot_wide_ptns.size();
+            boot_wide_ptns.push_back(ptn);
+            boot_wide_counts.push_back(IntVector(boot_samples.size(), 0));
+            for (int i = 0; i < sample; i++) {
+                boot_wide_counts.back()[i] = boot_samples[i][ptn];
+                boot_samples[i][ptn] = 0;
+            }
+        }
+        if (wide_index[ptn] >= 0)
+            boot_wide_counts[wide_index[ptn]][sample] = pattern_freq[ptn];
+        else
+            counts[ptn] = pattern_freq[ptn];
+    }
+}
+
+int IQTree::getBootSampleCount(int sample, int ptn) {
+    if (boot_samples[sample][ptn])
+        return boot_samples[sample][ptn];
+    for (size_t k = 0; k < boot_wide_ptns.size(); k++)
+        if (boot_wide_ptns[k] == ptn)
+            return boot_wide_counts[k][sample];
+    return 0;
+}
+
+/** mix the bits of x, as in the SplitMix64 generator */
+static inline uint64_t mixTopologyHash(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+    @return sum of the taxon keys of the subtree below node, and add the key of each split to hash
+ */
+static uint64_t computeSubtreeTopologyHash(Node *node, Node *dad, uint64_t &hash) {
+    if (node->isLeaf())
+        return mixTopologyHash(node->id + 1);
+    uint64_t sum = 0;
+    FOR_NEIGHBOR_IT(node, dad, it)
+        sum += computeSubtreeTopologyHash((*it)->node, node, hash);
+    // the taxon set of the subtree never contains the root taxon, so it identifies the split
+    hash += mixTopologyHash(sum);
+    return sum;
+}
+
+uint64_t IQTree::computeTopologyHash() {
+    uint64_t hash = 0;
+    computeSubtreeTopologyHash(root->neighbors[0]->node, root, hash);
+    // 0 marks trees that are not looked up by topology
+    return hash ? hash : 1;
+}
+
+int IQTree::addBootTopology(const string &tree_str, uint64_t hash) {
+    if (hash) {
+        auto it = boot_topology_map.find(hash);
+        if (it != boot_topology_map.end()) {
+            if (boot_topologies[it->second] == tree_str)
+                return it->second;
+            // hash collision of two topologies, keep the tree without looking it up
+            hash = 0;
+        }
+    }
+    int id;
+    if (!boot_topology_free.empty()) {
+        id = boot_topology_free.back();
+        boot_topology_free.pop_back();
+        boot_topologies[id] = tree_str;
+        boot_topology_hashes[id] = hash;
+    } else {
+        id = boot_topologies.size();
+        boot_topologies.push_back(tree_str);
+        boot_topology_hashes.push_back(hash);
+        boot_topology_refs.push_back(0);
+    }
+    if (hash)
+        boot_topology_map[hash] = id;
+    return id;
+}
+
+void IQTree::setBootTreeID(int sample, int id) {
+    int old_id = boot_tree_ids[sample];
+    if (old_id == id)
+        return;
+    if (id >= 0)
+        boot_topology_refs[id]++;
+    boot_tree_ids[sample] = id;
+    if (old_id >= 0 && --boot_topology_refs[old_id] == 0) {
+        // no sample refers to the tree any more
+        if (boot_topology_hashes[old_id])
+            boot_topology_map.erase(boot_topology_hashes[old_id]);
+        string().swap(boot_topologies[old_id]);
+        boot_topology_hashes[old_id] = 0;
+        boot_topology_free.push_back(old_id);
+    }
+}
+
+void IQTree::setBootTree(int sample, const string &tree_str) {
+    setBootTreeID(sample, tree_str.empty() ? -1 : addBootTopology(tree_str, 0));
+}
+
+const string &IQTree::getBootTree(int sample) {
+    static const string no_tree;
+    return (boot_tree_ids[sample] >= 0) ? boot_topologies[boot_tree_ids[sample]] : no_tree;
+}
+
+void IQTree::getBootTrees(StrVector &trees) {
+    trees.resize(boot_tree_ids.size());
+    for (int sample = 0; sample < boot_tree_ids.size(); sample++)
+        trees[sample] = getBootTree(sample);
+}
+
 IQTree::~IQTree() {
+    clearNNIParallelTrees(true);
     //if (bonus_values)
     //delete bonus_values;
     //bonus_values = NULL;
@@ -541,6 +710,7 @@ void IQTree::createPLLPartition(Params &params, ostream &pllPartitionFileHandle)
 }
 
 void IQTree::computeInitialTree(LikelihoodKernel kernel) {
+    ProfilePhaseScope profile_phase(PROF_PHASE_INITIAL_TREES);
     double start = getRealTime();
     string initTree;
     string out_file = params->out_prefix;
@@ -2150,6 +2320,7 @@ string IQTree::optimizeBranches(int maxTraversal) {
 }
 
 double IQTree::doTreeSearch() {
+    ProfilePhaseScope profile_phase(PROF_PHASE_SEARCH);
     
     if (params->numInitTrees > 1) {
         cout << "--------------------------------------------------------------------" << endl;
@@ -2175,6 +2346,7 @@ double IQTree::doTreeSearch() {
 
     /* Initialize candidate tree set */
     if (!getCheckpoint()->getBool("finishedCandidateSet")) {
+        ProfilePhaseScope profile_phase(PROF_PHASE_INITIAL_TREES);
         initCandidateTreeSet(treesPerProc, params->numNNITrees);
         // write best tree to disk
         printBestCandidateTree();
@@ -2243,6 +2415,11 @@ double IQTree::doTreeSearch() {
     int ufboot_count, ufboot_count_check;
     stop_rule.getUFBootCountCheck(ufboot_count, ufboot_count_check);
 
+    if (isSearchTrajectoryWanted())
+        doSearchTrajectories(cur_correlation);
+    else if (params->search_trajectories > 1)
+        outWarning("--search-traj is not supported for this analysis, running one search trajectory");
+
     while (!stop_rule.meetStopCondition(stop_rule.getCurIt(), cur_correlation)) {
 
         searchinfo.curIter = stop_rule.getCurIt();
@@ -2368,7 +2545,10 @@ double IQTree::doTreeSearch() {
         
     }
     
-    if(params->ufboot2corr) refineBootTrees();
+    if(params->ufboot2corr) {
+        ProfilePhaseScope profile_phase(PROF_PHASE_UFBOOT);
+        refineBootTrees();
+    }
 
     if (!early_stop)
         sendStopMessage();
@@ -2396,6 +2576,8 @@ double IQTree::doTreeSearch() {
     MPIHelper::getInstance().resetNumbers();
 #endif
 
+    mem_slots.report(cout);
+
     cout << "TREE SEARCH COMPLETED AFTER " << stop_rule.getCurIt() << " ITERATIONS"
     << " / Time: " << convert_time(getRealTime() - params->start_real_time) << endl << endl;
 
@@ -2403,6 +2585,108 @@ double IQTree::doTreeSearch() {
 
 }
 
+bool IQTree::isSearchTrajectoryWanted() {
+    if (params->search_trajectories <= 1 || num_threads < params->search_trajectories)
+        return false;
+    // all these modes keep per-iteration state in this tree that the trajectories would not share
+    if (params->gbo_replicates || params->pll || isSuperTree() || iqp_assess_quartet == IQP_BOOTSTRAP ||
+        MPIHelper::getInstance().getNumProcesses() > 1 || params->tabu || params->fixStableSplits ||
+        params->adaptPertubation || params->write_intermediate_trees || params->writeDistImdTrees ||
+        params->print_tree_lh || estimate_nni_cutoff || testNNI || !constraintTree.empty())
+        return false;
+    return true;
+}
+
+void IQTree::doSearchTrajectories(double &cur_correlation) {
+    int num_traj = params->search_trajectories;
+    int group_threads = num_threads / num_traj;
+    int procID = MPIHelper::getInstance().getProcessID();
+    cout << "Running " << num_traj << " search trajectories with " << group_threads << " thread(s) each" << endl;
+
+    // each trajectory runs on its own tree with its own partial likelihoods, sharing the model
+    vector<IQTree*> trees(num_traj);
+    for (int i = 0; i < num_traj; i++) {
+        IQTree *tree = new IQTree(aln);
+        tree->setParams(params);
+        tree->optimize_by_newton = optimize_by_newton;
+        tree->sse = sse;
+        tree->num_threads = group_threads;
+        tree->searchinfo.nni_type = searchinfo.nni_type;
+        tree->nni_cutoff = nni_cutoff;
+        tree->nni_sort = nni_sort;
+        tree->rooted = rooted;
+        tree->setModelFactory(getModelFactory());
+        // allocate the partial likelihoods once, outside the parallel region
+        tree->readTreeString(getTreeString());
+        tree->initializeAllPartialLh();
+        trees[i] = tree;
+    }
+
+    StrVector start_trees(num_traj), result_trees(num_traj);
+    DoubleVector result_scores(num_traj);
+
+    while (!stop_rule.meetStopCondition(stop_rule.getCurIt(), cur_correlation)) {
+        searchinfo.curIter = stop_rule.getCurIt();
+        // perturb on this tree, which owns the random stream and the candidate set
+        for (int i = 0; i < num_traj; i++) {
+            doTreePerturbation();
+            start_trees[i] = getTreeString();
+        }
+        // NNI acceptance compares against the best score found so far
+        for (int i = 0; i < num_traj; i++)
+            trees[i]->candidateTrees.initTrees(candidateTrees);
+
+#ifdef _OPENMP
+        omp_set_nested(true);
+#pragma omp parallel for num_threads(num_traj) schedule(static, 1)
+#endif
+        for (int i = 0; i < num_traj; i++) {
+            IQTree *tree = trees[i];
+            tree->readTreeString(start_trees[i]);
+            tree->computeLogL();
+            tree->optimizeNNI(params->speednni);
+            result_trees[i] = tree->getTreeString();
+            result_scores[i] = tree->getCurScore();
+        }
+#ifdef _OPENMP
+        omp_set_nested(false);
+#endif
+
+        // merge in trajectory order, as if the trajectories had run one after another
+        for (int i = 0; i < num_traj; i++) {
+            string curTree = result_trees[i];
+            double score = result_scores[i];
+            if (score > candidateTrees.getBestScore() + params->modelEps) {
+                // better tree found: re-optimize model parameters as in doNNISearch()
+                readTreeString(curTree);
+                initializeAllPartialLh();
+                optimizeModelParameters(false, params->modelEps * 10);
+                getModelFactory()->saveCheckpoint();
+                if (rooted && params->root_move_dist > 0)
+                    optimizeRootPosition(params->root_move_dist, true, params->modelEps * 10);
+                curTree = getTreeString();
+                score = curScore;
+            }
+            addTreeToCandidateSet(curTree, score, true, procID);
+            MPIHelper::getInstance().setNumNNISearch(MPIHelper::getInstance().getNumNNISearch() + 1);
+            if (stop_rule.meetStopCondition(stop_rule.getCurIt(), cur_correlation))
+                break;
+        }
+
+        saveCheckpoint();
+        checkpoint->dump();
+        if (bestcandidate_changed) {
+            printBestCandidateTree();
+            bestcandidate_changed = false;
+        }
+    }
+
+    for (int i = 0; i < num_traj; i++) {
+        trees[i]->setModelFactory(NULL);
+        delete trees[i];
+    }
+}
+
 
 /*
 void IQTree::refineBootTrees(){
@@ -2502,7 +2786,7 @@ void IQTree::refineBootTrees(){
         }
 
 
-        tree = boot_trees[sample];
+        tree = getBootTree(sample);
         // Read the bootstrap tree
 //        cout << tree << endl;
 
@@ -2547,7 +2831,7 @@ void IQTree::refineBootTrees(){
         stringstream ostr;
         printTree(ostr, WT_TAXON_ID | WT_SORT_TAXA);
         tree = ostr.str();
-        boot_trees[sample] = getTreeString();
+        setBootTree(sample, getTreeString());
         boot_logl[sample] = curScore;
 
         printTree(btreea, WT_NEWLINE | WT_SORT_TAXA);
@@ -2642,7 +2926,7 @@ void IQTree::refineBootTrees() {
     ModelsBlock *models_block = readModelsDefinition(*params);
     
 	// do bootstrap analysis
-	for (int sample = refined_samples; sample < boot_trees.size(); sample++) {
+	for (int sample = refined_samples; sample < boot_tree_ids.size(); sample++) {
         // create bootstrap alignment
         Alignment* bootstrap_alignment;
         if (aln->isSuperAlignment())
@@ -2702,9 +2986,9 @@ void IQTree::refineBootTrees() {
         // load the current ufboot tree
         // 2019-02-06: fix crash with -sp and -bnni
         if (isSuperTree())
-            boot_tree->PhyloTree::readTreeString(boot_trees[sample]);
+            boot_tree->PhyloTree::readTreeString(getBootTree(sample));
         else
-            boot_tree->readTreeString(boot_trees[sample]);
+            boot_tree->readTreeString(getBootTree(sample));
         
         if (boot_tree->isSuperTree() && params->partition_type == BRLEN_OPTIMIZE) {
             if (((PhyloSuperTree*)boot_tree)->size() > 1) {
@@ -2739,7 +3023,7 @@ void IQTree::refineBootTrees() {
             boot_tree->printTree(ostr, WT_TAXON_ID | WT_SORT_TAXA | WT_BR_LEN | WT_BR_LEN_SHORT);
         else
             boot_tree->printTree(ostr, WT_TAXON_ID | WT_SORT_TAXA);
-        boot_trees[sample] = ostr.str();
+        setBootTree(sample, ostr.str());
         boot_logl[sample] = boot_tree->curScore;
 
 
@@ -2784,7 +3068,7 @@ void IQTree::refineBootTrees() {
     checkpoint->dump();
     
     // restore
-    params->gbo_replicates = boot_trees.size();
+    params->gbo_replicates = boot_tree_ids.size();
     params->nni_type = saved_nni_type;
     if(params->nni_type == NNI5) {
         params->nni5 = true;
@@ -2946,6 +3230,8 @@ pair<int, int> IQTree::optimizeNNI(bool speedNNI) {
     const int MAXSTEPS = leafNum;
 //    unsigned int numInnerBranches = leafNum - 3;
     double curBestScore = candidateTrees.getBestScore();
+    // the model may have changed since the last NNI search
+    clearNNIParallelTrees();
 
 //    if (isMixlen())
 //        optimizeBranches();
@@ -3214,7 +3500,7 @@ void IQTree::pllInitUFBootData(){
                 if(!pllUFBootDataPtr->boot_samples[i]) outError("Not enough dynamic memory!");
                 for(int j = 0; j < pllAlignment->sequenceLength; j++){
                     pllUFBootDataPtr->boot_samples[i][j] =
-                        boot_samples[i][pll2iqtree_pattern_index[j]];
+                        getBootSampleCount(i, pll2iqtree_pattern_index[j]);
                 }
             }
 
@@ -3364,9 +3650,174 @@ void IQTree::setDelete(int _delete) {
     k_delete = _delete;
 }
 
+bool IQTree::isNNIBranchParallelWanted(size_t num_branches) {
+    if (!params->nni_branch_parallel || num_threads <= 1 || num_branches < 2)
+        return false;
+    // the tree copies only support the plain single-tree likelihood, each with all its partial likelihoods
+    return !(isSuperTree() || isMixlen() || !model->isReversible() || !constraintTree.empty() ||
+        save_all_trees == 2 || !root->isLeaf() || params->lh_mem_save == LM_MEM_SAVE);
+}
+
+uint64_t IQTree::getMemoryRequired(size_t ncategory, bool full_mem) {
+    uint64_t mem_size = PhyloTree::getMemoryRequired(ncategory, full_mem);
+    // with -T AUTO the number of threads is not yet known
+    int threads = (num_threads > 0) ? num_threads : params->num_threads_max;
+    if (!params->nni_branch_parallel || threads <= 1 || params->lh_mem_save == LM_MEM_SAVE)
+        return mem_size;
+    // each copy has all partial likelihoods, but shares the model and the UFBoot counts of this tree
+    int64_t saved_lh_slots = max_lh_slots;
+    uint64_t copy_mem = PhyloTree::getMemoryRequired(ncategory, true);
+    max_lh_slots = saved_lh_slots;
+    if (model)
+        copy_mem -= model->getMemoryRequired();
+    if (params->gbo_replicates)
+        copy_mem -= (uint64_t)params->gbo_replicates * (get_safe_upper_limit(aln->getNPattern()) +
+            max(get_safe_upper_limit(aln->num_states), get_safe_upper_limit(model_factory ? model_factory->unobserved_ptns.size() : 0))) *
+            sizeof(BootCountType);
+    return mem_size + threads * copy_mem;
+}
+
+void IQTree::evaluateNNIsParallel(Branches &nniBranches, vector<NNIMove> &positiveNNIs) {
+    double start_time = Profiler::getInstance().startTime();
+    vector<Branch> branches;
+    for (Branches::iterator it = nniBranches.begin(); it != nniBranches.end(); it++)
+        branches.push_back(it->second);
+    vector<NNIMove> nni_moves(branches.size());
+
+    // set up the copies sequentially, only the evaluation runs in parallel
+    int num_copies = min(num_threads, (int)branches.size());
+    syncNNIParallelTrees(num_copies);
+    vector<PhyloTree*> &trees = nni_par_trees;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_copies) schedule(dynamic)
+#endif
+    for (size_t i = 0; i < branches.size(); i++) {
+#ifdef _OPENMP
+        int copy = omp_get_thread_num();
+#else
+        int copy = 0;
+#endif
+        NodeVector &node_map = nni_par_node_maps[copy];
+        PhyloNode *node1 = (PhyloNode*)branches[i].first, *node2 = (PhyloNode*)branches[i].second;
+        NNIMove nni = trees[copy]->getBestNNIForBran((PhyloNode*)node_map[node1->id], (PhyloNode*)node_map[node2->id], NULL);
+        // translate the move back to this tree, node1 and node2 may have been swapped;
+        // the nodes have the same neighbor order in the copy, so do the new branch lengths
+        if (nni.node1 != node_map[node1->id])
+            swap(node1, node2);
+        nni.node1Nei_it = node1->neighbors.begin() + (nni.node1Nei_it - nni.node1->neighbors.begin());
+        nni.node2Nei_it = node2->neighbors.begin() + (nni.node2Nei_it - nni.node2->neighbors.begin());
+        nni.node1 = node1;
+        nni.node2 = node2;
+        nni_moves[i] = nni;
+    }
+
+    // two NNI moves per branch
+    Profiler::getInstance().addSince(PROF_NNI_EVAL, 2*branches.size(), 2*branches.size()*getAlnNPattern(), start_time);
+    // collect in the order of the branches, as the serial evaluation does
+    for (size_t i = 0; i < nni_moves.size(); i++)
+        if (nni_moves[i].newloglh > curScore)
+            positiveNNIs.push_back(nni_moves[i]);
+
+    // synchronize tree during optimization step
+    if (MPIHelper::getInstance().isMaster() && candidateset_changed.size() > 0
+        && MPIHelper::getInstance().gotMessage()) {
+        syncCurrentTree();
+    }
+}
+
+void IQTree::syncNNIParallelTrees(int num_copies) {
+    // the copies share the model of this tree
+    if (!nni_par_trees.empty() && (nni_par_trees[0]->getModelFactory() != getModelFactory() ||
+        nni_par_trees[0]->getModel() != model || nni_par_trees[0]->getRate() != site_rate))
+        clearNNIParallelTrees(true);
+    for (int i = nni_par_trees.size(); i < num_copies; i++) {
+        PhyloTree *tree = new PhyloTree;
+        tree->copyPhyloTree(this);
+        nni_par_node_maps.push_back(NodeVector());
+        mapCopiedNodes(tree, nni_par_node_maps.back());
+        tree->optimize_by_newton = optimize_by_newton;
+        tree->setParams(params);
+        tree->sse = sse;
+        tree->num_threads = 1;
+        tree->setModelFactory(getModelFactory());
+        tree->initializeAllPartialLh();
+        nni_par_trees.push_back(tree);
+    }
+
+    NodeVector nodes;
+    getAllNodesInSubtree(root->neighbors[0]->node, NULL, nodes);
+    // also the copies not needed this time, so that none misses a change
+    for (int i = 0; i < nni_par_trees.size(); i++) {
+        PhyloTree *tree = nni_par_trees[i];
+        NodeVector &node_map = nni_par_node_maps[i];
+        // the node IDs of this tree map to the same nodes of the copy even if the tree was
+        // re-read or NNIs were done, so the copy gets the same neighbors in the same order
+        bool topology_changed = false;
+        BranchVector changed_branches;
+        for (NodeVector::iterator it = nodes.begin(); it != nodes.end(); it++) {
+            Node *copy_node = node_map[(*it)->id];
+            for (int j = 0; j < (*it)->degree(); j++) {
+                PhyloNeighbor *nei = (PhyloNeighbor*)(*it)->neighbors[j];
+                PhyloNeighbor *copy_nei = (PhyloNeighbor*)copy_node->neighbors[j];
+                Node *copy_child = node_map[nei->node->id];
+                if (copy_nei->node != copy_child) {
+                    copy_nei->node = copy_child;
+                    topology_changed = true;
+                }
+                copy_nei->id = nei->id;
+                copy_nei->size = nei->size;
+                if (copy_nei->length != nei->length) {
+                    copy_nei->length = nei->length;
+                    if (!topology_changed)
+                        changed_branches.push_back(Branch(copy_node, copy_child));
+                }
+            }
+        }
+        tree->root = node_map[root->id];
+        if (topology_changed) {
+            tree->initializeAllPartialLh();
+        } else if (nni_par_trees_cleared) {
+            tree->clearAllPartialLH();
+        } else {
+            // both directions of a branch are visited, the partial likelihoods behind each end
+            for (BranchVector::iterator it = changed_branches.begin(); it != changed_branches.end(); it++)
+                ((PhyloNode*)it->first)->clearReversePartialLh((PhyloNode*)it->second);
+        }
+        tree->setCurScore(curScore);
+    }
+    nni_par_trees_cleared = false;
+}
+
+void IQTree::clearNNIParallelTrees(bool delete_trees) {
+    nni_par_trees_cleared = true;
+    if (!delete_trees)
+        return;
+    for (vector<PhyloTree*>::iterator it = nni_par_trees.begin(); it != nni_par_trees.end(); it++) {
+        (*it)->setModelFactory(NULL);
+        delete (*it);
+    }
+    nni_par_trees.clear();
+    nni_par_node_maps.clear();
+}
+
+void IQTree::setAlignment(Alignment *alignment) {
+    // the copies have the tip likelihoods of the old alignment
+    if (alignment != aln)
+        clearNNIParallelTrees(true);
+    PhyloTree::setAlignment(alignment);
+}
+
 void IQTree::evaluateNNIs(Branches &nniBranches, vector<NNIMove>  &positiveNNIs) {
+    if (isNNIBranchParallelWanted(nniBranches.size())) {
+        evaluateNNIsParallel(nniBranches, positiveNNIs);
+        return;
+    }
     for (Branches::iterator it = nniBranches.begin(); it != nniBranches.end(); it++) {
+        double start_time = Profiler::getInstance().startTime();
         NNIMove nni = getBestNNIForBran((PhyloNode*) it->second.first, (PhyloNode*) it->second.second, NULL);
+        // two NNI moves per branch
+        Profiler::getInstance().addSince(PROF_NNI_EVAL, 2, 2*getAlnNPattern(), start_time);
         if (nni.newloglh > curScore) {
             positiveNNIs.push_back(nni);
         }
@@ -3526,14 +3977,18 @@ void IQTree::saveCurrentTree(double cur_logl) {
 //        int ptn;
 //        int updated = 0;
 //        int nsamples = boot_samples.size();
-        ostringstream ostr;
-        string tree_str;
         setRootNode(params->root);
-        if (params->print_ufboot_trees == 2)
-            printTree(ostr, WT_TAXON_ID + WT_SORT_TAXA + WT_BR_LEN + WT_BR_LEN_SHORT);
-        else
-            printTree(ostr, WT_TAXON_ID + WT_SORT_TAXA);
-        tree_str = ostr.str();
+        IntVector updated(sample_end - sample_start, 0);
+
+        // RELL log-likelihoods of all samples, in chunks of samples sharing the pattern blocks
+        const int RELL_SAMPLE_CHUNK = 16;
+        DoubleVector rells(sample_end - sample_start);
+    #ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+        for (int chunk = sample_start; chunk < sample_end; chunk += RELL_SAMPLE_CHUNK)
+            (this->*rellProduct)(pattern_lh, &boot_samples[chunk], min(RELL_SAMPLE_CHUNK, sample_end - chunk),
+                                 nptn, &rells[chunk - sample_start]);
 
     #ifdef _OPENMP
         int rand_seed = random_int(1000);
@@ -3546,16 +4001,10 @@ void IQTree::saveCurrentTree(double cur_logl) {
         int *rstream = randstream;
     #endif
         for (int sample = sample_start; sample < sample_end; sample++) {
-            double rell = 0.0;
-
-            {
-                // SSE optimized version of the above loop
-                BootValType *boot_sample = boot_samples[sample];
-
-                BootValType res = (this->*dotProduct)(pattern_lh, boot_sample, nptn);
-
-                rell = res;
-            }
+            double rell = rells[sample - sample_start];
+            // patterns with large counts
+            for (size_t k = 0; k < boot_wide_ptns.size(); k++)
+                rell += boot_wide_counts[k][sample] * (double)pattern_lh[boot_wide_ptns[k]];
 
             bool better = rell > boot_logl[sample] + params->ufboot_epsilon;
             if (!better && rell > boot_logl[sample] - params->ufboot_epsilon) {
@@ -3569,13 +4018,32 @@ void IQTree::saveCurrentTree(double cur_logl) {
                 }
                 boot_logl[sample] = max(boot_logl[sample], rell);
                 boot_orig_logl[sample] = cur_logl;
-                boot_trees[sample] = tree_str;
+                updated[sample - sample_start] = 1;
             }
         }
     #ifdef _OPENMP
         finish_random(rstream);
         }
     #endif
+
+        // the tree is printed only if some sample takes it and its topology is not stored yet
+        int tree_id = -1;
+        for (int sample = sample_start; sample < sample_end; sample++) {
+            if (!updated[sample - sample_start])
+                continue;
+            if (tree_id < 0) {
+                // with branch lengths, every tree is stored separately
+                uint64_t hash = (params->print_ufboot_trees == 2) ? 0 : computeTopologyHash();
+                // the newick string is compared on a hash hit, so a collision never shares an entry
+                ostringstream ostr;
+                if (params->print_ufboot_trees == 2)
+                    printTree(ostr, WT_TAXON_ID + WT_SORT_TAXA + WT_BR_LEN + WT_BR_LEN_SHORT);
+                else
+                    printTree(ostr, WT_TAXON_ID + WT_SORT_TAXA);
+                tree_id = addBootTopology(ostr.str(), hash);
+            }
+            setBootTreeID(sample, tree_id);
+        }
     }
     if (Params::getInstance().print_tree_lh) {
         out_treelh << cur_logl;
@@ -3725,6 +4193,7 @@ void IQTree::summarizeBootstrap(Params &params, MTreeSet &trees) {
 }
 
 void IQTree::writeUFBootTrees(Params &params) {
+    ProfilePhaseScope profile_phase(PROF_PHASE_UFBOOT);
     MTreeSet trees;
 //    IntVector tree_weights;
     int i, j;
@@ -3732,6 +4201,8 @@ void IQTree::writeUFBootTrees(Params &params) {
     filename += ".ufboot";
     ofstream out(filename.c_str());
 
+    StrVector boot_trees;
+    getBootTrees(boot_trees);
     trees.init(boot_trees, rooted);
     for (i = 0; i < trees.size(); i++) {
         NodeVector taxa;
@@ -3755,8 +4226,11 @@ void IQTree::writeUFBootTrees(Params &params) {
 }
 
 void IQTree::summarizeBootstrap(Params &params) {
+    ProfilePhaseScope profile_phase(PROF_PHASE_UFBOOT);
     setRootNode(params.root);
     MTreeSet trees;
+    StrVector boot_trees;
+    getBootTrees(boot_trees);
     trees.init(boot_trees, rooted);
     summarizeBootstrap(params, trees);
 }
@@ -3764,6 +4238,8 @@ void IQTree::summarizeBootstrap(Params &params) {
 void IQTree::summarizeBootstrap(SplitGraph &sg) {
     MTreeSet trees;
     //SplitGraph sg;
+    StrVector boot_trees;
+    getBootTrees(boot_trees);
     trees.init(boot_trees, rooted);
     SplitIntMap hash_ss;
     // make the taxa name
@@ -3788,9 +4264,9 @@ void IQTree::pllConvertUFBootData2IQTree(){
 //        treels_logl.push_back(pllUFBootDataPtr->treels_logl[i]);
 
     //boot_trees
-    boot_trees.clear();
+    boot_tree_ids.resize(params->gbo_replicates, -1);
     for(int i = 0; i < params->gbo_replicates; i++)
-        boot_trees.push_back(pllUFBootDataPtr->boot_trees[i]);
+        setBootTree(i, pllUFBootDataPtr->boot_trees[i]);
 
 }
 
@@ -4264,3 +4740,60 @@ int PhyloTree::testNumThreads() {
     return bestProc+1;
 #endif
 }
+
+void PhyloTree::benchmarkKernelSchedule() {
+#ifndef _OPENMP
+    cout << "Kernel scheduling benchmark requires the multicore version" << endl;
+#else
+    // --threads-max overrides the number of physical cores, e.g. to test oversubscription
+    int max_procs = (params->num_threads_max < 10000) ? params->num_threads_max : countPhysicalCPUCores();
+    const int num_iter = 5;
+    const char *schedule_names[] = {"static", "steal"};
+    cout << "Benchmarking kernel pattern scheduling up to " << max_procs << " threads (" << num_iter << " rounds)" << endl;
+
+    string tree_string = getTreeString();
+    KernelSchedule saved_schedule = params->kernel_schedule;
+    int saved_threads = num_threads;
+    double saved_curScore = curScore;
+    DoubleVector static_times;
+
+    for (int proc = 1; proc <= max_procs; proc = (proc < max_procs && proc*2 > max_procs) ? max_procs : proc*2) {
+        omp_set_num_threads(proc);
+        setNumThreads(proc);
+        initializeAllPartialLh();
+        for (int sched = KS_STATIC; sched <= KS_STEAL; sched++) {
+            params->kernel_schedule = (KernelSchedule)sched;
+            readTreeString(tree_string);
+            double begin_time = getRealTime();
+            double logl = 0.0;
+            for (int iter = 0; iter < num_iter; iter++) {
+                // full traversal, then derivatives on all branches
+                clearAllPartialLH();
+                logl = computeLikelihood();
+                logl = optimizeAllBranches(1);
+            }
+            double run_time = getRealTime() - begin_time;
+            if (sched == KS_STATIC)
+                static_times.push_back(run_time);
+            cout << "Threads: " << proc << " / Schedule: " << schedule_names[sched]
+                << " / Time: " << run_time << " sec / Speedup: " << static_times[0] / run_time;
+            if (sched == KS_STEAL)
+                cout << " / vs. static: " << static_times.back() / run_time
+                    << " / Stolen blocks: " << pattern_scheduler.getNumStolen();
+            cout << " / LogL: " << logl << endl;
+            curScore = saved_curScore;
+        }
+        deleteAllPartialLh();
+        if (proc == max_procs)
+            break;
+    }
+
+    readTreeString(tree_string);
+    params->kernel_schedule = saved_schedule;
+    if (saved_threads > 0) {
+        omp_set_num_threads(saved_threads);
+        setNumThreads(saved_threads);
+    }
+    cout << endl;
+#endif
+}
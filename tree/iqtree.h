@@ -317,6 +317,21 @@ public:
      */
     virtual double doTreeSearch();
 
+    /**
+     * @return true if doTreeSearch() should run params->search_trajectories trajectories
+     * concurrently, each with its share of the threads
+     */
+    bool isSearchTrajectoryWanted();
+
+    /**
+     * run the main loop of doTreeSearch() with concurrent search trajectories until the stop rule is met.
+     * In each round, every trajectory starts NNI search from a perturbed candidate tree on its own tree
+     * (own partial likelihoods, shared model). Perturbation and candidate set updates are done on this
+     * tree in trajectory order, so the result only depends on the number of trajectories.
+     * @param cur_correlation bootstrap correlation for the stop rule
+     */
+    void doSearchTrajectories(double &cur_correlation);
+
     /**
      *  Wrapper function that uses either PLL or IQ-TREE to optimize the branch length
      *  @param maxTraversal
@@ -449,6 +464,46 @@ public:
      */
     void evaluateNNIs(Branches &nniBranches, vector<NNIMove> &outNNIMoves);
 
+    /**
+     * @param num_branches number of branches to evaluate
+     * @return true if evaluateNNIs() should spread the branches over the threads instead of
+     * parallelizing every likelihood computation over the patterns
+     */
+    bool isNNIBranchParallelWanted(size_t num_branches);
+
+    /**
+     * like evaluateNNIs(), but each thread evaluates a share of the branches on its own tree copy,
+     * with its own partial likelihoods and NNI buffers. The result does not depend on the threads.
+     */
+    void evaluateNNIsParallel(Branches &nniBranches, vector<NNIMove> &outNNIMoves);
+
+    /**
+     * bring the tree copies of evaluateNNIsParallel() in line with this tree, creating them if needed.
+     * Only the partial likelihoods depending on a changed branch are cleared, all of them
+     * if the topology changed or if the partial likelihoods were invalidated by clearNNIParallelTrees()
+     * @param num_copies number of tree copies needed
+     */
+    void syncNNIParallelTrees(int num_copies);
+
+    /**
+     * clear the partial likelihoods of the tree copies of evaluateNNIsParallel(), e.g. after
+     * the model parameters changed
+     * @param delete_trees TRUE to also delete the copies
+     */
+    void clearNNIParallelTrees(bool delete_trees = false);
+
+    /**
+     * set the alignment, deleting the tree copies of evaluateNNIsParallel() if it changed
+     * @param alignment the new alignment
+     */
+    virtual void setAlignment(Alignment *alignment);
+
+    /**
+     * @return the memory required by PhyloTree::getMemoryRequired() plus that of the tree copies
+     * of evaluateNNIsParallel(), one per thread, if --nni-branch-par is set
+     */
+    virtual uint64_t getMemoryRequired(size_t ncategory = 1, bool full_mem = false);
+
     double optimizeNNIBranches(Branches &nniBranches);
 
     /**
@@ -762,8 +817,27 @@ public:
     /** log-likelihood threshold (l_min) */
     double logl_cutoff;
 
-    /** vector of bootstrap alignments generated */
-    vector<BootValType* > boot_samples;
+    /** vector of bootstrap alignments generated, as pattern counts (see getBootSampleCount) */
+    vector<BootCountType* > boot_samples;
+
+    /** patterns whose count exceeds BootCountType in some sample, their boot_samples entries are 0 */
+    IntVector boot_wide_ptns;
+
+    /** boot_wide_counts[k][sample] is the count of pattern boot_wide_ptns[k] in the sample */
+    vector<IntVector> boot_wide_counts;
+
+    /**
+        store the pattern counts of one bootstrap sample into boot_samples
+        @param sample sample index
+        @param pattern_freq pattern counts of the sample
+        @param wide_index[in,out] index of each pattern in boot_wide_ptns or -1
+     */
+    void storeBootSample(int sample, IntVector &pattern_freq, IntVector &wide_index);
+
+    /**
+        @return count of pattern ptn in bootstrap sample
+     */
+    int getBootSampleCount(int sample, int ptn);
 
     /** starting sample for UFBoot, used for MPI */
     int sample_start;
@@ -771,8 +845,73 @@ public:
     /** end sample for UFBoot, used for MPI */
     int sample_end;
 
-    /** newick string of corresponding bootstrap trees */
-    StrVector boot_trees;
+    /** index in boot_topologies of the best tree of each bootstrap sample, -1 if none yet */
+    IntVector boot_tree_ids;
+
+    /** distinct newick strings (with taxon IDs) of the best bootstrap trees, shared by the samples */
+    StrVector boot_topologies;
+
+    /** number of samples referring to each entry of boot_topologies, 0 for a free entry */
+    IntVector boot_topology_refs;
+
+    /** topology hash of each entry of boot_topologies, 0 if the entry is not looked up by topology */
+    vector<uint64_t> boot_topology_hashes;
+
+    /** map from topology hash to the index in boot_topologies */
+    unordered_map<uint64_t, int> boot_topology_map;
+
+    /** free entries of boot_topologies */
+    IntVector boot_topology_free;
+
+    /**
+        @return hash of the split set of the current tree, rooted at params->root
+     */
+    uint64_t computeTopologyHash();
+
+    /**
+        add a tree to boot_topologies, with no sample referring to it yet.
+        An entry with the same hash is only reused if its newick string is the same; a tree whose
+        hash collides with another topology gets its own entry, which is not looked up by topology
+        @param tree_str newick string with taxon IDs
+        @param hash topology hash, 0 if the tree should not be looked up by topology
+        @return index in boot_topologies
+     */
+    int addBootTopology(const string &tree_str, uint64_t hash);
+
+    /**
+        let a bootstrap sample refer to another entry of boot_topologies
+        @param sample sample index
+        @param id index in boot_topologies or -1
+     */
+    void setBootTreeID(int sample, int id);
+
+    /**
+        set the best tree of a bootstrap sample from its newick string
+     */
+    void setBootTree(int sample, const string &tree_str);
+
+    /**
+        @return newick string of the best tree of a bootstrap sample, empty if none
+     */
+    const string &getBootTree(int sample);
+
+    /**
+        @param[out] trees newick strings of the best trees of all bootstrap samples
+     */
+    void getBootTrees(StrVector &trees);
+
+    /**
+        read the boot_topologies saved by saveUFBoot() from a checkpoint
+        @param[out] ids ids[i] is the index in boot_topologies of the i-th saved tree,
+            empty for checkpoints that store newick strings per sample
+     */
+    void restoreBootTopologies(Checkpoint *checkpoint, IntVector &ids);
+
+    /**
+        restore the UFBoot state of one sample from its checkpoint entry
+        @param ids as returned by restoreBootTopologies()
+     */
+    void restoreBootSample(int sample, const string &str, IntVector &ids);
 
     /** bootstrap tree strings with branch lengths, for -wbtl option */
 //    StrVector boot_trees_brlen;
@@ -830,6 +969,15 @@ protected:
 
     bool nni_sort;
 
+    /** tree copies for evaluateNNIsParallel(), kept across calls */
+    vector<PhyloTree*> nni_par_trees;
+
+    /** node of each tree copy per node ID of this tree */
+    vector<NodeVector> nni_par_node_maps;
+
+    /** TRUE if the partial likelihoods of the tree copies are no longer valid */
+    bool nni_par_trees_cleared;
+
     bool testNNI;
 
     ofstream outNNI;
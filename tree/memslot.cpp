@@ -21,6 +21,7 @@
 
 #include "tree/phylotree.h"
 #include "memslot.h"
+#include "utils/profiler.h"
 
 const int MEM_LOCKED = 1;
 const int MEM_SPECIAL = 2;
@@ -32,6 +33,9 @@ void MemSlotVector::init(PhyloTree *tree, int num_slot) {
     resize(num_slot);
     size_t lh_size = tree->getPartialLhSize();
     size_t scale_size = tree->getScaleNumSize();
+    policy = Params::getInstance().mem_evict_policy;
+    // a subtree with all taxa is kept about one round of slot uses longer than a cherry
+    hybrid_weight = (double)num_slot / max((int)tree->leafNum, 1);
     reset();
     for (iterator it = begin(); it != end(); it++) {
         it->partial_lh = tree->central_partial_lh + lh_size*(it-begin());
@@ -45,8 +49,12 @@ void MemSlotVector::reset() {
     for (iterator it = begin(); it != end(); it++) {
         it->status = 0;
         it->nei = NULL;
+        it->last_use = 0;
+        it->heap_pos = -1;
     }
     nei_id_map.clear();
+    evict_heap.clear();
+    use_clock = 0;
     free_count = 0;
 }
 
@@ -64,6 +72,132 @@ void MemSlotVector::addNei(PhyloNeighbor *nei, iterator it) {
     nei->scale_num = it->scale_num;
     it->nei = nei;
     nei_id_map[nei] = it-begin();
+    touch(it-begin());
+}
+
+double MemSlotVector::getPriority(MemSlot &slot) {
+    switch (policy) {
+    case MEM_EVICT_LRU:
+        return slot.last_use;
+    case MEM_EVICT_HYBRID:
+        return slot.last_use + hybrid_weight * slot.nei->size;
+    default:
+        return slot.nei->size;
+    }
+}
+
+void MemSlotVector::touch(int id) {
+    MemSlot &slot = at(id);
+    slot.last_use = ++use_clock;
+    if (slot.nei == NULL || slot.status != 0) {
+        heapRemove(id);
+        return;
+    }
+    slot.priority = getPriority(slot);
+    slot.priority_size = slot.nei->size;
+    if (slot.heap_pos < 0) {
+        heapInsert(id);
+    } else {
+        // priority can only go up under LRU, but may go down when the subtree size changed
+        heapSiftUp(slot.heap_pos);
+        heapSiftDown(slot.heap_pos);
+    }
+}
+
+void MemSlotVector::validateHeapTop() {
+    if (policy == MEM_EVICT_LRU)
+        return;
+    while (!evict_heap.empty()) {
+        MemSlot &slot = at(evict_heap[0]);
+        if (slot.nei->size == slot.priority_size)
+            return;
+        // each slot is re-keyed at most once, afterwards its size is up to date
+        slot.priority = getPriority(slot);
+        slot.priority_size = slot.nei->size;
+        heapSiftDown(0);
+    }
+}
+
+void MemSlotVector::heapInsert(int id) {
+    at(id).heap_pos = evict_heap.size();
+    evict_heap.push_back(id);
+    heapSiftUp(evict_heap.size()-1);
+}
+
+void MemSlotVector::heapRemove(int id) {
+    int pos = at(id).heap_pos;
+    if (pos < 0)
+        return;
+    int last = evict_heap.size()-1;
+    if (pos != last)
+        heapSwap(pos, last);
+    evict_heap.pop_back();
+    at(id).heap_pos = -1;
+    if (pos != last) {
+        heapSiftUp(pos);
+        heapSiftDown(pos);
+    }
+}
+
+void MemSlotVector::heapSiftUp(int pos) {
+    while (pos > 0) {
+        int parent = (pos-1)/2;
+        if (at(evict_heap[parent]).priority <= at(evict_heap[pos]).priority)
+            break;
+        heapSwap(pos, parent);
+        pos = parent;
+    }
+}
+
+void MemSlotVector::heapSiftDown(int pos) {
+    int size = evict_heap.size();
+    while (true) {
+        int smallest = pos;
+        int left = 2*pos+1, right = 2*pos+2;
+        if (left < size && at(evict_heap[left]).priority < at(evict_heap[smallest]).priority)
+            smallest = left;
+        if (right < size && at(evict_heap[right]).priority < at(evict_heap[smallest]).priority)
+            smallest = right;
+        if (smallest == pos)
+            break;
+        heapSwap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void MemSlotVector::heapSwap(int pos1, int pos2) {
+    std::swap(evict_heap[pos1], evict_heap[pos2]);
+    at(evict_heap[pos1]).heap_pos = pos1;
+    at(evict_heap[pos2]).heap_pos = pos2;
+}
+
+bool MemSlotVector::recomputing(PhyloNeighbor *nei) {
+    if (Params::getInstance().lh_mem_save != LM_MEM_SAVE)
+        return false;
+    if (!nei->lh_evicted)
+        return false;
+    nei->lh_evicted = false;
+    num_recomputes++;
+    Profiler::getInstance().add(PROF_MEMSLOT_RECOMPUTE, 1, 0, 0.0);
+    return true;
+}
+
+void MemSlotVector::addRecomputeTime(double seconds) {
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+    recompute_time += seconds;
+}
+
+void MemSlotVector::report(ostream &out) {
+    if (Params::getInstance().lh_mem_save != LM_MEM_SAVE)
+        return;
+    const char *policy_names[] = {"cost", "lru", "hybrid"};
+    out << "Memory slots (" << policy_names[policy] << " eviction): " << size() << " slots, "
+        << num_evictions << " evictions, " << num_recomputes << " recomputed";
+    if (num_evictions > 0)
+        out << " (" << round((1000.0 * num_recomputes) / num_evictions) / 10 << "%)";
+    out << ", " << recompute_time << " sec recomputing" << endl;
 }
 
 
@@ -75,6 +209,8 @@ void MemSlotVector::addSpecialNei(PhyloNeighbor *nei) {
     ms.nei = nei;
     ms.partial_lh = nei->partial_lh;
     ms.scale_num = nei->scale_num;
+    ms.last_use = 0;
+    ms.heap_pos = -1;
     push_back(ms);
     nei_id_map[nei] = size()-1;
 }
@@ -99,6 +235,7 @@ bool MemSlotVector::lock(PhyloNeighbor *nei) {
         return false;
     ASSERT((id->status & MEM_LOCKED) == 0);
     id->status |= MEM_LOCKED;
+    heapRemove(id-begin());
     return true;
 }
 
@@ -112,6 +249,7 @@ void MemSlotVector::unlock(PhyloNeighbor *nei) {
         return;
     ASSERT((id->status & MEM_LOCKED) != 0);
     id->status &= ~MEM_LOCKED;
+    touch(id-begin());
 }
 
 bool MemSlotVector::locked(PhyloNeighbor *nei) {
@@ -143,25 +281,18 @@ int MemSlotVector::allocate(PhyloNeighbor *nei) {
         return it-begin();
     }
 
-    int min_size = INT_MAX;
-    iterator best = end();
-
-
-    // no free slot found, find an unlocked slot with minimal size
-    for (iterator it = begin(); it != end(); it++)
-        if ((it->status & MEM_LOCKED) == 0 && (it->status & MEM_SPECIAL) == 0 && min_size > it->nei->size) {
-            best = it;
-            min_size = it->nei->size;
-            // 2 is the minimum size
-            if (min_size == 2)
-                break;
-        }
-
-    if (best == end())
+    // no free slot found, evict the unlocked slot with the lowest priority
+    validateHeapTop();
+    if (evict_heap.empty())
         return -1;
+    iterator best = begin() + evict_heap[0];
+    ASSERT((best->status & (MEM_LOCKED | MEM_SPECIAL)) == 0);
 
     // clear mem assigned to it->nei
     best->nei->clearPartialLh();
+    best->nei->lh_evicted = true;
+    num_evictions++;
+    Profiler::getInstance().add(PROF_MEMSLOT_EVICT, 1, 0, 0.0);
 
     // assign mem to nei
     addNei(nei, best);
@@ -179,6 +310,9 @@ void MemSlotVector::update(PhyloNeighbor *nei) {
     if (it->nei != nei) {
         // clear mem assigned to it->nei
         it->nei->clearPartialLh();
+        it->nei->lh_evicted = true;
+        num_evictions++;
+        Profiler::getInstance().add(PROF_MEMSLOT_EVICT, 1, 0, 0.0);
 
         // assign mem to nei
         addNei(nei, it);
@@ -219,6 +353,8 @@ void MemSlotVector::takeover(PhyloNeighbor *nei, PhyloNeighbor *taken_nei) {
     nei_id_map[nei] = id - begin();
     if (id->nei == taken_nei) {
         id->nei = nei;
+        if (id->heap_pos >= 0)
+            touch(id - begin());
     }
 }
 
@@ -232,6 +368,7 @@ void MemSlotVector::replace(PhyloNeighbor *new_nei, PhyloNeighbor *old_nei) {
     it->partial_lh = new_nei->partial_lh;
     it->scale_num = new_nei->scale_num;
     it->status = MEM_LOCKED + MEM_SPECIAL;
+    heapRemove(it-begin());
     nei_id_map[new_nei] = it-begin();
 //    nei_id_map.erase(old_nei);
     cout << "slot " << distance(begin(), it) << " replaced" << endl;
@@ -248,6 +385,7 @@ void MemSlotVector::restore(PhyloNeighbor *new_nei, PhyloNeighbor *old_nei) {
     it->partial_lh = old_nei->partial_lh;
     it->scale_num = old_nei->scale_num;
     it->status = 0;
+    touch(it-begin());
     nei_id_map.erase(new_nei);
 //    nei_id_map[old_nei] = it;
     cout << "slot " << distance(begin(), it) << " restored" << endl;
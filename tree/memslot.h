@@ -36,6 +36,11 @@ struct MemSlot {
     UBYTE *scale_num; // scale_num assigned to this slot
 
     PhyloNeighbor *saved_nei;
+
+    int64_t last_use; // time stamp of the last use, for the LRU and hybrid eviction policies
+    double priority; // eviction priority, the slot with the lowest one is evicted first
+    int priority_size; // nei->size when priority was computed, to re-key the slot when it changes
+    int heap_pos; // position in MemSlotVector::evict_heap, -1 if the slot cannot be evicted
 };
 
 /**
@@ -44,6 +49,11 @@ struct MemSlot {
 class MemSlotVector : public vector<MemSlot> {
 public:
 
+    MemSlotVector() {
+        num_evictions = num_recomputes = 0;
+        recompute_time = 0.0;
+    }
+
     /** initialize with a specified number of slots */
     void init(PhyloTree *tree, int num_slot);
 
@@ -93,8 +103,71 @@ public:
     /** restore neighbor, after calling replace */
     void restore(PhyloNeighbor *new_nei, PhyloNeighbor *old_nei);
 
+    /**
+        check if the partial likelihoods of nei are computed again after being evicted,
+        and count it as a recomputation
+        @param nei neighbor whose partial likelihoods are about to be computed
+        @return TRUE if nei was evicted since its partial likelihoods were last computed
+    */
+    bool recomputing(PhyloNeighbor *nei);
+
+    /** add time spent recomputing evicted partial likelihoods, thread-safe */
+    void addRecomputeTime(double seconds);
+
+    /** print eviction and recomputation statistics */
+    void report(ostream &out);
+
 protected:
 
+    /** @return eviction priority of a slot under the current policy */
+    double getPriority(MemSlot &slot);
+
+    /** mark a slot as used now and make it evictable if it is assigned and neither locked nor special */
+    void touch(int id);
+
+    /**
+        re-key the slot at the top of evict_heap while its subtree size changed since its priority
+        was computed, e.g. after an NNI or after sizes were cleared. Slots are only re-keyed when they
+        reach the top, so an eviction costs O(log slots) instead of a scan of all slots
+    */
+    void validateHeapTop();
+
+    /** add slot into evict_heap */
+    void heapInsert(int id);
+
+    /** remove slot from evict_heap if it is there */
+    void heapRemove(int id);
+
+    /** move the heap entry at pos up to restore the heap order */
+    void heapSiftUp(int pos);
+
+    /** move the heap entry at pos down to restore the heap order */
+    void heapSiftDown(int pos);
+
+    /** swap two heap entries and update their slot positions */
+    void heapSwap(int pos1, int pos2);
+
+    /** min-heap of IDs of evictable slots ordered by MemSlot::priority */
+    vector<int> evict_heap;
+
+    /** eviction policy, copied from Params::mem_evict_policy */
+    MemEvictPolicy policy;
+
+    /** weight of subtree size against slot age for MEM_EVICT_HYBRID */
+    double hybrid_weight;
+
+    /** logical clock for MemSlot::last_use */
+    int64_t use_clock;
+
+    /** number of partial likelihood vectors evicted */
+    int64_t num_evictions;
+
+    /** number of evicted partial likelihood vectors computed again */
+    int64_t num_recomputes;
+
+    /** time spent recomputing evicted partial likelihood vectors, summed over threads */
+    double recompute_time;
+
 
     /** 
         map from neighbor to slot ID for fast lookup
@@ -0,0 +1,205 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2016 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "tree/phylotree.h"
+#include "patternscheduler.h"
+
+PatternScheduler::PatternScheduler() {
+    queues = NULL;
+    num_queues = 0;
+    schedule = KS_STATIC;
+}
+
+PatternScheduler::PatternScheduler(const PatternScheduler &other) {
+    queues = NULL;
+    num_queues = 0;
+    schedule = other.schedule;
+}
+
+PatternScheduler& PatternScheduler::operator=(const PatternScheduler &other) {
+    if (this != &other) {
+        resizeQueues(0);
+        limits.clear();
+        schedule = other.schedule;
+    }
+    return *this;
+}
+
+PatternScheduler::~PatternScheduler() {
+    resizeQueues(0);
+}
+
+void PatternScheduler::resizeQueues(int threads) {
+    if (threads == num_queues)
+        return;
+    if (queues) {
+#ifdef _OPENMP
+        for (int i = 0; i < num_queues; i++)
+            omp_destroy_lock(&queues[i].lock);
+#endif
+        aligned_free(queues);
+    }
+    num_queues = threads;
+    if (threads == 0)
+        return;
+    queues = aligned_alloc<PatternBlockQueue>(threads, CACHE_LINE_SIZE);
+    for (int i = 0; i < threads; i++) {
+        queues[i].head = queues[i].tail = queues[i].stolen = 0;
+#ifdef _OPENMP
+        omp_init_lock(&queues[i].lock);
+#endif
+    }
+}
+
+void PatternScheduler::init(int threads, size_t elements, size_t vector_size, KernelSchedule schedule) {
+    ASSERT(threads > 0);
+    this->schedule = schedule;
+    resizeQueues(threads);
+    limits.clear();
+
+    // static split, one contiguous range per thread
+    vector<size_t> thread_limits;
+    thread_limits.reserve(threads+1);
+    elements = ((elements+vector_size-1)/vector_size)*vector_size;
+    size_t rest_elem = elements;
+    thread_limits.push_back(0);
+    size_t last = 0;
+    for (int rest_thread = threads; rest_thread > 1; rest_thread--) {
+        size_t block_size = rest_elem/rest_thread;
+        if (rest_elem % rest_thread != 0) block_size++;
+        // padding to the vector size
+        block_size = ((block_size+vector_size-1)/vector_size)*vector_size;
+
+        last += block_size;
+        if (last >= elements)
+            break;
+        thread_limits.push_back(last);
+        rest_elem -= block_size;
+    }
+    thread_limits.push_back(elements);
+    if (thread_limits.size() != threads+1) {
+        if (Params::getInstance().num_threads == 0)
+            outError("Too many threads may slow down analysis [-nt option]. Reduce threads");
+        else
+            outError("Too many threads may slow down analysis [-nt option]. Reduce threads or use -nt AUTO to automatically determine it");
+    }
+
+    limits.reserve(threads*STEAL_BLOCKS_PER_THREAD+1);
+    limits.push_back(0);
+    for (int thread = 0; thread < threads; thread++) {
+        PatternBlockQueue &queue = queues[thread];
+        queue.head = limits.size()-1;
+        queue.stolen = 0;
+        size_t lower = thread_limits[thread], upper = thread_limits[thread+1];
+        if (schedule == KS_STEAL) {
+            // cut the range of this thread into smaller blocks of multiple vector size
+            size_t block_size = (upper-lower+STEAL_BLOCKS_PER_THREAD-1)/STEAL_BLOCKS_PER_THREAD;
+            block_size = ((block_size+vector_size-1)/vector_size)*vector_size;
+            for (size_t ptn = lower+block_size; ptn < upper; ptn += block_size)
+                limits.push_back(ptn);
+        }
+        limits.push_back(upper);
+        queue.tail = limits.size()-1;
+    }
+}
+
+bool PatternScheduler::popHead(PatternBlockQueue &queue, size_t &block_id) {
+    bool found = false;
+#ifdef _OPENMP
+    omp_set_lock(&queue.lock);
+#endif
+    if (queue.head < queue.tail) {
+        block_id = queue.head;
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+        queue.head = block_id+1;
+        found = true;
+    }
+#ifdef _OPENMP
+    omp_unset_lock(&queue.lock);
+#endif
+    return found;
+}
+
+bool PatternScheduler::popTail(PatternBlockQueue &queue, size_t &block_id) {
+    bool found = false;
+#ifdef _OPENMP
+    omp_set_lock(&queue.lock);
+#endif
+    if (queue.head < queue.tail) {
+        block_id = queue.tail-1;
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+        queue.tail = block_id;
+        found = true;
+    }
+#ifdef _OPENMP
+    omp_unset_lock(&queue.lock);
+#endif
+    return found;
+}
+
+bool PatternScheduler::next(int thread_id, int team_size, size_t &block_id) {
+    // first drain own queues; if the team is smaller than expected,
+    // a thread also serves the queues of the missing threads
+    for (int q = thread_id; q < num_queues; q += team_size)
+        if (popHead(queues[q], block_id))
+            return true;
+
+    if (schedule != KS_STEAL)
+        return false;
+
+    // steal from the tail of the most loaded queue
+    while (true) {
+        int victim = -1;
+        size_t max_rest = 0;
+        for (int q = 0; q < num_queues; q++) {
+            size_t head, tail;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+            head = queues[q].head;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+            tail = queues[q].tail;
+            if (tail > head && tail-head > max_rest) {
+                max_rest = tail-head;
+                victim = q;
+            }
+        }
+        if (victim < 0)
+            return false;
+        if (popTail(queues[victim], block_id)) {
+            queues[thread_id].stolen++;
+            return true;
+        }
+    }
+}
+
+size_t PatternScheduler::getNumStolen() {
+    size_t num_stolen = 0;
+    for (int q = 0; q < num_queues; q++)
+        num_stolen += queues[q].stolen;
+    return num_stolen;
+}
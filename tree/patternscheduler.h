@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2016 by                                            *
+ *   BUI Quang Minh <minh.bui@univie.ac.at>                                *
+ *                                                                         *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef PATTERNSCHEDULER_H
+#define PATTERNSCHEDULER_H
+
+#include <vector>
+#include <cstddef>
+#include "utils/tools.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+    number of pattern blocks per thread for the work-stealing schedule
+*/
+const size_t STEAL_BLOCKS_PER_THREAD = 8;
+
+/**
+    queue of pattern blocks owned by one thread
+*/
+struct PatternBlockQueueData {
+    /** first block not yet taken */
+    size_t head;
+    /** one past the last block not yet taken */
+    size_t tail;
+    /** number of blocks stolen by the owner thread */
+    size_t stolen;
+#ifdef _OPENMP
+    omp_lock_t lock;
+#endif
+};
+
+/**
+    queue padded to whole cache lines. The queues are allocated at a cache line boundary,
+    so that each queue has its own lines and threads do not falsely share them
+*/
+struct PatternBlockQueue : public PatternBlockQueueData {
+    char padding[CACHE_LINE_SIZE - sizeof(PatternBlockQueueData) % CACHE_LINE_SIZE];
+};
+
+/**
+    Scheduler distributing alignment patterns to threads for the likelihood kernels.
+    Patterns are split into blocks (multiple of the vector size). Each thread owns
+    a contiguous run of blocks, the same split as computeBounds(). With KS_STATIC each
+    thread processes exactly its own run; with KS_STEAL the run is cut into smaller
+    blocks and idle threads steal blocks from the tail of the most loaded thread.
+    Results are accumulated per block and reduced in block order, so they do not
+    depend on which thread processed which block.
+*/
+class PatternScheduler {
+public:
+
+    PatternScheduler();
+
+    /** copying a scheduler does not copy queues and locks, they are created again by init() */
+    PatternScheduler(const PatternScheduler &other);
+
+    PatternScheduler& operator=(const PatternScheduler &other);
+
+    ~PatternScheduler();
+
+    /**
+        initialize the blocks and queues for a new parallel region
+        @param threads number of threads
+        @param elements number of patterns (will be padded to vector_size)
+        @param vector_size SIMD vector size
+        @param schedule KS_STATIC or KS_STEAL
+    */
+    void init(int threads, size_t elements, size_t vector_size, KernelSchedule schedule);
+
+    /**
+        get the next block for a thread, called inside the parallel region
+        @param thread_id ID of the calling thread
+        @param team_size actual number of threads in the parallel region
+        @param[out] block_id ID of the block
+        @return TRUE if a block was taken, FALSE if no work is left
+    */
+    bool next(int thread_id, int team_size, size_t &block_id);
+
+    /** @return number of blocks */
+    inline size_t getNumBlocks() { return limits.size()-1; }
+
+    /** @return first pattern of a block */
+    inline size_t getLower(size_t block_id) { return limits[block_id]; }
+
+    /** @return one past the last pattern of a block */
+    inline size_t getUpper(size_t block_id) { return limits[block_id+1]; }
+
+    /** @return number of blocks stolen during the last parallel region */
+    size_t getNumStolen();
+
+protected:
+
+    /** take a block from the head of a queue */
+    bool popHead(PatternBlockQueue &queue, size_t &block_id);
+
+    /** steal a block from the tail of a queue */
+    bool popTail(PatternBlockQueue &queue, size_t &block_id);
+
+    /** resize the queues */
+    void resizeQueues(int threads);
+
+    /** block boundaries, block i spans [limits[i], limits[i+1]) */
+    std::vector<size_t> limits;
+
+    /** one queue per thread */
+    PatternBlockQueue *queues;
+
+    /** number of queues */
+    int num_queues;
+
+    /** the current schedule */
+    KernelSchedule schedule;
+};
+
+#endif // PATTERNSCHEDULER_H
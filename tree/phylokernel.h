@@ -67,6 +67,73 @@ Numeric PhyloTree::dotProductSIMD(Numeric *x, Numeric *y, int size) {
     return horizontal_add(res);
 }
 
+/** number of patterns per block of rellProductSIMD(), chosen so that the block of x stays in L1 cache */
+const int RELL_BLOCK_SIZE = 2048;
+
+/** convert 16 UFBoot pattern counts into 16/VectorClass::size() vectors */
+template <class Numeric, class VectorClass>
+inline void widenBootCounts(BootCountType *counts, VectorClass *x) {
+    Numeric tmp[16];
+    for (int i = 0; i < 16; i++)
+        tmp[i] = counts[i];
+    for (int i = 0; i < 16/VectorClass::size(); i++)
+        x[i].load(tmp + i*VectorClass::size());
+}
+
+template <>
+inline void widenBootCounts<float, Vec4f>(BootCountType *counts, Vec4f *x) {
+    Vec16uc c = Vec16uc().load(counts);
+    Vec8us low = extend_low(c), high = extend_high(c);
+    x[0] = to_float(extend_low(low));
+    x[1] = to_float(extend_high(low));
+    x[2] = to_float(extend_low(high));
+    x[3] = to_float(extend_high(high));
+}
+
+template <>
+inline void widenBootCounts<float, Vec8f>(BootCountType *counts, Vec8f *x) {
+    Vec4f y[4];
+    widenBootCounts<float, Vec4f>(counts, y);
+    x[0] = Vec8f(y[0], y[1]);
+    x[1] = Vec8f(y[2], y[3]);
+}
+
+#if INSTRSET >= 9
+template <>
+inline void widenBootCounts<float, Vec16f>(BootCountType *counts, Vec16f *x) {
+    Vec8f y[2];
+    widenBootCounts<float, Vec8f>(counts, y);
+    x[0] = Vec16f(y[0], y[1]);
+}
+#endif
+
+template <class Numeric, class VectorClass>
+void PhyloTree::rellProductSIMD(Numeric *x, BootCountType **counts, int nsamples, int size, double *res) {
+    const int nvec = 16/VectorClass::size();
+    int size16 = size - size % 16;
+    VectorClass cnt[16];
+    for (int sample = 0; sample < nsamples; sample++)
+        res[sample] = 0.0;
+    // block over patterns: x of one block is reused by all samples
+    for (int start = 0; start < size16; start += RELL_BLOCK_SIZE) {
+        int end = min(start + RELL_BLOCK_SIZE, size16);
+        for (int sample = 0; sample < nsamples; sample++) {
+            BootCountType *count = counts[sample];
+            VectorClass sum = 0.0;
+            for (int ptn = start; ptn < end; ptn += 16) {
+                widenBootCounts<Numeric, VectorClass>(count + ptn, cnt);
+                for (int i = 0; i < nvec; i++)
+                    sum = mul_add(VectorClass().load_a(x + ptn + i*VectorClass::size()), cnt[i], sum);
+            }
+            // block sums are accumulated in double precision
+            res[sample] += horizontal_add(sum);
+        }
+    }
+    for (int sample = 0; sample < nsamples; sample++)
+        for (int ptn = size16; ptn < size; ptn++)
+            res[sample] += x[ptn] * counts[sample][ptn];
+}
+
 /************************************************************************************************
  *
  *   Highly optimized vectorized versions of likelihood functions
@@ -130,7 +197,7 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
         if ((*it)->node->isLeaf()) num_leaves++;
     }
 
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (params->lh_mem_save != LM_MEM_SAVE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
@@ -30,16 +30,27 @@
 void PhyloTree::setDotProductAVX512() {
 #ifdef BOOT_VAL_FLOAT
 		dotProduct = &PhyloTree::dotProductSIMD<float, Vec16f>;
+		rellProduct = &PhyloTree::rellProductSIMD<float, Vec16f>;
 #else
 		dotProduct = &PhyloTree::dotProductSIMD<double, Vec8d>;
+		rellProduct = &PhyloTree::rellProductSIMD<double, Vec8d>;
 #endif
         dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec8d>;
 }
 
 void PhyloTree::setLikelihoodKernelAVX512() {
     vector_size = 8;
+    switch (aln->num_states) {
+    case 4: computeSensitivityBlockPointer = &PhyloTree::computeSensitivityBlockSIMD<Vec8d, 4, true>; break;
+    case 20: computeSensitivityBlockPointer = &PhyloTree::computeSensitivityBlockSIMD<Vec8d, 20, true>; break;
+    default: computeSensitivityBlockPointer = &PhyloTree::computeSensitivityBlockGenericSIMD<Vec8d, true>; break;
+    }
     bool site_model = model_factory && model_factory->model->isSiteSpecificModel();
 //    setParsimonyKernelAVX();
+
+    if (site_model && ((model_factory && !model_factory->model->isReversible()) || params->kernel_nonrev))
+        outError("Site-specific model is not yet supported for nonreversible models");
+    
     computeLikelihoodDervMixlenPointer = NULL;
 
     if (site_model && safe_numeric) {
@@ -90,22 +101,130 @@ void PhyloTree::setLikelihoodKernelAVX512() {
 
     if ((model_factory && !model_factory->model->isReversible()) || params->kernel_nonrev) {
         // if nonreversible model
+        if (safe_numeric)
         switch (aln->num_states) {
         case 4:
-            computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchSIMD <Vec8d, 4, true>;
-            computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervSIMD   <Vec8d, 4, true>;
-            computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodSIMD<Vec8d, 4, true>;
+            computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchSIMD <Vec8d, SAFE_LH, 4, true>;
+            computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervSIMD   <Vec8d, SAFE_LH, 4, true>;
+            computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodSIMD<Vec8d, SAFE_LH, 4, true>;
+            break;
+        case 20:
+            computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchSIMD <Vec8d, SAFE_LH, 20, true>;
+            computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervSIMD   <Vec8d, SAFE_LH, 20, true>;
+            computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodSIMD<Vec8d, SAFE_LH, 20, true>;
             break;
         default:
-            computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchGenericSIMD <Vec8d>;
-            computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervGenericSIMD   <Vec8d>;
-            computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodGenericSIMD<Vec8d>;
+            computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchGenericSIMD <Vec8d, SAFE_LH, true>;
+            computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervGenericSIMD   <Vec8d, SAFE_LH, true>;
+            computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodGenericSIMD<Vec8d, SAFE_LH, true>;
             break;
+        } else {
+            switch (aln->num_states) {
+                case 4:
+                    computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchSIMD <Vec8d, NORM_LH, 4, true>;
+                    computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervSIMD   <Vec8d, NORM_LH, 4, true>;
+                    computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodSIMD<Vec8d, NORM_LH, 4, true>;
+                    break;
+                case 20:
+                    computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchSIMD <Vec8d, NORM_LH, 20, true>;
+                    computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervSIMD   <Vec8d, NORM_LH, 20, true>;
+                    computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodSIMD<Vec8d, NORM_LH, 20, true>;
+                    break;
+                default:
+                    computeLikelihoodBranchPointer  = &PhyloTree::computeNonrevLikelihoodBranchGenericSIMD <Vec8d, NORM_LH, true>;
+                    computeLikelihoodDervPointer    = &PhyloTree::computeNonrevLikelihoodDervGenericSIMD   <Vec8d, NORM_LH, true>;
+                    computePartialLikelihoodPointer = &PhyloTree::computeNonrevPartialLikelihoodGenericSIMD<Vec8d, NORM_LH, true>;
+                    break;
+            }
         }
+
         computeLikelihoodFromBufferPointer = NULL;
         return;        
     }
 
+    if (float_lh) {
+        // single-precision partial_lh storage (--float-lh), no mixlen support
+        computeLikelihoodDervMixlenPointer = NULL;
+        if (safe_numeric) {
+            switch(aln->num_states) {
+            case 4:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 4, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 4, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 4, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 4, true, false, true>;
+                break;
+            case 20:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 20, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 20, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 20, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 20, true, false, true>;
+                break;
+            // binary, PoMo and codon data, always with safe numerics
+            case 2:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 2, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 2, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 2, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 2, true, false, true>;
+                break;
+            case 52:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 52, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 52, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 52, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 52, true, false, true>;
+                break;
+            case 58:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 58, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 58, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 58, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 58, true, false, true>;
+                break;
+            case 59:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 59, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 59, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 59, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 59, true, false, true>;
+                break;
+            case 60:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 60, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 60, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 60, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 60, true, false, true>;
+                break;
+            case 61:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 61, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 61, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 61, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 61, true, false, true>;
+                break;
+            default:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchGenericSIMD    <Vec8d, SAFE_LH, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervGenericSIMD      <Vec8d, SAFE_LH, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodGenericSIMD   <Vec8d, SAFE_LH, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferGenericSIMD<Vec8d, true, false, true>;
+                break;
+            }
+        } else {
+            switch(aln->num_states) {
+            case 4:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, NORM_LH, 4, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, NORM_LH, 4, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, NORM_LH, 4, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 4, true, false, true>;
+                break;
+            case 20:
+                computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, NORM_LH, 20, true, false, true>;
+                computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, NORM_LH, 20, true, false, true>;
+                computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, NORM_LH, 20, true, false, true>;
+                computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 20, true, false, true>;
+                break;
+            default:
+                ASSERT(0);
+                break;
+            }
+        }
+        return;
+    }
+
     if (safe_numeric) {
         switch(aln->num_states) {
         case 4:
@@ -122,6 +241,49 @@ void PhyloTree::setLikelihoodKernelAVX512() {
             computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 20, true>;
             computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 20, true>;
             break;
+        // binary, PoMo (N=9, N=10) and codon data (61 states, fewer for non-standard genetic codes)
+        case 2:
+            computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 2, true>;
+            computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 2, true>;
+            computeLikelihoodDervMixlenPointer = &PhyloTree::computeLikelihoodDervMixlenSIMD<Vec8d, SAFE_LH, 2, true>;
+            computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 2, true>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 2, true>;
+            break;
+        case 52:
+            computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 52, true>;
+            computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 52, true>;
+            computeLikelihoodDervMixlenPointer = &PhyloTree::computeLikelihoodDervMixlenSIMD<Vec8d, SAFE_LH, 52, true>;
+            computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 52, true>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 52, true>;
+            break;
+        case 58:
+            computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 58, true>;
+            computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 58, true>;
+            computeLikelihoodDervMixlenPointer = &PhyloTree::computeLikelihoodDervMixlenSIMD<Vec8d, SAFE_LH, 58, true>;
+            computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 58, true>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 58, true>;
+            break;
+        case 59:
+            computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 59, true>;
+            computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 59, true>;
+            computeLikelihoodDervMixlenPointer = &PhyloTree::computeLikelihoodDervMixlenSIMD<Vec8d, SAFE_LH, 59, true>;
+            computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 59, true>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 59, true>;
+            break;
+        case 60:
+            computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 60, true>;
+            computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 60, true>;
+            computeLikelihoodDervMixlenPointer = &PhyloTree::computeLikelihoodDervMixlenSIMD<Vec8d, SAFE_LH, 60, true>;
+            computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 60, true>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 60, true>;
+            break;
+        case 61:
+            computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchSIMD    <Vec8d, SAFE_LH, 61, true>;
+            computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervSIMD      <Vec8d, SAFE_LH, 61, true>;
+            computeLikelihoodDervMixlenPointer = &PhyloTree::computeLikelihoodDervMixlenSIMD<Vec8d, SAFE_LH, 61, true>;
+            computePartialLikelihoodPointer    = &PhyloTree::computePartialLikelihoodSIMD   <Vec8d, SAFE_LH, 61, true>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferSIMD<Vec8d, 61, true>;
+            break;
         default:
             computeLikelihoodBranchPointer     = &PhyloTree::computeLikelihoodBranchGenericSIMD    <Vec8d, SAFE_LH, true>;
             computeLikelihoodDervPointer       = &PhyloTree::computeLikelihoodDervGenericSIMD      <Vec8d, SAFE_LH, true>;
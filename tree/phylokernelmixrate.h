@@ -74,7 +74,7 @@ void PhyloTree::computeMixratePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_bran
 	if ((right->partial_lh_computed & 1) == 0)
 		computeMixratePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(right, node);
 
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (params->lh_mem_save != LM_MEM_SAVE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
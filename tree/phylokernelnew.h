@@ -16,6 +16,8 @@
 #endif
 
 #include "phylotree.h"
+#include "utils/profiler.h"
+#include <type_traits>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -69,6 +71,231 @@ inline void sumVec(VectorClass *A, VectorClass &X, size_t N)
 }
 #endif
 
+#ifndef KERNEL_FIX_STATES
+/**
+    widen N float vectors to double. One float vector of twice the lanes (Vec4f, Vec8f, Vec16f)
+    is loaded and split into two double vectors
+*/
+template <class VectorClass>
+inline void convertFloatLh(float *src, size_t N, VectorClass *dest, std::true_type)
+{
+    typedef decltype(compress(VectorClass(), VectorClass())) FloatVector;
+    const size_t V = VectorClass::size();
+    size_t i;
+    for (i = 0; i+1 < N; i += 2) {
+        FloatVector vf;
+        vf.load(src + i*V);
+        dest[i] = extend_low(vf);
+        dest[i+1] = extend_high(vf);
+    }
+    for (size_t j = i*V; j < N*V; j++)
+        ((double*)dest)[j] = src[j];
+}
+
+template <class VectorClass>
+inline void convertFloatLh(float *src, size_t N, VectorClass *dest, std::false_type)
+{
+}
+
+/**
+    round N double vectors to float, two double vectors are packed into one float vector
+*/
+template <class VectorClass>
+inline void convertDoubleLh(VectorClass *src, size_t N, float *dest, std::true_type)
+{
+    const size_t V = VectorClass::size();
+    size_t i;
+    for (i = 0; i+1 < N; i += 2)
+        compress(src[i], src[i+1]).store(dest + i*V);
+    for (size_t j = i*V; j < N*V; j++)
+        dest[j] = (float)((double*)src)[j];
+}
+
+template <class VectorClass>
+inline void convertDoubleLh(VectorClass *src, size_t N, float *dest, std::false_type)
+{
+}
+
+/**
+    get the partial likelihoods of one pattern vector in double precision.
+    with FLOAT_LH the stored floats are converted into buffer,
+    otherwise the storage is returned directly
+    @param partial_lh partial_lh vector of a neighbor
+    @param offset offset of the first entry
+    @param N number of vectors to load
+    @param buffer buffer of size N
+    @return double partial likelihoods
+*/
+template <class VectorClass, const bool FLOAT_LH>
+inline VectorClass *loadPartialLh(double *partial_lh, size_t offset, size_t N, VectorClass *buffer)
+{
+    if (!FLOAT_LH)
+        return (VectorClass*)(partial_lh + offset);
+    convertFloatLh((float*)partial_lh + offset, N, buffer, std::integral_constant<bool, FLOAT_LH>());
+    return buffer;
+}
+
+/**
+    get the location to compute the partial likelihoods of one pattern vector.
+    with FLOAT_LH this is buffer, which storePartialLh() writes back afterwards,
+    otherwise the storage itself
+    @param partial_lh partial_lh vector of a neighbor
+    @param offset offset of the first entry
+    @param buffer buffer for the double partial likelihoods
+*/
+template <class VectorClass, const bool FLOAT_LH>
+inline VectorClass *outPartialLh(double *partial_lh, size_t offset, VectorClass *buffer)
+{
+    return FLOAT_LH ? buffer : (VectorClass*)(partial_lh + offset);
+}
+
+/**
+    round the partial likelihoods computed in buffer to the float storage,
+    nothing to do without FLOAT_LH
+    @param partial_lh partial_lh vector of a neighbor
+    @param offset offset of the first entry
+    @param N number of vectors to store
+    @param buffer buffer returned by outPartialLh()
+*/
+template <class VectorClass, const bool FLOAT_LH>
+inline void storePartialLh(double *partial_lh, size_t offset, size_t N, VectorClass *buffer)
+{
+    convertDoubleLh(buffer, N, (float*)partial_lh + offset, std::integral_constant<bool, FLOAT_LH>());
+}
+
+/**
+    get the patterns of the next vector of the pattern loop in computePartialLikelihood
+    @param ptn_list patterns to compute with site repeat compression, NULL to compute all patterns
+    @param pos position in the pattern loop, from ptn_lower in steps of VectorClass::size()
+    @param ptn_lower first pattern of the loop
+    @param[out] ptn first pattern of the vector
+    @param[out] ptn_lane pattern of each vector lane
+    @return true if the patterns do not form one stored vector and must be gathered
+*/
+template <class VectorClass>
+inline bool getPatternVector(UINT *ptn_list, size_t pos, size_t ptn_lower, size_t &ptn, UINT *ptn_lane)
+{
+    const size_t V = VectorClass::size();
+    if (!ptn_list) {
+        ptn = pos;
+        for (size_t x = 0; x < V; x++)
+            ptn_lane[x] = pos+x;
+        return false;
+    }
+    UINT *list = ptn_list + (pos-ptn_lower);
+    ptn = list[0];
+    // gather unless the vector is aligned and contiguous (the last one may be padded with duplicates)
+    bool gather = (ptn % V != 0);
+    for (size_t x = 0; x < V; x++) {
+        ptn_lane[x] = list[x];
+        gather |= (list[x] != ptn+x);
+    }
+    return gather;
+}
+
+/**
+    @return ptn_invar of the patterns of one vector
+    @param ptn first pattern of the vector
+    @param ptn_lane pattern of each vector lane, used if gather
+*/
+template <class VectorClass>
+inline VectorClass loadPtnInvar(double *ptn_invar, size_t ptn, UINT *ptn_lane, bool gather)
+{
+    if (!gather)
+        return VectorClass().load_a(&ptn_invar[ptn]);
+    double invar[VectorClass::size()];
+    for (size_t x = 0; x < VectorClass::size(); x++)
+        invar[x] = ptn_invar[ptn_lane[x]];
+    return VectorClass().load(invar);
+}
+
+/**
+    gather the partial likelihoods of arbitrary patterns into one pattern vector,
+    lane x of entry i of pattern ptn is stored at (ptn/V*V)*N + i*V + ptn%V
+    @param partial_lh partial_lh vector of a neighbor
+    @param ptn_lane pattern of each vector lane
+    @param N number of vectors to load
+    @param buffer buffer of size N
+    @return double partial likelihoods in buffer
+*/
+template <class VectorClass, const bool FLOAT_LH>
+inline VectorClass *gatherPartialLh(double *partial_lh, UINT *ptn_lane, size_t N, VectorClass *buffer)
+{
+    const size_t V = VectorClass::size();
+    double *dest = (double*)buffer;
+    for (size_t x = 0; x < V; x++) {
+        size_t offset = (ptn_lane[x] - ptn_lane[x]%V)*N + ptn_lane[x]%V;
+        if (FLOAT_LH) {
+            float *src = (float*)partial_lh + offset;
+            for (size_t i = 0; i < N; i++)
+                dest[i*V+x] = src[i*V];
+        } else {
+            double *src = partial_lh + offset;
+            for (size_t i = 0; i < N; i++)
+                dest[i*V+x] = src[i*V];
+        }
+    }
+    return buffer;
+}
+
+/**
+    store a pattern vector computed in buffer to the partial likelihoods of its patterns,
+    counterpart of gatherPartialLh()
+*/
+template <class VectorClass, const bool FLOAT_LH>
+inline void scatterPartialLh(double *partial_lh, UINT *ptn_lane, size_t N, VectorClass *buffer)
+{
+    const size_t V = VectorClass::size();
+    double *src = (double*)buffer;
+    for (size_t x = 0; x < V; x++) {
+        size_t offset = (ptn_lane[x] - ptn_lane[x]%V)*N + ptn_lane[x]%V;
+        if (FLOAT_LH) {
+            float *dest = (float*)partial_lh + offset;
+            for (size_t i = 0; i < N; i++)
+                dest[i*V] = (float)src[i*V+x];
+        } else {
+            double *dest = partial_lh + offset;
+            for (size_t i = 0; i < N; i++)
+                dest[i*V] = src[i*V+x];
+        }
+    }
+}
+
+/**
+    copy partial likelihoods and scale numbers of repeated patterns from the first pattern of their class
+    @param partial_lh partial_lh vector of a neighbor
+    @param scale_num scale_num vector of the same neighbor
+    @param site_repeat site repeat classes, see PhyloTree::computeSiteRepeats()
+    @param ptn_lower first pattern
+    @param ptn_upper last pattern (exclusive)
+    @param N number of vectors per pattern vector
+    @param scale_block number of scale_num entries per pattern
+*/
+template <class VectorClass, const bool FLOAT_LH>
+inline void copySiteRepeats(double *partial_lh, UBYTE *scale_num, UINT *site_repeat, size_t ptn_lower, size_t ptn_upper,
+    size_t N, size_t scale_block)
+{
+    const size_t V = VectorClass::size();
+    for (size_t ptn = ptn_lower; ptn < ptn_upper; ptn++) {
+        size_t from = site_repeat[ptn];
+        if (from == ptn)
+            continue;
+        size_t src_offset = (from - from%V)*N + from%V;
+        size_t dest_offset = (ptn - ptn%V)*N + ptn%V;
+        if (FLOAT_LH) {
+            float *src = (float*)partial_lh + src_offset, *dest = (float*)partial_lh + dest_offset;
+            for (size_t i = 0; i < N; i++)
+                dest[i*V] = src[i*V];
+        } else {
+            double *src = partial_lh + src_offset, *dest = partial_lh + dest_offset;
+            for (size_t i = 0; i < N; i++)
+                dest[i*V] = src[i*V];
+        }
+        memcpy(scale_num + ptn*scale_block, scale_num + from*scale_block, scale_block*sizeof(UBYTE));
+    }
+}
+#endif
+
 /**
     dotProduct of two vectors A, B
     X = A.B = A[0]*B[0] + ... + A[N-1]*B[N-1]
@@ -858,14 +1085,25 @@ void PhyloTree::computePartialInfo(TraversalInfo &info, VectorClass* buffer) {
         // non-reversible model
         FOR_NEIGHBOR_IT(node, dad, it) {
             PhyloNeighbor *child = (PhyloNeighbor*)*it;
-            // precompute information buffer
+            // precompute information buffer, matrices of all categories in one batch per mixture class
+            double len_child[ncat_mix];
+            vector<TransMatrixPtr> cached_mats(ncat_mix);
+            for (c = 0; c < ncat_mix; c++)
+                len_child[c] = site_rate->getRate(c%ncat) * child->length;
+            // matrices not taken from the cache are computed right into echild
+            for (c = 0; c < ncat_mix; c += denom)
+                model_factory->getTransMatrices(denom, len_child + c, cached_mats.data() + c, c/denom, &echild[c*nstatesqr]);
             if (child->direction == TOWARD_ROOT) {
                 // tranpose probability matrix
-                double mat[nstatesqr];
                 for (c = 0; c < ncat_mix; c++) {
-                    double len_child = site_rate->getRate(c%ncat) * child->length;
-                    model_factory->computeTransMatrix(len_child, mat, c/denom);
+                    const double *mat = cached_mats[c].get();
                     double *echild_ptr = &echild[c*nstatesqr];
+                    if (mat == echild_ptr) {
+                        for (i = 0; i < nstates; i++)
+                            for (x = i+1; x < nstates; x++)
+                                std::swap(echild_ptr[i*nstates+x], echild_ptr[x*nstates+i]);
+                        continue;
+                    }
                     for (i = 0; i < nstates; i++) {
                         for (x = 0; x < nstates; x++)
                             echild_ptr[x] = mat[x*nstates+i];
@@ -873,10 +1111,9 @@ void PhyloTree::computePartialInfo(TraversalInfo &info, VectorClass* buffer) {
                     }
                 }
             } else {
-                for (c = 0; c < ncat_mix; c++) {
-                    double len_child = site_rate->getRate(c%ncat) * child->length;
-                    model_factory->computeTransMatrix(len_child, &echild[c*nstatesqr], c/denom);
-                }
+                for (c = 0; c < ncat_mix; c++)
+                    if (cached_mats[c].get() != &echild[c*nstatesqr])
+                        memcpy(&echild[c*nstatesqr], cached_mats[c].get(), nstatesqr*sizeof(double));
             }
 
             // pre compute information for tip
@@ -1076,6 +1313,9 @@ void PhyloTree::computeTraversalInfo(PhyloNode *node, PhyloNode *dad, bool compu
         computeTipPartialLikelihood();
 
     traversal_info.clear();
+    // per-thread buffers of computeSiteRepeats(), which runs inside the parallel regions of the kernels
+    if (site_repeat && site_repeat_buffer.size() < num_threads)
+        site_repeat_buffer.resize(num_threads);
 #ifndef KERNEL_FIX_STATES
     size_t nstates = aln->num_states;
 #endif
@@ -1129,6 +1369,9 @@ void PhyloTree::computeTraversalInfo(PhyloNode *node, PhyloNode *dad, bool compu
     if (traversal_info.empty())
         return;
 
+    // once per traversal, however the patterns are split into blocks and tiles
+    Profiler::getInstance().add(PROF_PARTIAL_LH, traversal_info.size(), traversal_info.size() * aln->getNPattern(), 0.0);
+
     if (!model->isSiteSpecificModel()) {
 
         int num_info = traversal_info.size();
@@ -1185,17 +1428,24 @@ void PhyloTree::computeTraversalInfo(PhyloNode *node, PhyloNode *dad, bool compu
     }
 
     if (compute_partial_lh) {
-        vector<size_t> limits;
         size_t orig_nptn = ((aln->size()+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
         size_t nptn = ((orig_nptn+model_factory->unobserved_ptns.size()+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
-        computeBounds<VectorClass>(num_threads, nptn, limits);
+        pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
 
         #ifdef _OPENMP
-        #pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+        #pragma omp parallel num_threads(num_threads)
+        #endif
+        {
+        #ifdef _OPENMP
+            int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+        #else
+            int thread_id = 0, team_size = 1;
         #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, limits[thread_id], limits[thread_id+1], thread_id);
+            size_t block_id;
+            // each block runs through the whole traversal tile by tile, so children are done before parents
+            while (pattern_scheduler.next(thread_id, team_size, block_id)) {
+                computeTraversalPartialLikelihood(pattern_scheduler.getLower(block_id), pattern_scheduler.getUpper(block_id), VectorClass::size(), thread_id);
+            }
         }
         traversal_info.clear();
     }
@@ -1209,10 +1459,10 @@ void PhyloTree::computeTraversalInfo(PhyloNode *node, PhyloNode *dad, bool compu
  ******************************************************/
 
 #ifdef KERNEL_FIX_STATES
-template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 void PhyloTree::computePartialLikelihoodSIMD(TraversalInfo &info, size_t ptn_lower, size_t ptn_upper, int thread_id)
 #else
-template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t ptn_lower, size_t ptn_upper, int thread_id)
 #endif
 {
@@ -1260,6 +1510,9 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
     size_t tip_mem_size = max_orig_nptn * nstates;
 //    size_t scale_size = SAFE_NUMERIC ? max_nptn * ncat_mix : max_nptn;
     size_t scale_size = SAFE_NUMERIC ? (ptn_upper-ptn_lower) * ncat_mix : (ptn_upper-ptn_lower);
+    // float partial_lh are scaled earlier to stay within float range
+    const double scaling_threshold = FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD;
+    const int scaling_exp = FLOAT_LH ? SCALING_THRESHOLD_FLOAT_EXP : SCALING_THRESHOLD_EXP;
 
 	double *evec = model->getEigenvectors();
 	double *inv_evec = model->getInverseEigenvectors();
@@ -1280,7 +1533,16 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 
     // precomputed buffer to save times
     size_t thread_buf_size = (2*block+nstates)*VectorClass::size();
+    // with FLOAT_LH or site repeats, 3*block more per thread to convert or gather partial_lh of dad, left and right
+    if (FLOAT_LH || site_repeat)
+        thread_buf_size += 3*block*VectorClass::size();
     double *buffer_partial_lh_ptr = buffer_partial_lh + (getBufferPartialLhSize() - thread_buf_size*num_threads);
+    VectorClass *float_dad = NULL, *float_left = NULL, *float_right = NULL;
+    if (FLOAT_LH || site_repeat) {
+        float_dad = (VectorClass*)getBufferFloatLh(VectorClass::size(), thread_id);
+        float_left = float_dad + block;
+        float_right = float_left + block;
+    }
     double *echildren = NULL;
     double *partial_lh_leaves = NULL;
 
@@ -1333,6 +1595,24 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         len_right = etmp;
 	}
 
+    // site repeat compression: only the first pattern of each repeat class (ptn_list) is computed,
+    // the other patterns are copied from there after the loop over patterns
+    UINT ptn_lane[VectorClass::size()];
+    UINT *ptn_list = NULL;
+    size_t list_upper = ptn_upper;
+    if (info.site_repeat && computeSiteRepeats(info, ptn_lower, ptn_upper, thread_id) < ptn_upper-ptn_lower && !SITE_MODEL) {
+        vector<UINT> &list = site_repeat_buffer[thread_id];
+        list.clear();
+        for (ptn = ptn_lower; ptn < ptn_upper; ptn++)
+            if (info.site_repeat[ptn] == ptn)
+                list.push_back(ptn);
+        // fill up the last vector with the last pattern
+        while (list.size() % VectorClass::size() != 0)
+            list.push_back(list.back());
+        ptn_list = &list[0];
+        list_upper = ptn_lower + list.size();
+    }
+
     if (node->degree() > 3) {
         /*--------------------- multifurcating node ------------------*/
 
@@ -1386,7 +1666,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     } else {
                         // internal node
                         VectorClass *partial_lh = partial_lh_all;
-                        VectorClass *partial_lh_child = (VectorClass*)(child->partial_lh + ptn*block);
+                        VectorClass *partial_lh_child = loadPartialLh<VectorClass, FLOAT_LH>(child->partial_lh, ptn*block, block, float_left);
                         if (!SAFE_NUMERIC) {
                             for (i = 0; i < VectorClass::size(); i++)
                                 dad_branch->scale_num[ptn+i] += child->scale_num[ptn+i];
@@ -1446,7 +1726,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     } else {
                         // internal node
                         VectorClass *partial_lh = partial_lh_all;
-                        VectorClass *partial_lh_child = (VectorClass*)(child->partial_lh + ptn*block);
+                        VectorClass *partial_lh_child = loadPartialLh<VectorClass, FLOAT_LH>(child->partial_lh, ptn*block, block, float_left);
                         if (!SAFE_NUMERIC) {
                             for (i = 0; i < VectorClass::size(); i++)
                                 dad_branch->scale_num[ptn+i] += child->scale_num[ptn+i];
@@ -1483,7 +1763,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                         for (x = 0; x < nstates; x++)
                             lh_max = max(lh_max,abs(partial_lh_tmp[x]));
                         // check if one should scale partial likelihoods
-                        auto underflown = ((lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0));
+                        auto underflown = ((lh_max < scaling_threshold) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0));
                         if (horizontal_or(underflown)) { // at least one site has numerical underflown
                             for (x = 0; x < VectorClass::size(); x++)
                             if (underflown[x]) {
@@ -1491,7 +1771,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                                 // now do the likelihood scaling
                                 double *partial_lh = (double*)partial_lh_tmp + (x);
                                 for (i = 0; i < nstates; i++)
-                                    partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
+                                    partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
                                 dad_branch->scale_num[(ptn+x)*ncat_mix+c] += 1;
                             }
                         }
@@ -1502,14 +1782,14 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     VectorClass lh_max = 0.0;
                     for (x = 0; x < block; x++)
                         lh_max = max(lh_max,abs(partial_lh_all[x]));
-                    auto underflown = (lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0);
+                    auto underflown = (lh_max < scaling_threshold) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0);
                     if (horizontal_or(underflown)) { // at least one site has numerical underflown
                         for (x = 0; x < VectorClass::size(); x++)
                         if (underflown[x]) {
                             double *partial_lh = (double*)partial_lh_all + (x);
                             // now do the likelihood scaling
                             for (i = 0; i < block; i++) {
-                                partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
+                                partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
                             }
     //                        sum_scale += LOG_SCALING_THRESHOLD * ptn_freq[ptn+x];
                             dad_branch->scale_num[ptn+x] += 1;
@@ -1522,7 +1802,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         
             // compute dot-product with inv_eigenvector
             VectorClass *partial_lh_tmp = partial_lh_all;
-            VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+            VectorClass *partial_lh = outPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, float_dad);
             VectorClass lh_max = 0.0;
             double *inv_evec_ptr = SITE_MODEL ? &inv_evec[ptn*states_square] : NULL;
             for (c = 0; c < ncat_mix; c++) {
@@ -1544,6 +1824,7 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 partial_lh += nstates;
                 partial_lh_tmp += nstates;
             }
+            storePartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
 
         } // for ptn
 
@@ -1562,8 +1843,9 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         double *vec_right =  SITE_MODEL ? &vec_left[nstates*VectorClass::size()] : &vec_left[block*VectorClass::size()];
         VectorClass *partial_lh_tmp = SITE_MODEL ? (VectorClass*)vec_right+nstates : (VectorClass*)vec_right+block;
 
-		for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-			VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+		for (size_t pos = ptn_lower; pos < list_upper; pos+=VectorClass::size()) {
+            bool gather = getPatternVector<VectorClass>(ptn_list, pos, ptn_lower, ptn, ptn_lane);
+			VectorClass *partial_lh = gather ? float_dad : outPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, float_dad);
 
             if (SITE_MODEL) {
                 VectorClass* expleft = (VectorClass*) vec_left;
@@ -1602,15 +1884,15 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 // load data for tip
                 for (x = 0; x < VectorClass::size(); x++) {
                     double *tip_left, *tip_right;
-                    if (ptn+x < orig_nptn) {
-                        tip_left  = partial_lh_left  + block * (aln->at(ptn+x))[left->node->id];
-                        tip_right = partial_lh_right + block * (aln->at(ptn+x))[right->node->id];
-                    } else if (ptn+x < max_orig_nptn) {
+                    if (ptn_lane[x] < orig_nptn) {
+                        tip_left  = partial_lh_left  + block * (aln->at(ptn_lane[x]))[left->node->id];
+                        tip_right = partial_lh_right + block * (aln->at(ptn_lane[x]))[right->node->id];
+                    } else if (ptn_lane[x] < max_orig_nptn) {
                         tip_left  = partial_lh_left  + block * aln->STATE_UNKNOWN;
                         tip_right = partial_lh_right + block * aln->STATE_UNKNOWN;
-                    } else if (ptn+x < nptn) {
-                        tip_left  = partial_lh_left  + block * model_factory->unobserved_ptns[ptn+x-max_orig_nptn][left->node->id];
-                        tip_right = partial_lh_right + block * model_factory->unobserved_ptns[ptn+x-max_orig_nptn][right->node->id];
+                    } else if (ptn_lane[x] < nptn) {
+                        tip_left  = partial_lh_left  + block * model_factory->unobserved_ptns[ptn_lane[x]-max_orig_nptn][left->node->id];
+                        tip_right = partial_lh_right + block * model_factory->unobserved_ptns[ptn_lane[x]-max_orig_nptn][right->node->id];
                     } else {
                         tip_left  = partial_lh_left  + block * aln->STATE_UNKNOWN;
                         tip_right = partial_lh_right + block * aln->STATE_UNKNOWN;
@@ -1646,6 +1928,10 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                     partial_lh += nstates;
                 } // FOR category
             } // IF SITE_MODEL
+            if (gather)
+                scatterPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn_lane, block, float_dad);
+            else
+                storePartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
 		} // FOR LOOP
 
 
@@ -1665,9 +1951,13 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         double *vec_left = buffer_partial_lh_ptr + thread_buf_size*thread_id;
         VectorClass *partial_lh_tmp = SITE_MODEL ? (VectorClass*)vec_left+2*nstates : (VectorClass*)vec_left+block;
 
-		for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-			VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
-			VectorClass *partial_lh_right = (VectorClass*)(right->partial_lh + ptn*block);
+		for (size_t pos = ptn_lower; pos < list_upper; pos+=VectorClass::size()) {
+            bool gather = getPatternVector<VectorClass>(ptn_list, pos, ptn_lower, ptn, ptn_lane);
+            VectorClass vc_invar = loadPtnInvar<VectorClass>(ptn_invar, ptn, ptn_lane, gather);
+			VectorClass *partial_lh = gather ? float_dad : outPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, float_dad);
+			VectorClass *partial_lh_right = gather ? gatherPartialLh<VectorClass, FLOAT_LH>(right->partial_lh, ptn_lane, block, float_right) :
+                loadPartialLh<VectorClass, FLOAT_LH>(right->partial_lh, ptn*block, block, float_right);
+            double *dad_partial_lh = (double*)partial_lh;
 //            memset(partial_lh, 0, sizeof(VectorClass)*block);
             VectorClass lh_max = 0.0;
 
@@ -1700,16 +1990,18 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 #endif
                     // check if one should scale partial likelihoods
                     if (SAFE_NUMERIC) {
-                        auto underflown = ((lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0));
+                        auto underflown = ((lh_max < scaling_threshold) & (vc_invar == 0.0));
                         if (horizontal_or(underflown)) { // at least one site has numerical underflown
                             for (x = 0; x < VectorClass::size(); x++)
                             if (underflown[x]) {
                                 // BQM 2016-05-03: only scale for non-constant sites
                                 // now do the likelihood scaling
-                                double *partial_lh = dad_branch->partial_lh + (ptn*block + c*nstates*VectorClass::size() + x);
+                                double *partial_lh = dad_partial_lh + (c*nstates*VectorClass::size() + x);
                                 for (i = 0; i < nstates; i++)
-                                    partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
-                                dad_branch->scale_num[(ptn+x)*ncat_mix+c] += 1;
+                                    partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
+                                // lanes padding the last vector repeat the same pattern, scale it only once
+                                if (x == 0 || ptn_lane[x] != ptn_lane[x-1])
+                                    dad_branch->scale_num[ptn_lane[x]*ncat_mix+c] += 1;
                             }
                         }
                     }
@@ -1722,12 +2014,12 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
                 // load data for tip
                 for (x = 0; x < VectorClass::size(); x++) {
                     double *tip;
-                    if (ptn+x < orig_nptn) {
-                        tip = partial_lh_left + block*(aln->at(ptn+x))[left->node->id];
-                    } else if (ptn+x < max_orig_nptn) {
+                    if (ptn_lane[x] < orig_nptn) {
+                        tip = partial_lh_left + block*(aln->at(ptn_lane[x]))[left->node->id];
+                    } else if (ptn_lane[x] < max_orig_nptn) {
                         tip = partial_lh_left + block*aln->STATE_UNKNOWN;
-                    } else if (ptn+x < nptn) {
-                        tip = partial_lh_left + block*model_factory->unobserved_ptns[ptn+x-max_orig_nptn][left->node->id];
+                    } else if (ptn_lane[x] < nptn) {
+                        tip = partial_lh_left + block*model_factory->unobserved_ptns[ptn_lane[x]-max_orig_nptn][left->node->id];
                     } else {
                         tip = partial_lh_left + block*aln->STATE_UNKNOWN;
                     }
@@ -1763,16 +2055,17 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
     #endif
                     // check if one should scale partial likelihoods
                     if (SAFE_NUMERIC) {
-                        auto underflown = ((lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0));
+                        auto underflown = ((lh_max < scaling_threshold) & (vc_invar == 0.0));
                         if (horizontal_or(underflown)) { // at least one site has numerical underflown
                             for (x = 0; x < VectorClass::size(); x++)
                             if (underflown[x]) {
                                 // BQM 2016-05-03: only scale for non-constant sites
                                 // now do the likelihood scaling
-                                double *partial_lh = dad_branch->partial_lh + (ptn*block + c*nstates*VectorClass::size() + x);
+                                double *partial_lh = dad_partial_lh + (c*nstates*VectorClass::size() + x);
                                 for (i = 0; i < nstates; i++)
-                                    partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
-                                dad_branch->scale_num[(ptn+x)*ncat_mix+c] += 1;
+                                    partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
+                                if (x == 0 || ptn_lane[x] != ptn_lane[x-1])
+                                    dad_branch->scale_num[ptn_lane[x]*ncat_mix+c] += 1;
                             }
                         }
                     }
@@ -1783,20 +2076,25 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
             } // IF SITE_MODEL
 
             if (!SAFE_NUMERIC) {
-                auto underflown = (lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0);
+                auto underflown = (lh_max < scaling_threshold) & (vc_invar == 0.0);
                 if (horizontal_or(underflown)) { // at least one site has numerical underflown
                     for (x = 0; x < VectorClass::size(); x++)
                     if (underflown[x]) {
-                        double *partial_lh = dad_branch->partial_lh + (ptn*block + x);
+                        double *partial_lh = dad_partial_lh + x;
                         // now do the likelihood scaling
                         for (i = 0; i < block; i++) {
-                            partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
+                            partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
                         }
 //                        sum_scale += LOG_SCALING_THRESHOLD * ptn_freq[ptn+x];
-                        dad_branch->scale_num[ptn+x] += 1;
+                        if (x == 0 || ptn_lane[x] != ptn_lane[x-1])
+                            dad_branch->scale_num[ptn_lane[x]] += 1;
                     }
                 }
             }
+            if (gather)
+                scatterPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn_lane, block, float_dad);
+            else
+                storePartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
 
 		} // big for loop over ptn
 
@@ -1805,24 +2103,21 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
         /*--------------------- INTERNAL-INTERNAL NODE case ------------------*/
 
         VectorClass *partial_lh_tmp = (VectorClass*)(buffer_partial_lh_ptr + thread_buf_size*thread_id);
-		for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-			VectorClass *partial_lh = (VectorClass*)(dad_branch->partial_lh + ptn*block);
-			VectorClass *partial_lh_left = (VectorClass*)(left->partial_lh + ptn*block);
-			VectorClass *partial_lh_right = (VectorClass*)(right->partial_lh + ptn*block);
+		for (size_t pos = ptn_lower; pos < list_upper; pos+=VectorClass::size()) {
+            bool gather = getPatternVector<VectorClass>(ptn_list, pos, ptn_lower, ptn, ptn_lane);
+            VectorClass vc_invar = loadPtnInvar<VectorClass>(ptn_invar, ptn, ptn_lane, gather);
+			VectorClass *partial_lh = gather ? float_dad : outPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, float_dad);
+			VectorClass *partial_lh_left = gather ? gatherPartialLh<VectorClass, FLOAT_LH>(left->partial_lh, ptn_lane, block, float_left) :
+                loadPartialLh<VectorClass, FLOAT_LH>(left->partial_lh, ptn*block, block, float_left);
+			VectorClass *partial_lh_right = gather ? gatherPartialLh<VectorClass, FLOAT_LH>(right->partial_lh, ptn_lane, block, float_right) :
+                loadPartialLh<VectorClass, FLOAT_LH>(right->partial_lh, ptn*block, block, float_right);
+            double *dad_partial_lh = (double*)partial_lh;
             VectorClass lh_max = 0.0;
-            UBYTE *scale_dad, *scale_left, *scale_right;
+            UBYTE *scale_dad = dad_branch->scale_num, *scale_left = left->scale_num, *scale_right = right->scale_num;
 
-            if (SAFE_NUMERIC) {
-                size_t addr = ptn*ncat_mix;
-                scale_dad = dad_branch->scale_num + addr;
-                scale_left = left->scale_num + addr;
-                scale_right = right->scale_num + addr;
-            } else {
-                scale_dad = dad_branch->scale_num + ptn;
-                scale_left = left->scale_num + ptn;
-                scale_right = right->scale_num + ptn;
-                for (i = 0; i < VectorClass::size(); i++)
-                    scale_dad[i] = scale_left[i] + scale_right[i];
+            if (!SAFE_NUMERIC) {
+                for (x = 0; x < VectorClass::size(); x++)
+                    scale_dad[ptn_lane[x]] = scale_left[ptn_lane[x]] + scale_right[ptn_lane[x]];
             }
 
             double *eleft_ptr = eleft;
@@ -1839,8 +2134,10 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 			for (c = 0; c < ncat_mix; c++) {
                 if (SAFE_NUMERIC) {
                     lh_max = 0.0;
-                    for (x = 0; x < VectorClass::size(); x++)
-                        scale_dad[x*ncat_mix] = scale_left[x*ncat_mix] + scale_right[x*ncat_mix];
+                    for (x = 0; x < VectorClass::size(); x++) {
+                        size_t addr = ptn_lane[x]*ncat_mix+c;
+                        scale_dad[addr] = scale_left[addr] + scale_right[addr];
+                    }
                 }
 
                 if (SITE_MODEL) {
@@ -1886,20 +2183,19 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 
                 // check if one should scale partial likelihoods
                 if (SAFE_NUMERIC) {
-                    auto underflown = ((lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0));
+                    auto underflown = ((lh_max < scaling_threshold) & (vc_invar == 0.0));
                     if (horizontal_or(underflown))
                         for (x = 0; x < VectorClass::size(); x++)
                         if (underflown[x]) {
                             // BQM 2016-05-03: only scale for non-constant sites
                             // now do the likelihood scaling
-                            double *partial_lh = dad_branch->partial_lh + (ptn*block + c*nstates*VectorClass::size() + x);
+                            double *partial_lh = dad_partial_lh + (c*nstates*VectorClass::size() + x);
                             for (i = 0; i < nstates; i++)
-                                partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
-                            scale_dad[x*ncat_mix] += 1;
+                                partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
+                            // lanes padding the last vector repeat the same pattern, scale it only once
+                            if (x == 0 || ptn_lane[x] != ptn_lane[x-1])
+                                scale_dad[ptn_lane[x]*ncat_mix+c] += 1;
                         }
-                    scale_dad++;
-                    scale_left++;
-                    scale_right++;
                 }
                 partial_lh_left += nstates;
                 partial_lh_right += nstates;
@@ -1908,25 +2204,34 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 
             if (!SAFE_NUMERIC) {
                 // check if one should scale partial likelihoods
-                auto underflown = (lh_max < SCALING_THRESHOLD) & (VectorClass().load_a(&ptn_invar[ptn]) == 0.0);
+                auto underflown = (lh_max < scaling_threshold) & (vc_invar == 0.0);
                 if (horizontal_or(underflown)) { // at least one site has numerical underflown
                     for (x = 0; x < VectorClass::size(); x++)
                     if (underflown[x]) {
-                        double *partial_lh = dad_branch->partial_lh + (ptn*block + x);
+                        double *partial_lh = dad_partial_lh + x;
                         // now do the likelihood scaling
                         for (i = 0; i < block; i++) {
-                            partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], SCALING_THRESHOLD_EXP);
+                            partial_lh[i*VectorClass::size()] = ldexp(partial_lh[i*VectorClass::size()], scaling_exp);
                         }
 //                        sum_scale += LOG_SCALING_THRESHOLD * ptn_freq[ptn+x];
-                        dad_branch->scale_num[ptn+x] += 1;
+                        if (x == 0 || ptn_lane[x] != ptn_lane[x-1])
+                            dad_branch->scale_num[ptn_lane[x]] += 1;
                     }
                 }
             }
+            if (gather)
+                scatterPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn_lane, block, float_dad);
+            else
+                storePartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
 
 		} // big for loop over ptn
 
 	}
 
+    if (ptn_list)
+        copySiteRepeats<VectorClass, FLOAT_LH>(dad_branch->partial_lh, dad_branch->scale_num, info.site_repeat,
+            ptn_lower, ptn_upper, block, SAFE_NUMERIC ? ncat_mix : 1);
+
     if (Params::getInstance().buffer_mem_save) {
         if (partial_lh_leaves)
             aligned_free(partial_lh_leaves);
@@ -1943,10 +2248,10 @@ void PhyloTree::computePartialLikelihoodGenericSIMD(TraversalInfo &info, size_t
 
 
 #ifdef KERNEL_FIX_STATES
-template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 void PhyloTree::computeLikelihoodBufferSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, size_t ptn_lower, size_t ptn_upper, int thread_id)
 #else
-template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, size_t ptn_lower, size_t ptn_upper, int thread_id)
 #endif
 {
@@ -1980,9 +2285,17 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
         buffer_partial_lh_ptr += nmix*(nmix+1)*VectorClass::size() + (nmix+3)*nmix*VectorClass::size()*num_threads;
     }
 
+    const double scaling_threshold = FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD;
+    const double log_scaling_threshold = FLOAT_LH ? LOG_SCALING_THRESHOLD_FLOAT : LOG_SCALING_THRESHOLD;
+    // buffers to convert float partial_lh, free again after computePartialLikelihood
+    VectorClass *float_dad = NULL, *float_node = NULL;
+    if (FLOAT_LH) {
+        float_dad = (VectorClass*)getBufferFloatLh(VectorClass::size(), thread_id);
+        float_node = float_dad + block;
+    }
+
     // first compute partial_lh
-    for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-        computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+    computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
     if (dad->isLeaf()) {
         // special treatment for TIP-INTERNAL NODE case
@@ -1991,7 +2304,7 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
         double *vec_tip = buffer_partial_lh_ptr + tip_block*VectorClass::size()*thread_id;
 
         for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
-            VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+            VectorClass *partial_lh_dad = loadPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
             VectorClass *theta = (VectorClass*)(theta_all + ptn*block);
             //load tip vector
             if (!SITE_MODEL)
@@ -2040,7 +2353,7 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
                         if (scale_dad[c] == min_scale+1) {
                             double *this_theta = &theta_all[ptn*block + c*nstates*VectorClass::size() + i];
                             for (size_t x = 0; x < nstates; x++) {
-                                this_theta[x*VectorClass::size()] *= SCALING_THRESHOLD;
+                                this_theta[x*VectorClass::size()] *= scaling_threshold;
                             }
                         } else if (scale_dad[c] > min_scale+1) {
                             double *this_theta = &theta_all[ptn*block + c*nstates*VectorClass::size() + i];
@@ -2056,7 +2369,7 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
                     buffer_scale_all[ptn+i] = dad_branch->scale_num[ptn+i];
             }
             VectorClass *buf = (VectorClass*)(buffer_scale_all+ptn);
-            *buf *= LOG_SCALING_THRESHOLD;
+            *buf *= log_scaling_threshold;
 
         } // FOR PTN LOOP
 //            aligned_free(vec_tip);
@@ -2066,8 +2379,8 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
         // now compute theta
         for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
             VectorClass *theta = (VectorClass*)(theta_all + ptn*block);
-            VectorClass *partial_lh_node = (VectorClass*)(node_branch->partial_lh + ptn*block);
-            VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+            VectorClass *partial_lh_node = loadPartialLh<VectorClass, FLOAT_LH>(node_branch->partial_lh, ptn*block, block, float_node);
+            VectorClass *partial_lh_dad = loadPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
             for (i = 0; i < block; i++)
                 theta[i] = partial_lh_node[i] * partial_lh_dad[i];
 
@@ -2091,7 +2404,7 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
                         if (sum_scale[c] == min_scale+1) {
                             double *this_theta = &theta_all[ptn*block + c*nstates*VectorClass::size() + i];
                             for (size_t x = 0; x < nstates; x++) {
-                                this_theta[x*VectorClass::size()] *= SCALING_THRESHOLD;
+                                this_theta[x*VectorClass::size()] *= scaling_threshold;
                             }
                         } else if (sum_scale[c] > min_scale+1) {
                             double *this_theta = &theta_all[ptn*block + c*nstates*VectorClass::size() + i];
@@ -2108,16 +2421,16 @@ void PhyloTree::computeLikelihoodBufferGenericSIMD(PhyloNeighbor *dad_branch, Ph
                     buffer_scale_all[ptn+i] = dad_branch->scale_num[ptn+i] + node_branch->scale_num[ptn+i];
             }
             VectorClass *buf = (VectorClass*)(buffer_scale_all+ptn);
-            *buf *= LOG_SCALING_THRESHOLD;
+            *buf *= log_scaling_threshold;
         } // FOR ptn
     } // internal node
 }
 
 #ifdef KERNEL_FIX_STATES
-template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 void PhyloTree::computeLikelihoodDervSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, double *df, double *ddf)
 #else
-template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, double *df, double *ddf)
 #endif
 {
@@ -2183,8 +2496,8 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
     ASSERT(eval);
 
     double *buffer_partial_lh_ptr = buffer_partial_lh;
-    vector<size_t> limits;
-    computeBounds<VectorClass>(num_threads, nptn, limits);
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
 
 	ASSERT(theta_all);
 
@@ -2266,21 +2579,35 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
         for (i = 0; i < nmixlen2; i++) all_ddfvec[i] = 0.0;
     }
 
+    // per-block accumulators, reduced in block order for reproducible results
+    size_t block_acc_size = num_blocks*(5 + (isMixlen() ? nmixlen+nmixlen2+1 : 0));
+    VectorClass *block_acc = (VectorClass*)getBufferBlockAcc(block_acc_size*VectorClass::size());
+    VectorClass *block_mixlen = NULL;
+    if (isMixlen())
+        block_mixlen = block_acc + num_blocks*5;
+
 //    double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
 
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static, 1) private(ptn, i, c) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-    for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+    {
+#ifdef _OPENMP
+    int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+    int thread_id = 0, team_size = 1;
+#endif
+    size_t block_id;
+    while (pattern_scheduler.next(thread_id, team_size, block_id)) {
         VectorClass my_df(0.0), my_ddf(0.0), vc_prob_const(0.0), vc_df_const(0.0), vc_ddf_const(0.0);
-        size_t ptn_lower = limits[thread_id];
-        size_t ptn_upper = limits[thread_id+1];
+        size_t ptn_lower = pattern_scheduler.getLower(block_id);
+        size_t ptn_upper = pattern_scheduler.getUpper(block_id);
 
         if (!theta_computed)
         #ifdef KERNEL_FIX_STATES
-            computeLikelihoodBufferSIMD<VectorClass, SAFE_NUMERIC, nstates, FMA, SITE_MODEL>(dad_branch, dad, ptn_lower, ptn_upper, thread_id);
+            computeLikelihoodBufferSIMD<VectorClass, SAFE_NUMERIC, nstates, FMA, SITE_MODEL, FLOAT_LH>(dad_branch, dad, ptn_lower, ptn_upper, thread_id);
         #else
-            computeLikelihoodBufferGenericSIMD<VectorClass, SAFE_NUMERIC, FMA, SITE_MODEL>(dad_branch, dad, ptn_lower, ptn_upper, thread_id);
+            computeLikelihoodBufferGenericSIMD<VectorClass, SAFE_NUMERIC, FMA, SITE_MODEL, FLOAT_LH>(dad_branch, dad, ptn_lower, ptn_upper, thread_id);
         #endif
 
         if (isMixlen()) {
@@ -2347,21 +2674,12 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
                 }
             } // FOR ptn
 
-        #ifdef _OPENMP
-        #pragma omp critical
-        #endif
-            {
-                for (i = 0; i < nmixlen; i++)
-                    all_dfvec[i] += my_df[i];
-                for (i = 0; i < nmixlen2; i++)
-                    all_ddfvec[i] += my_ddf[i];
-                all_lh += my_lh;
-//                if (isASC) {
-//                    all_prob_const += vc_prob_const;
-//                    all_df_const += vc_df_const;
-//                    all_ddf_const += vc_ddf_const;
-//                }
-            }
+            VectorClass *this_block = block_mixlen + block_id*(nmixlen+nmixlen2+1);
+            for (i = 0; i < nmixlen; i++)
+                this_block[i] = my_df[i];
+            for (i = 0; i < nmixlen2; i++)
+                this_block[nmixlen+i] = my_ddf[i];
+            this_block[nmixlen+nmixlen2] = my_lh;
 
         } else {
             // normal joint branch length model
@@ -2424,9 +2742,9 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
                         double *ddf_ptn_dbl = (double*)&ddf_ptn;
                         for (i = 0; i < VectorClass::size(); i++)
                             if (buffer_scale_all[ptn+i] != 0.0) {
-                                lh_ptn_dbl[i] *= SCALING_THRESHOLD;
-                                df_ptn_dbl[i] *= SCALING_THRESHOLD;
-                                ddf_ptn_dbl[i] *= SCALING_THRESHOLD;
+                                lh_ptn_dbl[i] *= (FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD);
+                                df_ptn_dbl[i] *= (FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD);
+                                ddf_ptn_dbl[i] *= (FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD);
                             }
                     }
 
@@ -2441,20 +2759,36 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
                     }
                 }
             } // FOR ptn
-        #ifdef _OPENMP
-        #pragma omp critical
-        #endif
-            {
-                all_df += my_df;
-                all_ddf += my_ddf;
-                if (ASC_Lewis) {
-                    all_prob_const += vc_prob_const;
-                    all_df_const += vc_df_const;
-                    all_ddf_const += vc_ddf_const;
-                }
-            }
+            VectorClass *this_block = block_acc + block_id*5;
+            this_block[0] = my_df;
+            this_block[1] = my_ddf;
+            this_block[2] = vc_prob_const;
+            this_block[3] = vc_df_const;
+            this_block[4] = vc_ddf_const;
         } // else isMixlen()
-    } // FOR thread
+    } // WHILE block
+    } // PARALLEL
+
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        if (isMixlen()) {
+            VectorClass *this_block = block_mixlen + b*(nmixlen+nmixlen2+1);
+            for (i = 0; i < nmixlen; i++)
+                all_dfvec[i] += this_block[i];
+            for (i = 0; i < nmixlen2; i++)
+                all_ddfvec[i] += this_block[nmixlen+i];
+            all_lh += this_block[nmixlen+nmixlen2];
+        } else {
+            VectorClass *this_block = block_acc + b*5;
+            all_df += this_block[0];
+            all_ddf += this_block[1];
+            if (ASC_Lewis) {
+                all_prob_const += this_block[2];
+                all_df_const += this_block[3];
+                all_ddf_const += this_block[4];
+            }
+        }
+    }
 
     // mark buffer as computed
     theta_computed = true;
@@ -2556,10 +2890,10 @@ void PhyloTree::computeLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch, Phyl
  ******************************************************/
 
 #ifdef KERNEL_FIX_STATES
-template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const int nstates, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 double PhyloTree::computeLikelihoodBranchSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad)
 #else
-template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool SAFE_NUMERIC, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad)
 #endif
 {
@@ -2601,6 +2935,8 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
     size_t max_orig_nptn = ((orig_nptn+VectorClass::size()-1)/VectorClass::size())*VectorClass::size();
     size_t nptn = max_orig_nptn+model_factory->unobserved_ptns.size();
     size_t tip_mem_size = max_orig_nptn * nstates;
+    const double scaling_threshold = FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD;
+    const double log_scaling_threshold = FLOAT_LH ? LOG_SCALING_THRESHOLD_FLOAT : LOG_SCALING_THRESHOLD;
     ASCType ASC_type = model_factory->getASC();
     bool ASC_Holder = (ASC_type == ASC_VARIANT_MISSING || ASC_type == ASC_INFORMATIVE_MISSING);
     bool ASC_Lewis = (ASC_type == ASC_VARIANT || ASC_type == ASC_INFORMATIVE);
@@ -2659,8 +2995,10 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
     VectorClass all_tree_lh(0.0);
     VectorClass all_prob_const(0.0);
 
-    vector<size_t> limits;
-    computeBounds<VectorClass>(num_threads, nptn, limits);
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
+    // per-block accumulators, reduced in block order for reproducible results
+    VectorClass *block_acc = (VectorClass*)getBufferBlockAcc(num_blocks*2*VectorClass::size());
 
     if (dad->isLeaf()) {
     	// special treatment for TIP-INTERNAL NODE case
@@ -2712,21 +3050,33 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
 
     	// now do the real computation
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static, 1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        // buffers to convert float partial_lh, free again after computePartialLikelihood
+        VectorClass *float_dad = NULL, *float_node = NULL;
+        if (FLOAT_LH) {
+            float_dad = (VectorClass*)getBufferFloatLh(VectorClass::size(), thread_id);
+            float_node = float_dad + block;
+        }
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
 
             VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
 
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
 
             // reset memory for _pattern_lh_cat
             memset(_pattern_lh_cat + ptn_lower*ncat_mix, 0, sizeof(double)*(ptn_upper-ptn_lower)*ncat_mix);
 
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
             double *vec_tip = buffer_partial_lh_ptr + block*VectorClass::size()*thread_id;
 
@@ -2734,7 +3084,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                 VectorClass lh_ptn(0.0);
 //                lh_ptn.load_a(&ptn_invar[ptn]);
                 VectorClass *lh_cat = (VectorClass*)(_pattern_lh_cat + ptn*ncat_mix);
-                VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
+                VectorClass *partial_lh_dad = loadPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
                 VectorClass *lh_node = SITE_MODEL ? (VectorClass*)&partial_lh_node[ptn*nstates] : (VectorClass*)vec_tip;
 
                 if (SITE_MODEL) {
@@ -2806,7 +3156,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         for (c = 0; c < ncat_mix; c++) {
                             // rescale lh_cat if neccessary
                             if (scale_dad[c] == min_scale+1) {
-                                this_lh_cat[c*VectorClass::size()] *= SCALING_THRESHOLD;
+                                this_lh_cat[c*VectorClass::size()] *= scaling_threshold;
                             } else if (scale_dad[c] > min_scale+1) {
                                 this_lh_cat[c*VectorClass::size()] = 0.0;
                             }
@@ -2821,7 +3171,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         vc_min_scale_ptr[i] = dad_branch->scale_num[ptn+i];
                     }
                 }
-                vc_min_scale *= LOG_SCALING_THRESHOLD;
+                vc_min_scale *= log_scaling_threshold;
 
                 // Sum later to avoid underflow of invariant sites
                 lh_ptn = abs(lh_ptn) + VectorClass().load_a(&ptn_invar[ptn]);
@@ -2841,7 +3191,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         double *lh_ptn_dbl = (double*)&lh_ptn;
                         for (i = 0; i < VectorClass::size(); i++)
                             if (vc_min_scale_ptr[i] != 0.0)
-                                lh_ptn_dbl[i] *= SCALING_THRESHOLD;
+                                lh_ptn_dbl[i] *= scaling_threshold;
                     }
                     if (ASC_Holder)
                         lh_ptn.store_a(&_pattern_lh[ptn]);
@@ -2849,15 +3199,10 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         vc_prob_const += lh_ptn;
                 }
             } // FOR PTN
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-            {
-                all_tree_lh += vc_tree_lh;
-                if (ASC_Lewis)
-                    all_prob_const += vc_prob_const;
-            }
-        } // FOR thread
+            block_acc[block_id*2] = vc_tree_lh;
+            block_acc[block_id*2+1] = vc_prob_const;
+        } // WHILE block
+        } // PARALLEL
 
     } else {
 
@@ -2865,12 +3210,25 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
     	//-------- both dad and node are internal nodes -----------/
 
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static, 1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
+#endif
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        size_t block_id;
+        // buffers to convert float partial_lh, free again after computePartialLikelihood
+        VectorClass *float_dad = NULL, *float_node = NULL;
+        if (FLOAT_LH) {
+            float_dad = (VectorClass*)getBufferFloatLh(VectorClass::size(), thread_id);
+            float_node = float_dad + block;
+        }
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
 
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
 
             VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
 
@@ -2878,15 +3236,14 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
             memset(_pattern_lh_cat + ptn_lower*ncat_mix, 0, sizeof(double)*(ptn_upper-ptn_lower)*ncat_mix);
 
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
             for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
                 VectorClass lh_ptn(0.0);
 //                lh_ptn.load_a(&ptn_invar[ptn]);
                 VectorClass *lh_cat = (VectorClass*)(_pattern_lh_cat + ptn*ncat_mix);
-                VectorClass *partial_lh_dad = (VectorClass*)(dad_branch->partial_lh + ptn*block);
-                VectorClass *partial_lh_node = (VectorClass*)(node_branch->partial_lh + ptn*block);
+                VectorClass *partial_lh_dad = loadPartialLh<VectorClass, FLOAT_LH>(dad_branch->partial_lh, ptn*block, block, float_dad);
+                VectorClass *partial_lh_node = loadPartialLh<VectorClass, FLOAT_LH>(node_branch->partial_lh, ptn*block, block, float_node);
 
                 // compute likelihood per category
                 if (SITE_MODEL) {
@@ -2940,7 +3297,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         double *this_lh_cat = &_pattern_lh_cat[ptn*ncat_mix + i];
                         for (c = 0; c < ncat_mix; c++) {
                             if (sum_scale[c] == min_scale+1) {
-                                this_lh_cat[c*VectorClass::size()] *= SCALING_THRESHOLD;
+                                this_lh_cat[c*VectorClass::size()] *= scaling_threshold;
                             } else if (sum_scale[c] > min_scale+1) {
                                 // reset if category is scaled a lot
                                 this_lh_cat[c*VectorClass::size()] = 0.0;
@@ -2955,7 +3312,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         vc_min_scale_ptr[i] = dad_branch->scale_num[ptn+i] + node_branch->scale_num[ptn+i];
                     }
                 } // if SAFE_NUMERIC
-                vc_min_scale *= LOG_SCALING_THRESHOLD;
+                vc_min_scale *= log_scaling_threshold;
 
                 // Sum later to avoid underflow of invariant sites
                 lh_ptn = abs(lh_ptn) + VectorClass().load_a(&ptn_invar[ptn]);
@@ -2976,7 +3333,7 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         double *lh_ptn_dbl = (double*)&lh_ptn;
                         for (i = 0; i < VectorClass::size(); i++)
                             if (vc_min_scale_ptr[i] != 0.0)
-                                lh_ptn_dbl[i] *= SCALING_THRESHOLD;
+                                lh_ptn_dbl[i] *= scaling_threshold;
                     }
                     if (ASC_Holder)
                         lh_ptn.store_a(&_pattern_lh[ptn]);
@@ -2984,17 +3341,19 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
                         vc_prob_const += lh_ptn;
                 }
             } // FOR LOOP ptn
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-            {
-                all_tree_lh += vc_tree_lh;
-                if (ASC_Lewis)
-                    all_prob_const += vc_prob_const;
-            }
-        } // FOR thread
+            block_acc[block_id*2] = vc_tree_lh;
+            block_acc[block_id*2+1] = vc_prob_const;
+        } // WHILE block
+        } // PARALLEL
     } // else
 
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        all_tree_lh += block_acc[b*2];
+        if (ASC_Lewis)
+            all_prob_const += block_acc[b*2+1];
+    }
+
     tree_lh += horizontal_add(all_tree_lh);
 
 //    if (!SAFE_NUMERIC && !std::isfinite(tree_lh)))
@@ -3072,10 +3431,10 @@ double PhyloTree::computeLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_branch,
  ******************************************************/
 
 #ifdef KERNEL_FIX_STATES
-template <class VectorClass, const int nstates, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const int nstates, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 double PhyloTree::computeLikelihoodFromBufferSIMD()
 #else
-template <class VectorClass, const bool FMA, const bool SITE_MODEL>
+template <class VectorClass, const bool FMA, const bool SITE_MODEL, const bool FLOAT_LH>
 double PhyloTree::computeLikelihoodFromBufferGenericSIMD()
 #endif
 {
@@ -3155,15 +3514,26 @@ double PhyloTree::computeLikelihoodFromBufferGenericSIMD()
 
     VectorClass all_tree_lh(0.0), all_prob_const(0.0);
 
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
+    // per-block accumulators, reduced in block order for reproducible results
+    VectorClass *block_acc = (VectorClass*)getBufferBlockAcc(num_blocks*2*VectorClass::size());
+
 #ifdef _OPENMP
 #pragma omp parallel num_threads(num_threads)
-    {
 #endif
-        VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
+    {
 #ifdef _OPENMP
-#pragma omp for schedule(static) nowait
+    int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+    int thread_id = 0, team_size = 1;
 #endif
-    for (size_t ptn = 0; ptn < nptn; ptn+=VectorClass::size()) {
+    size_t block_id;
+    while (pattern_scheduler.next(thread_id, team_size, block_id)) {
+        VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
+        size_t ptn_lower = pattern_scheduler.getLower(block_id);
+        size_t ptn_upper = pattern_scheduler.getUpper(block_id);
+    for (size_t ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
 		VectorClass lh_ptn(0.0);
 		VectorClass *theta = (VectorClass*)(theta_all + ptn*block);
         if (SITE_MODEL) {
@@ -3205,26 +3575,25 @@ double PhyloTree::computeLikelihoodFromBufferGenericSIMD()
                 double *lh_ptn_dbl = (double*)&lh_ptn;
                 for (size_t i = 0; i < VectorClass::size(); i++)
                     if (buffer_scale_all[ptn+i] != 0.0)
-                        lh_ptn_dbl[i] *= SCALING_THRESHOLD;
+                        lh_ptn_dbl[i] *= (FLOAT_LH ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD);
             }
             if (ASC_Holder)
                 lh_ptn.store_a(&_pattern_lh[ptn]);
             else
                 vc_prob_const += lh_ptn;
         }
+    } // FOR ptn
+        block_acc[block_id*2] = vc_tree_lh;
+        block_acc[block_id*2+1] = vc_prob_const;
+    } // WHILE block
+    } // PARALLEL
+
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        all_tree_lh += block_acc[b*2];
+        if (ASC_Lewis)
+            all_prob_const += block_acc[b*2+1];
     }
-#ifdef _OPENMP
-#pragma omp critical
-        {
-            all_tree_lh += vc_tree_lh;
-            if (ASC_Lewis)
-                all_prob_const += vc_prob_const;
-        }
-    }
-#else
-    all_tree_lh = vc_tree_lh;
-    all_prob_const = vc_prob_const;
-#endif
 
     double tree_lh = horizontal_add(all_tree_lh);
 
@@ -3358,8 +3727,8 @@ void PhyloTree::computeLikelihoodDervMixlenGenericSIMD(PhyloNeighbor *dad_branch
     ASSERT(eval);
 
     double *buffer_partial_lh_ptr = buffer_partial_lh;
-    vector<size_t> limits;
-    computeBounds<VectorClass>(num_threads, nptn, limits);
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
 
 	ASSERT(theta_all);
 
@@ -3408,13 +3777,23 @@ void PhyloTree::computeLikelihoodDervMixlenGenericSIMD(PhyloNeighbor *dad_branch
 
 //    double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
 
+    // per-block accumulators, reduced in block order for reproducible results
+    VectorClass *block_acc = (VectorClass*)getBufferBlockAcc(num_blocks*5*VectorClass::size());
+
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static, 1) private(ptn, i, c) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-    for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+    {
+#ifdef _OPENMP
+    int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+    int thread_id = 0, team_size = 1;
+#endif
+    size_t block_id;
+    while (pattern_scheduler.next(thread_id, team_size, block_id)) {
         VectorClass my_df(0.0), my_ddf(0.0), vc_prob_const(0.0), vc_df_const(0.0), vc_ddf_const(0.0);
-        size_t ptn_lower = limits[thread_id];
-        size_t ptn_upper = limits[thread_id+1];
+        size_t ptn_lower = pattern_scheduler.getLower(block_id);
+        size_t ptn_upper = pattern_scheduler.getUpper(block_id);
 
         if (!theta_computed)
         #ifdef KERNEL_FIX_STATES
@@ -3464,20 +3843,26 @@ void PhyloTree::computeLikelihoodDervMixlenGenericSIMD(PhyloNeighbor *dad_branch
             }
         } // FOR ptn
 
-    #ifdef _OPENMP
-    #pragma omp critical
-    #endif
-        {
-            all_df += my_df;
-            all_ddf += my_ddf;
-            if (ASC_Lewis) {
-                all_prob_const += vc_prob_const;
-                all_df_const += vc_df_const;
-                all_ddf_const += vc_ddf_const;
-            }
+        VectorClass *this_block = block_acc + block_id*5;
+        this_block[0] = my_df;
+        this_block[1] = my_ddf;
+        this_block[2] = vc_prob_const;
+        this_block[3] = vc_df_const;
+        this_block[4] = vc_ddf_const;
+    } // WHILE block
+    } // PARALLEL
+
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        VectorClass *this_block = block_acc + b*5;
+        all_df += this_block[0];
+        all_ddf += this_block[1];
+        if (ASC_Lewis) {
+            all_prob_const += this_block[2];
+            all_df_const += this_block[3];
+            all_ddf_const += this_block[4];
         }
-
-    } // FOR thread
+    }
 
     // mark buffer as computed
     theta_computed = true;
@@ -3507,7 +3892,259 @@ void PhyloTree::computeLikelihoodDervMixlenGenericSIMD(PhyloNeighbor *dad_branch
     }
 }
 
+/*******************************************************
+ *
+ * derivatives of the log-likelihood by model quantities
+ *
+ ******************************************************/
+
+/**
+    add the derivatives by the transition matrices of one branch in eigen coordinates for one vector
+    of patterns, i.e. the weighted outer products A B^T per category, see PhyloTree::computeLikelihoodSensitivity()
+    @param ncat number of categories
+    @param lh_dad, lh_node partial likelihoods on both sides of the branch in eigen coordinates
+    @param dad_scale, node_scale scaling exponents of lh_dad and lh_node per category, NULL if
+        all categories of a pattern are scaled alike
+    @param exp_eval exp(eigenvalue * time) of the branch per category
+    @param cat_prop proportion of each category
+    @param ptn_freq, ptn_invar pattern frequencies and invariant-site likelihoods of the vector
+    @param[out] factor proportion times relative scaling factor per category
+    @param[out] lh_cat likelihood per category, without proportion
+    @param[out] cat_weight factor times pattern frequency divided by pattern likelihood
+    @param[in,out] grad ncat*nstates*nstates sums
+*/
+#ifdef KERNEL_FIX_STATES
+template <class VectorClass, const size_t nstates, const bool FMA>
+inline void addSensitivityOuterProduct(size_t ncat, VectorClass *lh_dad, VectorClass *lh_node, int *dad_scale,
+    int *node_scale, double *exp_eval, double *cat_prop, double *ptn_freq, double *ptn_invar,
+    VectorClass *factor, VectorClass *lh_cat, VectorClass *cat_weight, VectorClass *grad)
+#else
+template <class VectorClass, const bool FMA>
+inline void addSensitivityOuterProduct(size_t ncat, VectorClass *lh_dad, VectorClass *lh_node, int *dad_scale,
+    int *node_scale, double *exp_eval, double *cat_prop, double *ptn_freq, double *ptn_invar,
+    VectorClass *factor, VectorClass *lh_cat, VectorClass *cat_weight, VectorClass *grad, size_t nstates)
+#endif
+{
+    const size_t V = VectorClass::size();
+    size_t c, i, j, x;
+    // categories scaled more often than the least scaled one count less
+    for (c = 0; c < ncat; c++)
+        factor[c] = cat_prop[c];
+    for (x = 0; x < V && dad_scale; x++) {
+        int min_exp = INT_MAX;
+        for (c = 0; c < ncat; c++)
+            min_exp = min(min_exp, dad_scale[c*V+x] + node_scale[c*V+x]);
+        for (c = 0; c < ncat; c++) {
+            int diff = min_exp - dad_scale[c*V+x] - node_scale[c*V+x];
+            if (diff)
+                factor[c].insert(x, cat_prop[c] * ldexp(1.0, diff));
+        }
+    }
+
+    VectorClass lh_ptn = 0.0;
+    for (c = 0; c < ncat; c++) {
+        VectorClass *this_dad = lh_dad + c*nstates, *this_node = lh_node + c*nstates;
+        double *this_exp = exp_eval + c*nstates;
+        VectorClass this_lh = 0.0;
+        for (i = 0; i < nstates; i++)
+            this_lh = mul_add(this_dad[i] * this_exp[i], this_node[i], this_lh);
+        lh_cat[c] = this_lh;
+        lh_ptn = mul_add(factor[c], this_lh, lh_ptn);
+    }
+    lh_ptn = abs(lh_ptn) + VectorClass().load_a(ptn_invar);
+    VectorClass inv_lh = select(lh_ptn > 0.0, VectorClass().load_a(ptn_freq) / lh_ptn, VectorClass(0.0));
+
+    for (c = 0; c < ncat; c++) {
+        cat_weight[c] = factor[c] * inv_lh;
+        VectorClass *this_node = lh_node + c*nstates;
+        for (i = 0; i < nstates; i++) {
+            VectorClass scaled_dad = cat_weight[c] * lh_dad[c*nstates+i];
+            for (j = 0; j < nstates; j++, grad++)
+                *grad = mul_add(scaled_dad, this_node[j], *grad);
+        }
+    }
+}
+
+#ifdef KERNEL_FIX_STATES
+template <class VectorClass, const int nstates, const bool FMA>
+void PhyloTree::computeSensitivityBlockSIMD(SensitivityBranchInfo &info, size_t ptn, double *buffer,
+    int *scale_buffer, double *grad, LikelihoodSensitivity &sens)
+#else
+template <class VectorClass, const bool FMA>
+void PhyloTree::computeSensitivityBlockGenericSIMD(SensitivityBranchInfo &info, size_t ptn, double *buffer,
+    int *scale_buffer, double *grad, LikelihoodSensitivity &sens)
+#endif
+{
+    const size_t V = VectorClass::size();
+#ifndef KERNEL_FIX_STATES
+    size_t nstates = aln->num_states;
+#endif
+    size_t ncat = site_rate->getNRate();
+    size_t block = ncat * nstates;
+    size_t nsquare = nstates * nstates;
+    size_t grad_size = (ncat*nsquare + nstates + ncat) * V;
+    size_t nsrc = info.nsrc;
+    size_t nptn = aln->size();
+    size_t c, i, s, t, x;
+    double *evec = model->getEigenvectors();
+    double *inv_evec = model->getInverseEigenvectors();
+
+    // A = partial likelihood of the rest of the tree at dad, B = subtree below node, the subtrees of
+    // the children, their messages to node, the product of messages, outside partial likelihoods of
+    // a leaf child and per-category values
+    double *lh_node = buffer + block*V;
+    VectorClass *msg = (VectorClass*)(buffer + (nsrc+1)*block*V);
+    VectorClass *prod = msg + nsrc*block;
+    VectorClass *leaf_lh = prod + block;
+    VectorClass *factor = leaf_lh + block;
+    VectorClass *lh_cat = factor + ncat;
+    VectorClass *cat_weight = lh_cat + ncat;
+    // scaling exponents of A and the children, of B, and of leaf_lh
+    int *node_scale = scale_buffer + nsrc*ncat*V;
+    int *leaf_scale = node_scale + ncat*V;
+
+    // without safe numerics all categories of a pattern are scaled alike, so that the scaling cancels
+    // out of the derivatives and the outside partial likelihoods only need to be kept from underflow
+    double *lh_dad;
+    if (info.outside_lh) {
+        lh_dad = info.outside_lh + ptn*block;
+        if (safe_numeric)
+            memcpy(scale_buffer, info.outside_scale + ptn*ncat, sizeof(int)*ncat*V);
+    } else {
+        lh_dad = loadPatternBlockLh(info.node_branch, info.dad, ptn, buffer);
+        if (safe_numeric)
+            memset(scale_buffer, 0, sizeof(int)*ncat*V);
+    }
+    lh_node = loadPatternBlockLh(info.dad_branch, info.node, ptn, lh_node);
+    if (safe_numeric)
+        loadPatternBlockScale(info.dad_branch, info.node, ptn, node_scale);
+
+#ifdef KERNEL_FIX_STATES
+    addSensitivityOuterProduct<VectorClass, nstates, FMA>(ncat, (VectorClass*)lh_dad, (VectorClass*)lh_node,
+        safe_numeric ? scale_buffer : NULL, node_scale, info.exp_eval, info.cat_prop, ptn_freq + ptn, ptn_invar + ptn,
+        factor, lh_cat, cat_weight, (VectorClass*)grad);
+#else
+    addSensitivityOuterProduct<VectorClass, FMA>(ncat, (VectorClass*)lh_dad, (VectorClass*)lh_node,
+        safe_numeric ? scale_buffer : NULL, node_scale, info.exp_eval, info.cat_prop, ptn_freq + ptn, ptn_invar + ptn,
+        factor, lh_cat, cat_weight, (VectorClass*)grad, nstates);
+#endif
+
+    if (info.root_branch) {
+        // the branch at the root also gives the derivatives by root frequencies, proportions and ptn_invar
+        double *grad_freq = grad + ncat*nsquare*V;
+        double *grad_prop = grad_freq + nstates*V;
+        for (x = 0; x < V && ptn+x < nptn; x++) {
+            for (c = 0; c < ncat; c++) {
+                double weight = cat_weight[c][x];
+                if (weight == 0.0)
+                    continue;
+                sens.invar[ptn+x] = weight / factor[c][x];
+                grad_prop[c*V+x] += weight / info.cat_prop[c] * lh_cat[c][x];
+                // back to states: a = V A, P b = V exp(lambda t) B
+                for (i = 0; i < nstates; i++) {
+                    double *evec_row = evec + i*nstates;
+                    double a = 0.0, pb = 0.0;
+                    for (size_t j = 0; j < nstates; j++) {
+                        a += evec_row[j] * lh_dad[(c*nstates+j)*V+x];
+                        pb += evec_row[j] * info.exp_eval[c*nstates+j] * lh_node[(c*nstates+j)*V+x];
+                    }
+                    grad_freq[i*V+x] += weight * a * pb;
+                }
+            }
+        }
+    }
+
+    if (nsrc == 1)
+        return;
+
+    // message of each neighbor in states: V exp(lambda t) L
+    for (s = 0; s < nsrc; s++) {
+        double *lh;
+        if (s == 0) {
+            lh = lh_dad;
+        } else {
+            PhyloNeighbor *child = info.children[s-1];
+            lh = loadPatternBlockLh(child, (PhyloNode*)child->node, ptn, buffer + (s+1)*block*V);
+            if (safe_numeric)
+                loadPatternBlockScale(child, (PhyloNode*)child->node, ptn, scale_buffer + s*ncat*V);
+        }
+        for (c = 0; c < ncat; c++) {
+#ifdef KERNEL_FIX_STATES
+            productVecMat<VectorClass, double, nstates, FMA>((VectorClass*)lh + c*nstates,
+                info.echildren + (s*ncat+c)*nsquare, msg + s*block + c*nstates);
+#else
+            productVecMat<VectorClass, double, FMA>((VectorClass*)lh + c*nstates,
+                info.echildren + (s*ncat+c)*nsquare, msg + s*block + c*nstates, nstates);
+#endif
+        }
+    }
+
+    VectorClass invar = VectorClass().load_a(ptn_invar + ptn);
+    for (t = 1; t < nsrc; t++) {
+        // the branch to a leaf child ends here, its derivatives are added right away
+        bool leaf_child = info.children[t-1]->node->isLeaf();
+        VectorClass *out = leaf_child ? leaf_lh : (VectorClass*)(info.child_lh[t-1] + ptn*block);
+        int *scale = leaf_child ? leaf_scale : info.child_scale[t-1] + ptn*ncat;
+
+        // product of the messages of all other neighbors
+        for (i = 0; i < block; i++) {
+            VectorClass this_prod = (t == 1) ? msg[i] : msg[i] * msg[block+i];
+            for (s = 2; s < nsrc; s++)
+                if (s != t)
+                    this_prod *= msg[s*block+i];
+            prod[i] = this_prod;
+        }
+        for (i = 0; i < ncat*V && safe_numeric; i++) {
+            scale[i] = 0;
+            for (s = 0; s < nsrc; s++)
+                if (s != t)
+                    scale[i] += scale_buffer[s*ncat*V+i];
+        }
+
+        // rescale like the likelihood kernels, per category with safe numerics
+        size_t nscale = safe_numeric ? ncat : 1;
+        size_t scale_block = block / nscale;
+        for (c = 0; c < nscale; c++) {
+            VectorClass *this_prod = prod + c*scale_block;
+            VectorClass lh_max = 0.0;
+            for (i = 0; i < scale_block; i++)
+                lh_max = max(lh_max, abs(this_prod[i]));
+            auto underflown = (lh_max < SCALING_THRESHOLD) & (invar == 0.0);
+            if (!horizontal_or(underflown))
+                continue;
+            for (x = 0; x < V; x++)
+            if (underflown[x]) {
+                double *prod_lane = (double*)this_prod + x;
+                for (i = 0; i < scale_block; i++)
+                    prod_lane[i*V] = ldexp(prod_lane[i*V], SCALING_THRESHOLD_EXP);
+                if (safe_numeric)
+                    scale[c*V+x] += SCALING_THRESHOLD_EXP;
+            }
+        }
 
+        // back to eigen coordinates
+        for (c = 0; c < ncat; c++) {
+#ifdef KERNEL_FIX_STATES
+            productVecMat<VectorClass, double, nstates, FMA>(prod + c*nstates, inv_evec, out + c*nstates);
+#else
+            productVecMat<VectorClass, double, FMA>(prod + c*nstates, inv_evec, out + c*nstates, nstates);
+#endif
+        }
 
+        if (!leaf_child)
+            continue;
+        VectorClass *lh_leaf = (VectorClass*)(buffer + (t+1)*block*V);
+        VectorClass *leaf_grad = (VectorClass*)(grad + t*grad_size);
+#ifdef KERNEL_FIX_STATES
+        addSensitivityOuterProduct<VectorClass, nstates, FMA>(ncat, leaf_lh, lh_leaf,
+            safe_numeric ? leaf_scale : NULL, scale_buffer + t*ncat*V, info.child_exp_eval + (t-1)*block,
+            info.cat_prop, ptn_freq + ptn, ptn_invar + ptn, factor, lh_cat, cat_weight, leaf_grad);
+#else
+        addSensitivityOuterProduct<VectorClass, FMA>(ncat, leaf_lh, lh_leaf,
+            safe_numeric ? leaf_scale : NULL, scale_buffer + t*ncat*V, info.child_exp_eval + (t-1)*block,
+            info.cat_prop, ptn_freq + ptn, ptn_invar + ptn, factor, lh_cat, cat_weight, leaf_grad, nstates);
+#endif
+    }
+}
 
 #endif //PHYLOKERNELNEW_H_
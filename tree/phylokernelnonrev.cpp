@@ -13,6 +13,8 @@
 #include "vectorclass/vectorf64.h"
 
 
+// no OpenMP inside: the kernels call this in parallel for disjoint pattern ranges,
+// see computeTraversalPartialLikelihood()
 void PhyloTree::computeNonrevPartialLikelihood(TraversalInfo &info, size_t ptn_lower, size_t ptn_upper, int thread_id) {
 
     PhyloNeighbor *dad_branch = info.dad_branch;
@@ -105,9 +107,6 @@ void PhyloTree::computeNonrevPartialLikelihood(TraversalInfo &info, size_t ptn_l
         /*--------------------- multifurcating node ------------------*/
     
         // now for-loop computing partial_lh over all site-patterns
-//#ifdef _OPENMP
-//#pragma omp parallel for reduction(+: sum_scale) private(ptn, c, x, i) schedule(static)
-//#endif
         for (ptn = ptn_lower; ptn < ptn_upper; ptn++) {
             double *partial_lh_all = dad_branch->partial_lh + ptn*block;
             for (i = 0; i < block; i++)
@@ -213,9 +212,6 @@ void PhyloTree::computeNonrevPartialLikelihood(TraversalInfo &info, size_t ptn_l
     
 		// scale number must be ZERO
 	    memset(dad_branch->scale_num + ptn_lower, 0, (ptn_upper-ptn_lower) * sizeof(UBYTE));
-//#ifdef _OPENMP
-//#pragma omp parallel for private(ptn, i) schedule(static)
-//#endif
 		for (ptn = ptn_lower; ptn < ptn_upper; ptn++) {
 			double *partial_lh = dad_branch->partial_lh + ptn*block;
 			int state_left;
@@ -239,9 +235,6 @@ void PhyloTree::computeNonrevPartialLikelihood(TraversalInfo &info, size_t ptn_l
 
         double *partial_lh_left = partial_lh_leaves;
 
-//#ifdef _OPENMP
-//#pragma omp parallel for reduction(+: sum_scale) private(ptn, c, x, i) schedule(static)
-//#endif
 		for (ptn = ptn_lower; ptn < ptn_upper; ptn++) {
 			double *partial_lh = dad_branch->partial_lh + ptn*block;
 			double *partial_lh_right = right->partial_lh + ptn*block;
@@ -301,9 +294,6 @@ void PhyloTree::computeNonrevPartialLikelihood(TraversalInfo &info, size_t ptn_l
 
         /*--------------------- INTERNAL-INTERNAL NODE case ------------------*/
 
-//#ifdef _OPENMP
-//#pragma omp parallel for reduction(+: sum_scale) private(ptn, c, x, i) schedule(static)
-//#endif
 		for (ptn = ptn_lower; ptn < ptn_upper; ptn++) {
 			double *partial_lh = dad_branch->partial_lh + ptn*block;
 			double *partial_lh_left = left->partial_lh + ptn*block;
@@ -400,30 +390,38 @@ void PhyloTree::computeNonrevLikelihoodDerv(PhyloNeighbor *dad_branch, PhyloNode
     size_t orig_nptn = aln->size();
     size_t nptn = aln->size()+model_factory->unobserved_ptns.size();
 
-    double *trans_mat = new double[block*nstates*3];
+    // the second half holds the matrices and derivatives per category if they are not cached
+    double *trans_mat = new double[block*nstates*6];
     double *trans_derv1 = trans_mat + block*nstates;
     double *trans_derv2 = trans_derv1 + block*nstates;
     
+    double cat_len[ncat];
+    vector<TransMatrixPtr> cached_dervs(ncat);
+    for (c = 0; c < ncat; c++)
+        cat_len[c] = site_rate->getRate(c)*dad_branch->length;
+    model_factory->getTransDervs(ncat, cat_len, cached_dervs.data(), 0, trans_derv2 + block*nstates);
+
 	for (c = 0; c < ncat; c++) {
-		double len = site_rate->getRate(c)*dad_branch->length;
 		double prop = site_rate->getProp(c);
         double *this_trans_mat = &trans_mat[c*nstatesqr];
         double *this_trans_derv1 = &trans_derv1[c*nstatesqr];
         double *this_trans_derv2 = &trans_derv2[c*nstatesqr];
-        model->computeTransDerv(len, this_trans_mat, this_trans_derv1, this_trans_derv2);
-        double prop_rate = prop*site_rate->getRate(c);
-        double prop_rate_2 = prop_rate * site_rate->getRate(c); 
+        const double *derv = cached_dervs[c].get();
+        double prop_rate = prop * site_rate->getRate(c);
+        double prop_rate_2 = prop_rate * site_rate->getRate(c);
 		for (i = 0; i < nstatesqr; i++) {
-			this_trans_mat[i] *= prop;
-            this_trans_derv1[i] *= prop_rate;
-            this_trans_derv2[i] *= prop_rate_2;
+			this_trans_mat[i] = derv[i] * prop;
+            this_trans_derv1[i] = derv[nstatesqr+i] * prop_rate;
+            this_trans_derv2[i] = derv[nstatesqr*2+i] * prop_rate_2;
         }
 	}
 
-    double my_df = 0.0, my_ddf = 0.0, prob_const = 0.0, df_const = 0.0, ddf_const = 0.0;
+    double all_df = 0.0, all_ddf = 0.0, prob_const = 0.0, df_const = 0.0, ddf_const = 0.0;
 
-    vector<size_t> limits;
-    computeBounds<Vec1d>(num_threads, nptn, limits);
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, 1, params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
+    // per-block accumulators, reduced in block order for reproducible results
+    double *block_acc = getBufferBlockAcc(num_blocks*5);
 
     if (dad->isLeaf()) {
          // make sure that we do not estimate the virtual branch length from the root
@@ -465,14 +463,21 @@ void PhyloTree::computeNonrevLikelihoodDerv(PhyloNeighbor *dad_branch, PhyloNode
 
     	// now do the real computation
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+: my_df, my_ddf, prob_const, df_const, ddf_const) private(ptn, i, c) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
+#endif
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
+            double my_df = 0.0, my_ddf = 0.0, my_prob_const = 0.0, my_df_const = 0.0, my_ddf_const = 0.0;
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, 1, thread_id);
 
             for (ptn = ptn_lower; ptn < ptn_upper; ptn++) {
                 double lh_ptn = ptn_invar[ptn], df_ptn = 0.0, ddf_ptn = 0.0;
@@ -507,26 +512,40 @@ void PhyloTree::computeNonrevLikelihoodDerv(PhyloNeighbor *dad_branch, PhyloNode
                     if (dad_branch->scale_num[ptn] + node_branch->scale_num[ptn] >= 1)
                         lh_ptn *= SCALING_THRESHOLD;
     //				_pattern_lh[ptn] = lh_ptn;
-                    prob_const += lh_ptn;
-                    df_const += df_ptn;
-                    ddf_const += ddf_ptn;
+                    my_prob_const += lh_ptn;
+                    my_df_const += df_ptn;
+                    my_ddf_const += ddf_ptn;
                 }
             } // FOR ptn
-        } // FOR thread_id
+            double *this_block = block_acc + block_id*5;
+            this_block[0] = my_df;
+            this_block[1] = my_ddf;
+            this_block[2] = my_prob_const;
+            this_block[3] = my_df_const;
+            this_block[4] = my_ddf_const;
+        } // WHILE block
+        } // PARALLEL
 
 		delete [] partial_lh_node;
     } else {
 
     	// both dad and node are internal nodes
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+: my_df, my_ddf, prob_const, df_const, ddf_const) private(ptn, i, c, x) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c, x) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
+            double my_df = 0.0, my_ddf = 0.0, my_prob_const = 0.0, my_df_const = 0.0, my_ddf_const = 0.0;
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, 1, thread_id);
 
             for (ptn = ptn_lower; ptn < ptn_upper; ptn++) {
                 double lh_ptn = ptn_invar[ptn], df_ptn = 0.0, ddf_ptn = 0.0;
@@ -570,16 +589,33 @@ void PhyloTree::computeNonrevLikelihoodDerv(PhyloNeighbor *dad_branch, PhyloNode
                     if (dad_branch->scale_num[ptn] + node_branch->scale_num[ptn] >= 1)
                         lh_ptn *= SCALING_THRESHOLD;
     //				_pattern_lh[ptn] = lh_ptn;
-                    prob_const += lh_ptn;
-                    df_const += df_ptn;
-                    ddf_const += ddf_ptn;
+                    my_prob_const += lh_ptn;
+                    my_df_const += df_ptn;
+                    my_ddf_const += ddf_ptn;
                 }
             } // FOR ptn
-        } // FOR thread
+            double *this_block = block_acc + block_id*5;
+            this_block[0] = my_df;
+            this_block[1] = my_ddf;
+            this_block[2] = my_prob_const;
+            this_block[3] = my_df_const;
+            this_block[4] = my_ddf_const;
+        } // WHILE block
+        } // PARALLEL
+    }
+
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        double *this_block = block_acc + b*5;
+        all_df += this_block[0];
+        all_ddf += this_block[1];
+        prob_const += this_block[2];
+        df_const += this_block[3];
+        ddf_const += this_block[4];
     }
 
-	*df = my_df;
-	*ddf = my_ddf;
+	*df = all_df;
+	*ddf = all_ddf;
     ASSERT(!std::isnan(*df) && !std::isinf(*df));
 
 	if (orig_nptn < nptn) {
@@ -631,17 +667,25 @@ double PhyloTree::computeNonrevLikelihoodBranch(PhyloNeighbor *dad_branch, Phylo
     size_t orig_nptn = aln->size();
     size_t nptn = aln->size()+model_factory->unobserved_ptns.size();
 
-    vector<size_t> limits;
-    computeBounds<Vec1d>(num_threads, nptn, limits);
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, 1, params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
+    // per-block accumulators, reduced in block order for reproducible results
+    double *block_acc = getBufferBlockAcc(num_blocks*2);
 
     double *trans_mat = new double[block*nstates];
+    double cat_len[ncat];
+    vector<TransMatrixPtr> cached_mats(ncat);
+    for (c = 0; c < ncat; c++)
+        cat_len[c] = site_rate->getRate(c)*dad_branch->length;
+    // matrices not taken from the cache are computed right into trans_mat and scaled in place
+    model_factory->getTransMatrices(ncat, cat_len, cached_mats.data(), 0, trans_mat);
+
 	for (c = 0; c < ncat; c++) {
-		double len = site_rate->getRate(c)*dad_branch->length;
 		double prop = site_rate->getProp(c);
         double *this_trans_mat = &trans_mat[c*nstatesqr];
-        model->computeTransMatrix(len, this_trans_mat);
+        const double *mat = cached_mats[c].get();
 		for (i = 0; i < nstatesqr; i++)
-			this_trans_mat[i] *= prop;
+			this_trans_mat[i] = mat[i] * prop;
 	}
 
 	double prob_const = 0.0;
@@ -679,14 +723,21 @@ double PhyloTree::computeNonrevLikelihoodBranch(PhyloNeighbor *dad_branch, Phylo
 
     	// now do the real computation
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+: tree_lh, prob_const) private(ptn, i, c) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
+#endif
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
+            double my_tree_lh = 0.0, my_prob_const = 0.0;
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, 1, thread_id);
 
             // reset memory for _pattern_lh_cat
             memset(_pattern_lh_cat+ptn_lower*ncat, 0, (ptn_upper-ptn_lower)*ncat*sizeof(double));
@@ -714,29 +765,39 @@ double PhyloTree::computeNonrevLikelihoodBranch(PhyloNeighbor *dad_branch, Phylo
                 if (ptn < orig_nptn) {
                     lh_ptn = log(fabs(lh_ptn)) + dad_branch->scale_num[ptn] * LOG_SCALING_THRESHOLD;
                     _pattern_lh[ptn] = lh_ptn;
-                    tree_lh += lh_ptn * ptn_freq[ptn];
+                    my_tree_lh += lh_ptn * ptn_freq[ptn];
                 } else {
                     // bugfix 2016-01-21, prob_const can be rescaled
                     if (dad_branch->scale_num[ptn] >= 1)
                         lh_ptn *= SCALING_THRESHOLD;
     //				_pattern_lh[ptn] = lh_ptn;
-                    prob_const += lh_ptn;
+                    my_prob_const += lh_ptn;
                 }
             } // FOR ptn
-        } // FOR thread_id
+            block_acc[block_id*2] = my_tree_lh;
+            block_acc[block_id*2+1] = my_prob_const;
+        } // WHILE block
+        } // PARALLEL
 		delete [] partial_lh_node;
     } else {
 
     	// both dad and node are internal nodes
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+: tree_lh, prob_const) private(ptn, i, c, x) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c, x) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
+            double my_tree_lh = 0.0, my_prob_const = 0.0;
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, 1, thread_id);
 
             // reset memory for _pattern_lh_cat
             memset(_pattern_lh_cat+ptn_lower*ncat, 0, (ptn_upper-ptn_lower)*ncat*sizeof(double));
@@ -765,16 +826,25 @@ double PhyloTree::computeNonrevLikelihoodBranch(PhyloNeighbor *dad_branch, Phylo
                 if (ptn < orig_nptn) {
                     lh_ptn = log(fabs(lh_ptn)) + (dad_branch->scale_num[ptn] + node_branch->scale_num[ptn])*LOG_SCALING_THRESHOLD;
                     _pattern_lh[ptn] = lh_ptn;
-                    tree_lh += lh_ptn * ptn_freq[ptn];
+                    my_tree_lh += lh_ptn * ptn_freq[ptn];
                 } else {
                     // bugfix 2016-01-21, prob_const can be rescaled
                     if (dad_branch->scale_num[ptn] + node_branch->scale_num[ptn] >= 1)
                         lh_ptn *= SCALING_THRESHOLD;
     //				_pattern_lh[ptn] = lh_ptn;
-                    prob_const += lh_ptn;
+                    my_prob_const += lh_ptn;
                 }
             } // FOR ptn
-        } // FOR thread_id
+            block_acc[block_id*2] = my_tree_lh;
+            block_acc[block_id*2+1] = my_prob_const;
+        } // WHILE block
+        } // PARALLEL
+    }
+
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        tree_lh += block_acc[b*2];
+        prob_const += block_acc[b*2+1];
     }
 
     if (std::isnan(tree_lh) || std::isinf(tree_lh)) {
@@ -52,6 +52,10 @@ void PhyloTree::computeNonrevPartialLikelihoodGenericSIMD(TraversalInfo &info, s
 	}
     
     ASSERT(node->degree() >= 3);
+
+    // not compressed here, but keep the site repeat classes up to date for the reversible kernel
+    if (info.site_repeat)
+        computeSiteRepeats(info, ptn_lower, ptn_upper, thread_id);
     
     size_t ptn, c;
     size_t orig_nptn = aln->size();
@@ -596,22 +600,29 @@ void PhyloTree::computeNonrevLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch
     double *trans_derv2 = trans_derv1 + block*nstates;
     double *buffer_partial_lh_ptr = buffer_partial_lh + get_safe_upper_limit(3*block*nstates);
 
+    // matrices of all categories, one batch per mixture class
+    double cat_len[ncat_mix];
+    vector<TransMatrixPtr> cached_dervs(ncat_mix);
+    for (c = 0; c < ncat_mix; c++)
+        cat_len[c] = site_rate->getRate(c%ncat) * dad_branch->length;
+    for (c = 0; c < ncat_mix; c += denom)
+        model_factory->getTransDervs(denom, cat_len + c, cached_dervs.data() + c, c/denom);
+
 	for (c = 0; c < ncat_mix; c++) {
         size_t mycat = c%ncat;
         size_t m = c/denom;
         double cat_rate = site_rate->getRate(mycat);
-		double len = cat_rate * dad_branch->length;
 		double prop = site_rate->getProp(mycat) * model->getMixtureWeight(m);
         double *this_trans_mat = &trans_mat[c*nstatesqr];
         double *this_trans_derv1 = &trans_derv1[c*nstatesqr];
         double *this_trans_derv2 = &trans_derv2[c*nstatesqr];
-        model->computeTransDerv(len, this_trans_mat, this_trans_derv1, this_trans_derv2, m);
+        const double *derv = cached_dervs[c].get();
         double prop_rate = prop * cat_rate;
         double prop_rate_2 = prop_rate * cat_rate;
 		for (i = 0; i < nstatesqr; i++) {
-			this_trans_mat[i] *= prop;
-            this_trans_derv1[i] *= prop_rate;
-            this_trans_derv2[i] *= prop_rate_2;
+			this_trans_mat[i] = derv[i] * prop;
+            this_trans_derv1[i] = derv[nstatesqr+i] * prop_rate;
+            this_trans_derv2[i] = derv[nstatesqr*2+i] * prop_rate_2;
         }
         if (!rooted) {
             // for unrooted tree, multiply with state_freq
@@ -633,9 +644,10 @@ void PhyloTree::computeNonrevLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch
     VectorClass all_df(0.0), all_ddf(0.0);
     VectorClass all_prob_const(0.0), all_df_const(0.0), all_ddf_const(0.0);
 
-    vector<size_t> limits;
-    computeBounds<VectorClass>(num_threads, nptn, limits);
-//    double *buffer_partial_lh_ptr = buffer_partial_lh;
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
+    // per-block accumulators, reduced in block order for reproducible results
+    VectorClass *block_acc = (VectorClass*)getBufferBlockAcc(num_blocks*5*VectorClass::size());
 
     if (dad->isLeaf()) {
          // make sure that we do not estimate the virtual branch length from the root
@@ -696,15 +708,21 @@ void PhyloTree::computeNonrevLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch
 
     	// now do the real computation
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
             VectorClass my_df(0.0), my_ddf(0.0), vc_prob_const(0.0), vc_df_const(0.0), vc_ddf_const(0.0);
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
             double *vec_tip = buffer_partial_lh_ptr + block*3*VectorClass::size()*thread_id;
 
@@ -824,19 +842,14 @@ void PhyloTree::computeNonrevLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch
                     vc_ddf_const += ddf_ptn;
                 }
             } // FOR ptn
-        #ifdef _OPENMP
-        #pragma omp critical
-        #endif
-            {
-                all_df += my_df;
-                all_ddf += my_ddf;
-                if (isASC) {
-                    all_prob_const += vc_prob_const;
-                    all_df_const += vc_df_const;
-                    all_ddf_const += vc_ddf_const;
-                }
-            }
-        } // FOR thread_id
+            VectorClass *this_block = block_acc + block_id*5;
+            this_block[0] = my_df;
+            this_block[1] = my_ddf;
+            this_block[2] = vc_prob_const;
+            this_block[3] = vc_df_const;
+            this_block[4] = vc_ddf_const;
+        } // WHILE block
+        } // PARALLEL
 
 //		delete [] partial_lh_node;
     } else {
@@ -848,15 +861,21 @@ void PhyloTree::computeNonrevLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch
         
     	// both dad and node are internal nodes
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
             VectorClass my_df(0.0), my_ddf(0.0), vc_prob_const(0.0), vc_df_const(0.0), vc_ddf_const(0.0);
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
             for (ptn = ptn_lower; ptn < ptn_upper; ptn+=VectorClass::size()) {
                 VectorClass lh_ptn(0.0), df_ptn(0.0), ddf_ptn(0.0);
@@ -983,23 +1002,30 @@ void PhyloTree::computeNonrevLikelihoodDervGenericSIMD(PhyloNeighbor *dad_branch
                     vc_ddf_const += ddf_ptn;
                 }
             } // FOR ptn
-        #ifdef _OPENMP
-        #pragma omp critical
-        #endif
-            {
-                all_df += my_df;
-                all_ddf += my_ddf;
-                if (isASC) {
-                    all_prob_const += vc_prob_const;
-                    all_df_const += vc_df_const;
-                    all_ddf_const += vc_ddf_const;
-                }
-            }
-        } // FOR thread
+            VectorClass *this_block = block_acc + block_id*5;
+            this_block[0] = my_df;
+            this_block[1] = my_ddf;
+            this_block[2] = vc_prob_const;
+            this_block[3] = vc_df_const;
+            this_block[4] = vc_ddf_const;
+        } // WHILE block
+        } // PARALLEL
         if (buffer_lh)
             aligned_free(buffer_lh);
     }
 
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        VectorClass *this_block = block_acc + b*5;
+        all_df += this_block[0];
+        all_ddf += this_block[1];
+        if (isASC) {
+            all_prob_const += this_block[2];
+            all_df_const += this_block[3];
+            all_ddf_const += this_block[4];
+        }
+    }
+
 	*df = horizontal_add(all_df);
 	*ddf = horizontal_add(all_ddf);
     ASSERT(std::isfinite(*df) && "Numerical underflow for non-rev lh-derivative");
@@ -1065,21 +1091,31 @@ double PhyloTree::computeNonrevLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_br
     size_t nptn = max_orig_nptn+model_factory->unobserved_ptns.size();
     bool isASC = model_factory->unobserved_ptns.size() > 0;
 
-    vector<size_t> limits;
-    computeBounds<VectorClass>(num_threads, nptn, limits);
+    pattern_scheduler.init(getPatternLayoutThreads(), nptn, VectorClass::size(), params->kernel_schedule);
+    size_t num_blocks = pattern_scheduler.getNumBlocks();
+    // per-block accumulators, reduced in block order for reproducible results
+    VectorClass *block_acc = (VectorClass*)getBufferBlockAcc(num_blocks*2*VectorClass::size());
 
 //    double *trans_mat = new double[block*nstates];
     double *trans_mat = buffer_partial_lh;
     double *buffer_partial_lh_ptr = buffer_partial_lh + block*nstates;
+    // matrices of all categories, one batch per mixture class
+    double cat_len[ncat_mix];
+    vector<TransMatrixPtr> cached_mats(ncat_mix);
+    for (c = 0; c < ncat_mix; c++)
+        cat_len[c] = site_rate->getRate(c%ncat) * dad_branch->length;
+    // matrices not taken from the cache are computed right into trans_mat and scaled in place
+    for (c = 0; c < ncat_mix; c += denom)
+        model_factory->getTransMatrices(denom, cat_len + c, cached_mats.data() + c, c/denom, &trans_mat[c*nstatesqr]);
+
 	for (c = 0; c < ncat_mix; c++) {
         size_t mycat = c%ncat;
         size_t m = c/denom;
-		double len = site_rate->getRate(mycat) * dad_branch->length;
 		double prop = site_rate->getProp(mycat) * model->getMixtureWeight(m);
         double *this_trans_mat = &trans_mat[c*nstatesqr];
-        model->computeTransMatrix(len, this_trans_mat, m);
+        const double *mat = cached_mats[c].get();
 		for (i = 0; i < nstatesqr; i++)
-			this_trans_mat[i] *= prop;
+			this_trans_mat[i] = mat[i] * prop;
         if (!rooted) {
             // if unrooted tree, multiply with frequency
             double state_freq[nstates];
@@ -1132,15 +1168,21 @@ double PhyloTree::computeNonrevLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_br
 
     	// now do the real computation
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
             VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
             // reset memory for _pattern_lh_cat
             memset(_pattern_lh_cat+ptn_lower*ncat_mix, 0, sizeof(double)*(ptn_upper-ptn_lower)*ncat_mix);
@@ -1261,28 +1303,29 @@ double PhyloTree::computeNonrevLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_br
                     vc_prob_const += lh_ptn;
                 }
             } // FOR ptn
-            #ifdef _OPENMP
-            #pragma omp critical
-            #endif
-            {
-                all_tree_lh += vc_tree_lh;
-                if (isASC)
-                    all_prob_const += vc_prob_const;
-            }
-        } // FOR thread_id
+            block_acc[block_id*2] = vc_tree_lh;
+            block_acc[block_id*2+1] = vc_prob_const;
+        } // WHILE block
+        } // PARALLEL
     } else {
 
     	// both dad and node are internal nodes
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i, c) schedule(static,1) num_threads(num_threads)
+#pragma omp parallel private(ptn, i, c) num_threads(num_threads)
 #endif
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        {
+#ifdef _OPENMP
+        int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+        int thread_id = 0, team_size = 1;
+#endif
+        size_t block_id;
+        while (pattern_scheduler.next(thread_id, team_size, block_id)) {
             VectorClass vc_tree_lh(0.0), vc_prob_const(0.0);
-            size_t ptn_lower = limits[thread_id];
-            size_t ptn_upper = limits[thread_id+1];
+            size_t ptn_lower = pattern_scheduler.getLower(block_id);
+            size_t ptn_upper = pattern_scheduler.getUpper(block_id);
             // first compute partial_lh
-            for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++)
-                computePartialLikelihood(*it, ptn_lower, ptn_upper, thread_id);
+            computeTraversalPartialLikelihood(ptn_lower, ptn_upper, VectorClass::size(), thread_id);
 
             // reset memory for _pattern_lh_cat
             memset(_pattern_lh_cat+ptn_lower*ncat_mix, 0, (ptn_upper-ptn_lower)*ncat_mix*sizeof(double));
@@ -1389,15 +1432,17 @@ double PhyloTree::computeNonrevLikelihoodBranchGenericSIMD(PhyloNeighbor *dad_br
                     vc_prob_const += lh_ptn;
                 }
             } // FOR ptn
-            #ifdef _OPENMP
-            #pragma omp critical
-            #endif
-            {
-                all_tree_lh += vc_tree_lh;
-                if (isASC)
-                    all_prob_const += vc_prob_const;
-            }
-        } // FOR thread_id
+            block_acc[block_id*2] = vc_tree_lh;
+            block_acc[block_id*2+1] = vc_prob_const;
+        } // WHILE block
+        } // PARALLEL
+    }
+
+    // deterministic reduction over blocks
+    for (size_t b = 0; b < num_blocks; b++) {
+        all_tree_lh += block_acc[b*2];
+        if (isASC)
+            all_prob_const += block_acc[b*2+1];
     }
 
     tree_lh = horizontal_add(all_tree_lh);
@@ -54,7 +54,7 @@ void PhyloTree::computeSitemodelPartialLikelihoodEigen(PhyloNeighbor *dad_branch
         dad_branch->lh_scale_factor += nei->lh_scale_factor;
 	}
 
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (params->lh_mem_save != LM_MEM_SAVE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
@@ -52,6 +52,7 @@ public:
         partial_pars = NULL;
         direction = UNDEFINED_DIRECTION;
         size = 0;
+        lh_evicted = false;
     }
 
     /**
@@ -68,6 +69,7 @@ public:
         partial_pars = NULL;
         direction = UNDEFINED_DIRECTION;
         size = 0;
+        lh_evicted = false;
     }
 
     /**
@@ -82,6 +84,7 @@ public:
         partial_pars = NULL;
         direction = nei->direction;
         size = nei->size;
+        lh_evicted = false;
     }
 
     
@@ -182,6 +185,12 @@ private:
     /** size of subtree below this neighbor in terms of number of taxa */
     int size;
 
+    /**
+        TRUE if the partial likelihoods were evicted from a memory slot (-mem option)
+        since they were last computed, see MemSlotVector::recomputing()
+    */
+    bool lh_evicted;
+
 };
 
 /**
@@ -10,6 +10,7 @@
 #include "model/partitionmodelplen.h"
 #include <string.h>
 #include "utils/timeutil.h"
+#include "utils/mmaparena.h"
 
 
 
@@ -1632,6 +1633,8 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
 	for (partid = 0; partid < ntrees; partid++) {
 		part = part_order[partid];
         it = begin() + part;
+        // partition trees share the scale_num layout below, which has no room for site repeat classes
+        (*it)->site_repeat = false;
         // extra #numStates for ascertainment bias correction
 		mem_size[part] = get_safe_upper_limit((*it)->getAlnNPattern()) + get_safe_upper_limit((*it)->aln->num_states);
         size_t mem_cat_size = mem_size[part] * (*it)->getRate()->getNRate() *
@@ -1660,7 +1663,7 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
     if (!buffer_scale_all)
         buffer_scale_all = aligned_alloc<double>(total_mem_size);
     if (!buffer_partial_lh)
-        buffer_partial_lh = aligned_alloc<double>(total_buffer_size);
+        buffer_partial_lh = arena_alloc<double>(total_buffer_size);
     at(part_order[0])->theta_all = theta_all;
     at(part_order[0])->buffer_scale_all = buffer_scale_all;
     at(part_order[0])->buffer_partial_lh = buffer_partial_lh;
@@ -1680,12 +1683,12 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
 //    size_t IT_NUM = (params->nni5) ? 6 : 2;
     size_t IT_NUM = 2;
     if (!nni_partial_lh) {
-        nni_partial_lh = aligned_alloc<double>(IT_NUM*total_block_size);
+        nni_partial_lh = arena_alloc<double>(IT_NUM*total_block_size);
     }
     at(part_order[0])->nni_partial_lh = nni_partial_lh;
     
     if (!nni_scale_num) {
-        nni_scale_num = aligned_alloc<UBYTE>(IT_NUM*total_scale_block_size);
+        nni_scale_num = arena_alloc<UBYTE>(IT_NUM*total_scale_block_size);
     }
     at(part_order[0])->nni_scale_num = nni_scale_num;
 
@@ -1721,8 +1724,15 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
 	// allocate central memory for all partitions
 	if (!central_partial_lh) {
         try {
-        	central_partial_lh = aligned_alloc<double>(total_partial_lh_entries);
-        	central_scale_num = aligned_alloc<UBYTE>(total_scale_num_entries);
+            if (params->lh_mem_save == LM_MMAP) {
+                cout << "Memory-mapping " << (total_partial_lh_entries * sizeof(double)) / 1048576
+                     << " MB of partial likelihood vectors in " << params->mmap_dir << endl;
+                central_partial_lh = mmap_alloc<double>(total_partial_lh_entries, params->mmap_dir.c_str());
+                central_scale_num = mmap_alloc<UBYTE>(total_scale_num_entries, params->mmap_dir.c_str());
+            } else {
+                central_partial_lh = arena_alloc<double>(total_partial_lh_entries);
+                central_scale_num = arena_alloc<UBYTE>(total_scale_num_entries);
+            }
         } catch (std::bad_alloc &ba) {
         	outError("Not enough memory for partial likelihood vectors (bad_alloc)");
         }
@@ -1802,7 +1812,7 @@ void PhyloSuperTreePlen::initializeAllPartialLh(double* &lh_addr, UBYTE* &scale_
         	PhyloNeighbor *nei_part_back = nei_back->link_neighbors[part];
             
 
-            if (params->lh_mem_save == LM_PER_NODE) {
+            if (params->lh_mem_save != LM_MEM_SAVE) {
                 if (!nei_part_back->node->isLeaf()) {
                     if (!nei_part_back->partial_lh) {
                         nei_part_back->partial_lh = lh_addr;
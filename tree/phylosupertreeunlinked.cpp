@@ -293,8 +293,9 @@ void PhyloSuperTreeUnlinked::writeUFBootTrees(Params &params) {
     
     for (auto tree = begin(); tree != end(); tree++) {
         MTreeSet trees;
-
-        trees.init(((IQTree*)*tree)->boot_trees, (*tree)->rooted);
+        StrVector boot_trees;
+        ((IQTree*)*tree)->getBootTrees(boot_trees);
+        trees.init(boot_trees, (*tree)->rooted);
         for (i = 0; i < trees.size(); i++) {
             NodeVector taxa;
             // change the taxa name from ID to real name
@@ -33,6 +33,8 @@
 #include "upperbounds.h"
 #include "utils/MPIHelper.h"
 #include "utils/hammingdistance.h"
+#include "utils/profiler.h"
+#include "utils/mmaparena.h"
 #include "model/modelmixture.h"
 #include "phylonodemixlen.h"
 #include "phylotreemixlen.h"
@@ -78,6 +80,9 @@ void PhyloTree::init() {
     model = NULL;
     site_rate = NULL;
     optimize_by_newton = true;
+    float_lh = false;
+    force_double_lh = false;
+    site_repeat = false;
     central_partial_lh = NULL;
     nni_partial_lh = NULL;
     tip_partial_lh = NULL;
@@ -98,6 +103,8 @@ void PhyloTree::init() {
     theta_all = NULL;
     buffer_scale_all = NULL;
     buffer_partial_lh = NULL;
+    buffer_block_acc = NULL;
+    buffer_block_acc_size = 0;
     ptn_freq = NULL;
     ptn_freq_pars = NULL;
     ptn_invar = NULL;
@@ -108,6 +115,7 @@ void PhyloTree::init() {
     setLikelihoodKernel(LK_SSE2);  // FOR TUNG: you forgot to initialize this variable!
     setNumThreads(1);
     num_threads = 0;
+    pattern_layout_threads = 0;
     max_lh_slots = 0;
     save_all_trees = 0;
     nodeBranchDists = NULL;
@@ -130,6 +138,7 @@ void PhyloTree::init() {
     is_opt_scaling = false;
     num_partial_lh_computations = 0;
     vector_size = 0;
+    computeSensitivityBlockPointer = NULL;
     safe_numeric = false;
     summary = nullptr;
 }
@@ -204,16 +213,16 @@ void myPartitionsDestroy(partitionList *pl) {
 PhyloTree::~PhyloTree() {
     doneComputingDistances();
     if (nni_scale_num)
-        aligned_free(nni_scale_num);
+        arena_free(nni_scale_num);
     nni_scale_num = NULL;
     if (nni_partial_lh)
-        aligned_free(nni_partial_lh);
+        arena_free(nni_partial_lh);
     nni_partial_lh = NULL;
     if (central_partial_lh)
-        aligned_free(central_partial_lh);
+        arena_free(central_partial_lh);
     central_partial_lh = NULL;
     if (central_scale_num)
-        aligned_free(central_scale_num);
+        arena_free(central_scale_num);
     central_scale_num = NULL;
 
     if (central_partial_pars)
@@ -249,8 +258,12 @@ PhyloTree::~PhyloTree() {
         aligned_free(buffer_scale_all);
     buffer_scale_all = NULL;
     if (buffer_partial_lh)
-        aligned_free(buffer_partial_lh);
+        arena_free(buffer_partial_lh);
     buffer_partial_lh = NULL;
+    if (buffer_block_acc)
+        aligned_free(buffer_block_acc);
+    buffer_block_acc = NULL;
+    buffer_block_acc_size = 0;
     if (ptn_freq)
         aligned_free(ptn_freq);
     ptn_freq = NULL;
@@ -373,6 +386,48 @@ void PhyloTree::copyPhyloTreeMixlen(PhyloTree *tree, int mix) {
     }
 }
 
+/** collect the dad of every node of the subtree, indexed by node ID */
+static void getNodeDads(Node *node, Node *dad, NodeVector &dads) {
+    dads[node->id] = dad;
+    FOR_NEIGHBOR_IT(node, dad, it)
+        getNodeDads((*it)->node, node, dads);
+}
+
+/**
+    map the subtree below node to the copy, see PhyloTree::mapCopiedNodes()
+    @param copy_leaf leaf of the copy per sequence ID
+    @param copy_dad dad of every node of the copy, rooted at the same leaf
+    @return node of the copy
+*/
+static Node *mapCopiedSubtree(Node *node, Node *dad, NodeVector &copy_leaf, NodeVector &copy_dad, NodeVector &node_map) {
+    Node *copy_node = node->isLeaf() ? copy_leaf[node->id] : NULL;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        Node *copy_child = mapCopiedSubtree((*it)->node, node, copy_leaf, copy_dad, node_map);
+        copy_node = copy_dad[copy_child->id];
+        copy_child->findNeighbor(copy_node)->length = (*it)->length;
+        copy_node->findNeighbor(copy_child)->length = (*it)->length;
+    }
+    node_map[node->id] = copy_node;
+    // same neighbor order as in this tree, so that the branches are visited in the same order
+    NeighborVec neighbors;
+    for (NeighborVec::iterator it = node->neighbors.begin(); it != node->neighbors.end(); it++)
+        neighbors.push_back(copy_node->findNeighbor(((*it)->node == dad) ? copy_dad[copy_node->id] : node_map[(*it)->node->id]));
+    copy_node->neighbors = neighbors;
+    return copy_node;
+}
+
+void PhyloTree::mapCopiedNodes(PhyloTree *tree, NodeVector &node_map) {
+    ASSERT(tree->nodeNum == nodeNum && root->isLeaf());
+    // leaves have the sequence IDs in both trees, internal node IDs may differ
+    NodeVector taxa, copy_leaf(nodeNum, NULL), copy_dad(nodeNum, NULL);
+    tree->getTaxa(taxa);
+    for (NodeVector::iterator it = taxa.begin(); it != taxa.end(); it++)
+        copy_leaf[(*it)->id] = *it;
+    getNodeDads(copy_leaf[root->id], NULL, copy_dad);
+    node_map.assign(nodeNum, NULL);
+    mapCopiedSubtree(root, NULL, copy_leaf, copy_dad, node_map);
+}
+
 void PhyloTree::setAlignment(Alignment *alignment) {
     aln = alignment;
     bool err = false;
@@ -855,11 +910,17 @@ size_t PhyloTree::getBufferPartialLhSize() {
 
     buffer_size += get_safe_upper_limit(block *(aln->STATE_UNKNOWN+1));
     buffer_size += (block*2+model->num_states)*VECTOR_SIZE*num_threads;
+    // per-thread buffers to convert float partial_lh or gather site repeats, see getBufferFloatLh()
+    if (float_lh || site_repeat)
+        buffer_size += block*3*VECTOR_SIZE*num_threads;
 
     // always more buffer for non-rev kernel, in case switching between kernels
     buffer_size += get_safe_upper_limit(block)*(aln->STATE_UNKNOWN+1)*2;
     buffer_size += block*2*VECTOR_SIZE*num_threads;
     buffer_size += get_safe_upper_limit(3*block*model->num_states);
+    // non-rev kernel keeps its per-thread buffers at the end (computeNonrevPartialLikelihood) on top of
+    // the ones skipped at the beginning (computeTraversalInfo), otherwise they overlap echildren for VECTOR_SIZE=8
+    buffer_size += block*3*VECTOR_SIZE*num_threads + get_safe_upper_limit(block)*(aln->STATE_UNKNOWN+2);
 
     if (isMixlen()) {
         size_t nmix = max(getMixlen(), getRate()->getNRate());
@@ -868,6 +929,26 @@ size_t PhyloTree::getBufferPartialLhSize() {
     return buffer_size;
 }
 
+double *PhyloTree::getBufferFloatLh(size_t vector_size, int thread_id) {
+    ASSERT(float_lh || site_repeat);
+    size_t ncat_mix = site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    size_t block = model->num_states * ncat_mix;
+    // same layout as the thread buffer at the end of buffer_partial_lh in computePartialLikelihood
+    size_t thread_buf_size = (5*block+model->num_states)*vector_size;
+    return buffer_partial_lh + getBufferPartialLhSize() - thread_buf_size*(num_threads-thread_id)
+        + (2*block+model->num_states)*vector_size;
+}
+
+double *PhyloTree::getBufferBlockAcc(size_t size) {
+    if (size > buffer_block_acc_size) {
+        if (buffer_block_acc)
+            aligned_free(buffer_block_acc);
+        buffer_block_acc = aligned_alloc<double>(size);
+        buffer_block_acc_size = size;
+    }
+    return buffer_block_acc;
+}
+
 void PhyloTree::initializeAllPartialLh() {
     int index, indexlh;
     int numStates = model->num_states;
@@ -888,7 +969,7 @@ void PhyloTree::initializeAllPartialLh() {
     if (!buffer_scale_all)
         buffer_scale_all = aligned_alloc<double>(mem_size);
     if (!buffer_partial_lh) {
-        buffer_partial_lh = aligned_alloc<double>(getBufferPartialLhSize());
+        buffer_partial_lh = arena_alloc<double>(getBufferPartialLhSize());
     }
     if (!ptn_freq) {
         ptn_freq = aligned_alloc<double>(mem_size);
@@ -903,7 +984,7 @@ void PhyloTree::initializeAllPartialLh() {
         mem_slots.init(this, max_lh_slots);
         
     ASSERT(index == (nodeNum - 1) * 2);
-    if (params->lh_mem_save == LM_PER_NODE) {
+    if (params->lh_mem_save != LM_MEM_SAVE) {
         ASSERT(indexlh == nodeNum-leafNum);
     }
 
@@ -913,20 +994,18 @@ void PhyloTree::initializeAllPartialLh() {
 
 void PhyloTree::deleteAllPartialLh() {
 
-    if (central_partial_lh) {
-        aligned_free(central_partial_lh);
-    }
-    if (central_scale_num) {
-        aligned_free(central_scale_num);
-    }
+    if (central_partial_lh)
+        arena_free(central_partial_lh);
+    if (central_scale_num)
+        arena_free(central_scale_num);
     if (central_partial_pars)
         aligned_free(central_partial_pars);
 
     if (nni_scale_num)
-        aligned_free(nni_scale_num);
+        arena_free(nni_scale_num);
     nni_scale_num = NULL;
     if (nni_partial_lh)
-        aligned_free(nni_partial_lh);
+        arena_free(nni_partial_lh);
     nni_partial_lh = NULL;
 
     if (ptn_invar)
@@ -940,7 +1019,9 @@ void PhyloTree::deleteAllPartialLh() {
     if (buffer_scale_all)
         aligned_free(buffer_scale_all);
     if (buffer_partial_lh)
-        aligned_free(buffer_partial_lh);
+        arena_free(buffer_partial_lh);
+    if (buffer_block_acc)
+        aligned_free(buffer_block_acc);
     if (_pattern_lh_cat)
         aligned_free(_pattern_lh_cat);
     if (_pattern_lh)
@@ -956,6 +1037,8 @@ void PhyloTree::deleteAllPartialLh() {
     theta_all = NULL;
     buffer_scale_all = NULL;
     buffer_partial_lh = NULL;
+    buffer_block_acc = NULL;
+    buffer_block_acc_size = 0;
     _pattern_lh_cat = NULL;
     _pattern_lh = NULL;
 
@@ -964,7 +1047,42 @@ void PhyloTree::deleteAllPartialLh() {
 
     clearAllPartialLH();
 }
- 
+
+void PhyloTree::firstTouchPartialLh(double *partial_lh, UBYTE *scale_num, size_t num_vectors,
+    size_t block_size, size_t scale_block_size)
+{
+    // patterns as allocated in initializeAllPartialLh(), block_size may be halved for float_lh
+    size_t alloc_nptn = get_safe_upper_limit(aln->size()) + max(get_safe_upper_limit(aln->num_states),
+        get_safe_upper_limit(model_factory->unobserved_ptns.size()));
+    size_t lh_ptn_bytes = block_size * sizeof(double) / alloc_nptn;
+    // scale_num is indexed in UBYTE entries, memset() takes bytes
+    size_t scale_ptn_entries = scale_block_size / alloc_nptn;
+
+    // the same pattern ranges per thread as the kernels get with KS_STATIC, see computePartialLikelihood()
+    size_t vsize = max(vector_size, (size_t)1);
+    size_t orig_nptn = ((aln->size()+vsize-1)/vsize)*vsize;
+    size_t nptn = ((orig_nptn+model_factory->unobserved_ptns.size()+vsize-1)/vsize)*vsize;
+    PatternScheduler scheduler;
+    scheduler.init(num_threads, nptn, vsize, KS_STATIC);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+#endif
+    for (int thread_id = 0; thread_id < num_threads; thread_id++) {
+        size_t ptn_lower = min(scheduler.getLower(thread_id), alloc_nptn);
+        size_t ptn_upper = min(scheduler.getUpper(thread_id), alloc_nptn);
+        // the last thread also takes the padding and the site repeat classes behind scale_num
+        size_t lh_upper = (thread_id == num_threads-1) ? block_size*sizeof(double) : ptn_upper*lh_ptn_bytes;
+        size_t scale_upper = (thread_id == num_threads-1) ? scale_block_size : ptn_upper*scale_ptn_entries;
+        for (size_t i = 0; i < num_vectors; i++) {
+            memset((char*)(partial_lh + i*block_size) + ptn_lower*lh_ptn_bytes, 0, lh_upper - ptn_lower*lh_ptn_bytes);
+            if (scale_num)
+                memset(scale_num + i*scale_block_size + ptn_lower*scale_ptn_entries, 0,
+                    (scale_upper - ptn_lower*scale_ptn_entries) * sizeof(UBYTE));
+        }
+    }
+}
+
 uint64_t PhyloTree::getMemoryRequired(size_t ncategory, bool full_mem) {
     // +num_states for ascertainment bias correction
     int64_t nptn = get_safe_upper_limit(aln->getNPattern()) + get_safe_upper_limit(aln->num_states);
@@ -989,13 +1107,17 @@ uint64_t PhyloTree::getMemoryRequired(size_t ncategory, bool full_mem) {
 
     // memory for UFBoot
     if (params->gbo_replicates)
-        mem_size += params->gbo_replicates*nptn*sizeof(BootValType);
+        mem_size += params->gbo_replicates*nptn*sizeof(BootCountType);
 
     // memory for model
     if (model)
         mem_size += model->getMemoryRequired();
 
-    int64_t lh_scale_size = block_size * sizeof(double) + scale_block_size * sizeof(UBYTE);
+    // float_lh is decided per tree by setLikelihoodKernel(), it may fall back to double
+    int64_t lh_scale_size = block_size * (float_lh ? sizeof(float) : sizeof(double)) + scale_block_size * sizeof(UBYTE);
+    // site repeat classes stored behind scale_num
+    if (isSiteRepeatWanted())
+        lh_scale_size += nptn * sizeof(UINT);
 
     max_lh_slots = leafNum-2;
 
@@ -1022,7 +1144,10 @@ uint64_t PhyloTree::getMemoryRequired(size_t ncategory, bool full_mem) {
     }
 
     // also count MEM for nni_partial_lh
-    mem_size += (max_lh_slots+2) * lh_scale_size;
+    if (params->lh_mem_save == LM_MMAP)
+        mem_size += 2 * lh_scale_size; // the rest is in memory-mapped files
+    else
+        mem_size += (max_lh_slots+2) * lh_scale_size;
 
 
     return mem_size;
@@ -1064,8 +1189,11 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
     // +num_states for ascertainment bias correction
     size_t nptn = get_safe_upper_limit(aln->size())+ max(get_safe_upper_limit(aln->num_states), get_safe_upper_limit(model_factory->unobserved_ptns.size()));
     uint64_t block_size;
-    uint64_t scale_block_size = nptn * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
-    block_size = scale_block_size * model->num_states;
+    uint64_t scale_block_size = getScaleNumSize();
+    block_size = nptn * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures()) * model->num_states;
+    // float partial_lh take half of the space
+    if (float_lh)
+        block_size /= 2;
 
     if (!node) {
         node = (PhyloNode*) root;
@@ -1074,11 +1202,14 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
         size_t IT_NUM = 2;
         if (!nni_partial_lh) {
             // allocate memory only once!
-            nni_partial_lh = aligned_alloc<double>(IT_NUM*block_size);
-            nni_scale_num = aligned_alloc<UBYTE>(IT_NUM*scale_block_size);
+            nni_partial_lh = arena_alloc<double>(IT_NUM*block_size);
+            nni_scale_num = arena_alloc<UBYTE>(IT_NUM*scale_block_size);
+            if (params->lh_huge_pages)
+                firstTouchPartialLh(nni_partial_lh, nni_scale_num, IT_NUM, block_size, scale_block_size);
         }
 
 
+        bool new_central_partial_lh = !central_partial_lh;
         if (!central_partial_lh) {
             uint64_t tip_partial_lh_size = get_safe_upper_limit(aln->num_states * (aln->STATE_UNKNOWN+1) * model->getNMixtures());
             if (model->isSiteSpecificModel())
@@ -1092,7 +1223,12 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
             if (verbose_mode >= VB_MAX)
                 cout << "Allocating " << mem_size * sizeof(double) << " bytes for partial likelihood vectors" << endl;
             try {
-                central_partial_lh = aligned_alloc<double>(mem_size);
+                if (params->lh_mem_save == LM_MMAP) {
+                    cout << "Memory-mapping " << (mem_size * sizeof(double)) / 1048576 << " MB of partial likelihood vectors in "
+                         << params->mmap_dir << endl;
+                    central_partial_lh = mmap_alloc<double>(mem_size, params->mmap_dir.c_str());
+                } else
+                    central_partial_lh = arena_alloc<double>(mem_size);
             } catch (std::bad_alloc &ba) {
                 outError("Not enough memory for partial likelihood vectors (bad_alloc)");
             }
@@ -1101,7 +1237,7 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
         }
 
         // now always assign tip_partial_lh
-        if (params->lh_mem_save == LM_PER_NODE) {
+        if (params->lh_mem_save != LM_MEM_SAVE) {
             tip_partial_lh = central_partial_lh + ((nodeNum - leafNum)*block_size);
         } else {
             tip_partial_lh = central_partial_lh + (max_lh_slots*block_size);
@@ -1113,7 +1249,10 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
             if (verbose_mode >= VB_MAX)
                 cout << "Allocating " << mem_size * sizeof(UBYTE) << " bytes for scale num vectors" << endl;
             try {
-                central_scale_num = aligned_alloc<UBYTE>(mem_size);
+                if (params->lh_mem_save == LM_MMAP)
+                    central_scale_num = mmap_alloc<UBYTE>(mem_size, params->mmap_dir.c_str());
+                else
+                    central_scale_num = arena_alloc<UBYTE>(mem_size);
             } catch (std::bad_alloc &ba) {
                 outError("Not enough memory for scale num vectors (bad_alloc)");
             }
@@ -1121,6 +1260,18 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
                 outError("Not enough memory for scale num vectors");
         }
 
+        if (new_central_partial_lh && params->lh_huge_pages && params->lh_mem_save != LM_MMAP) {
+            firstTouchPartialLh(central_partial_lh, central_scale_num, max_lh_slots, block_size, scale_block_size);
+            uint64_t requested, mapped, explicit_huge;
+            huge_alloc_usage(requested, mapped, explicit_huge);
+            int64_t saved_lh_slots = max_lh_slots;
+            uint64_t predicted = getMemoryRequired();
+            max_lh_slots = saved_lh_slots;
+            cout << "Huge-page memory: " << mapped / 1048576 << " MB allocated (" << explicit_huge / 1048576
+                 << " MB in reserved huge pages) for " << requested / 1048576 << " MB requested, "
+                 << predicted / 1048576 << " MB predicted in total" << endl;
+        }
+
         if (!central_partial_pars) {
             uint64_t tip_partial_pars_size = get_safe_upper_limit_float(aln->num_states * (aln->STATE_UNKNOWN+1));
             uint64_t mem_size = (leafNum - 1) * 4 * pars_block_size + tip_partial_pars_size;
@@ -1152,7 +1303,7 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
         ASSERT(index < nodeNum * 2 - 1);
         
         // now initialize partial_lh and scale_num
-        if (params->lh_mem_save == LM_PER_NODE) {
+        if (params->lh_mem_save != LM_MEM_SAVE) {
             if (!node->isLeaf()) { // only allocate memory to internal node
                 nei->partial_lh = NULL; // do not allocate memory for tip, use tip_partial_lh instead
                 nei->scale_num = NULL;
@@ -1200,6 +1351,9 @@ size_t PhyloTree::getPartialLhSize() {
     size_t block_size = get_safe_upper_limit(aln->size())+max(get_safe_upper_limit(aln->num_states),
         get_safe_upper_limit(model_factory->unobserved_ptns.size()));
     block_size *= model->num_states * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    // number of doubles occupied by float partial_lh
+    if (float_lh)
+        block_size /= 2;
     return block_size;
 }
 
@@ -1211,7 +1365,23 @@ size_t PhyloTree::getPartialLhBytes() {
 size_t PhyloTree::getScaleNumSize() {
     size_t block_size = get_safe_upper_limit(aln->size())+max(get_safe_upper_limit(aln->num_states),
         get_safe_upper_limit(model_factory->unobserved_ptns.size()));
-    return (block_size) * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    size_t scale_size = (block_size) * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    // site repeat classes follow the scale numbers, so that they move together with scale_num
+    if (site_repeat)
+        scale_size = ((scale_size+63)/64)*64 + block_size*sizeof(UINT);
+    return scale_size;
+}
+
+bool PhyloTree::isSiteRepeatWanted() {
+    return params && params->site_repeat > 0;
+}
+
+UINT *PhyloTree::getSiteRepeat(PhyloNeighbor *nei) {
+    ASSERT(site_repeat && nei->scale_num);
+    size_t scale_size = (get_safe_upper_limit(aln->size())+max(get_safe_upper_limit(aln->num_states),
+        get_safe_upper_limit(model_factory->unobserved_ptns.size()))) *
+        site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    return (UINT*)(nei->scale_num + ((scale_size+63)/64)*64);
 }
 
 size_t PhyloTree::getScaleNumBytes() {
@@ -1266,7 +1436,7 @@ double PhyloTree::computeLikelihood(double *pattern_lh) {
         int nptn = aln->getNPattern();
         //double check_score = 0.0;
         for (int i = 0; i < nptn; i++) {
-            pattern_lh[i] += max(current_it->scale_num[i], UBYTE(0)) * LOG_SCALING_THRESHOLD;
+            pattern_lh[i] += max(current_it->scale_num[i], UBYTE(0)) * getLogScalingThreshold();
             //check_score += (pattern_lh[i] * (aln->at(i).frequency));
         }
         /*       if (fabs(score - check_score) > 1e-6) {
@@ -1477,16 +1647,16 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
     if (sum_scaling < 0.0) {
         if (current_it->lh_scale_factor == 0.0) {
             for (i = 0; i < nptn; i++) {
-                ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+                ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
             }
         } else if (current_it_back->lh_scale_factor == 0.0){
             for (i = 0; i < nptn; i++) {
-                ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it->scale_num[i])) * LOG_SCALING_THRESHOLD;
+                ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it->scale_num[i])) * getLogScalingThreshold();
             }
         } else {
             for (i = 0; i < nptn; i++) {
                 ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it->scale_num[i]) +
-                    max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+                    max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
             }
         }
     } else {
@@ -1506,20 +1676,20 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
             }
         } else if (current_it->lh_scale_factor == 0.0) {
             for (i = 0; i < nptn; i++) {
-                double scale = (max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+                double scale = (max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
                 for (int j = 0; j < ncat; j++, offset++)
                     ptn_lh_cat[offset] = log(_pattern_lh_cat[offset]) + scale;
             }
         } else if (current_it_back->lh_scale_factor == 0.0) {
             for (i = 0; i < nptn; i++) {
-                double scale = (max(UBYTE(0), current_it->scale_num[i])) * LOG_SCALING_THRESHOLD;
+                double scale = (max(UBYTE(0), current_it->scale_num[i])) * getLogScalingThreshold();
                 for (int j = 0; j < ncat; j++, offset++)
                     ptn_lh_cat[offset] = log(_pattern_lh_cat[offset]) + scale;
             }
         } else {
             for (i = 0; i < nptn; i++) {
                 double scale = (max(UBYTE(0), current_it->scale_num[i]) +
-                        max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+                        max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
                 for (int j = 0; j < ncat; j++, offset++)
                     ptn_lh_cat[offset] = log(_pattern_lh_cat[offset]) + scale;
             }
@@ -1547,7 +1717,7 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
             // per-category scaling
             for (ptn = 0; ptn < nptn; ptn++) {
                 for (i = 0; i < ncat; i++) {
-                    out_lh_cat[i] = log(lh_cat[i]) + nei2_scale[i] * LOG_SCALING_THRESHOLD;
+                    out_lh_cat[i] = log(lh_cat[i]) + nei2_scale[i] * getLogScalingThreshold();
                 }
                 lh_cat += ncat;
                 out_lh_cat += ncat;
@@ -1556,7 +1726,7 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
         } else {
             // normal scaling
             for (ptn = 0; ptn < nptn; ptn++) {
-                double scale = nei2_scale[ptn] * LOG_SCALING_THRESHOLD;
+                double scale = nei2_scale[ptn] * getLogScalingThreshold();
                 for (i = 0; i < ncat; i++)
                     out_lh_cat[i] = log(lh_cat[i]) + scale;
                 lh_cat += ncat;
@@ -1573,7 +1743,7 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
             // per-category scaling
             for (ptn = 0; ptn < nptn; ptn++) {
                 for (i = 0; i < ncat; i++) {
-                    out_lh_cat[i] = log(lh_cat[i]) + (nei1_scale[i]+nei2_scale[i]) * LOG_SCALING_THRESHOLD;
+                    out_lh_cat[i] = log(lh_cat[i]) + (nei1_scale[i]+nei2_scale[i]) * getLogScalingThreshold();
                 }
                 lh_cat += ncat;
                 out_lh_cat += ncat;
@@ -1583,7 +1753,7 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
         } else {
             // normal scaling
             for (ptn = 0; ptn < nptn; ptn++) {
-                double scale = (nei1_scale[ptn] + nei2_scale[ptn]) * LOG_SCALING_THRESHOLD;
+                double scale = (nei1_scale[ptn] + nei2_scale[ptn]) * getLogScalingThreshold();
                 for (i = 0; i < ncat; i++)
                     out_lh_cat[i] = log(lh_cat[i]) + scale;
                 lh_cat += ncat;
@@ -2714,6 +2884,9 @@ void PhyloTree::computeBestTraversal(NodeVector &nodes, NodeVector &nodes2) {
 }
 
 double PhyloTree::optimizeAllBranches(int my_iterations, double tolerance, int maxNRStep) {
+    if (params && params->optimize_alg_brlen == "LBFGS" && !isMixlen())
+        return optimizeAllBranchesJoint(my_iterations, tolerance);
+
     if (verbose_mode >= VB_MAX)
         cout << "Optimizing branch lengths (max " << my_iterations << " loops)..." << endl;
     
@@ -2808,6 +2981,122 @@ double PhyloTree::optimizeAllBranches(int my_iterations, double tolerance, int m
     return tree_lh;
 }
 
+double PhyloTree::computeBranchLengthGradient(NodeVector &nodes, NodeVector &nodes2, double *df, double *ddf) {
+    double tree_lh = 0.0;
+    for (int j = 0; j < nodes.size(); j++) {
+        current_it = (PhyloNeighbor*)nodes[j]->findNeighbor(nodes2[j]);
+        current_it_back = (PhyloNeighbor*)nodes2[j]->findNeighbor(nodes[j]);
+        theta_computed = false;
+        computeLikelihoodDerv(current_it, (PhyloNode*)nodes[j], &df[j], &ddf[j]);
+        if (j == 0)
+            tree_lh = computeLikelihoodFromBuffer();
+    }
+    return tree_lh;
+}
+
+/**
+    negative log-likelihood as function of all branch lengths, for L-BFGS-B.
+    Each variable is a branch length times a scale, which is the square root of the curvature
+    at the start; this makes the problem well conditioned, as the curvature differs by
+    orders of magnitude between short and long branches
+*/
+class OptimizationAllBranches : public Optimization {
+
+public:
+
+    OptimizationAllBranches(PhyloTree *tree, NodeVector &nodes, NodeVector &nodes2, DoubleVector &scale)
+        : tree(tree), nodes(nodes), nodes2(nodes2), scale(scale), df(nodes.size()), ddf(nodes.size()) {}
+
+    virtual int getNDim() { return nodes.size(); }
+
+    /** set the branch lengths from the scaled variables x[1..ndim] */
+    void setBranchLengths(double x[]) {
+        for (int j = 0; j < nodes.size(); j++) {
+            double len = x[j+1] / scale[j];
+            nodes[j]->findNeighbor(nodes2[j])->length = len;
+            nodes2[j]->findNeighbor(nodes[j])->length = len;
+        }
+        tree->clearAllPartialLH();
+    }
+
+    virtual double targetFunk(double x[]) {
+        setBranchLengths(x);
+        return -tree->computeLikelihood();
+    }
+
+    virtual double derivativeFunk(double x[], double dfx[]) {
+        setBranchLengths(x);
+        double tree_lh = tree->computeBranchLengthGradient(nodes, nodes2, &df[0], &ddf[0]);
+        for (int j = 0; j < nodes.size(); j++)
+            dfx[j+1] = -df[j] / scale[j];
+        return -tree_lh;
+    }
+
+    PhyloTree *tree;
+    NodeVector &nodes, &nodes2;
+    DoubleVector &scale;
+    DoubleVector df, ddf;
+};
+
+double PhyloTree::optimizeAllBranchesJoint(int my_iterations, double tolerance) {
+    if (verbose_mode >= VB_MAX)
+        cout << "Optimizing all branch lengths jointly (max " << my_iterations << " restarts)..." << endl;
+
+    NodeVector all_nodes, all_nodes2, nodes, nodes2;
+    computeBestTraversal(all_nodes, all_nodes2);
+    for (int j = 0; j < all_nodes.size(); j++)
+        if (!rooted || (all_nodes[j] != root && all_nodes2[j] != root)) {
+            // the virtual branch to the root is not optimized
+            nodes.push_back(all_nodes[j]);
+            nodes2.push_back(all_nodes2[j]);
+        }
+    size_t nbranch = nodes.size();
+    DoubleVector lenvec, scale(nbranch), variables(nbranch), lower(nbranch), upper(nbranch);
+    OptimizationAllBranches opt(this, nodes, nodes2, scale);
+
+    clearAllPartialLH();
+    double tree_lh = computeLikelihood();
+    double orig_lh = tree_lh;
+    saveBranchLengths(lenvec);
+    if (verbose_mode >= VB_MAX)
+        cout << "Initial tree log-likelihood: " << tree_lh << endl;
+
+    for (int i = 0; i < my_iterations; i++) {
+        // rescale by the diagonal of the Hessian at the current point, then restart L-BFGS-B
+        computeBranchLengthGradient(nodes, nodes2, &opt.df[0], &opt.ddf[0]);
+        for (size_t j = 0; j < nbranch; j++) {
+            double len = nodes[j]->findNeighbor(nodes2[j])->length;
+            len = min(max(len, params->min_branch_length), params->max_branch_length);
+            scale[j] = sqrt(max(-opt.ddf[j], 1.0));
+            variables[j] = len * scale[j];
+            lower[j] = params->min_branch_length * scale[j];
+            upper[j] = params->max_branch_length * scale[j];
+        }
+        opt.L_BFGS_B(nbranch, &variables[0], &lower[0], &upper[0], sqrt(tolerance), 20);
+        opt.setBranchLengths(&variables[0]-1);
+        double new_tree_lh = computeLikelihood();
+
+        if (verbose_mode >= VB_MAX)
+            cout << "Likelihood after restart " << i + 1 << " : " << new_tree_lh << endl;
+
+        if (new_tree_lh < tree_lh) {
+            // L-BFGS-B stopped at a worse point, go back to the previous branch lengths
+            clearAllPartialLH();
+            restoreBranchLengths(lenvec);
+            tree_lh = computeLikelihood();
+            break;
+        }
+        bool converged = (new_tree_lh <= tree_lh + tolerance);
+        tree_lh = new_tree_lh;
+        saveBranchLengths(lenvec);
+        if (converged)
+            break;
+    }
+    ASSERT(tree_lh >= orig_lh - tolerance);
+    curScore = tree_lh;
+    return tree_lh;
+}
+
 void PhyloTree::moveRoot(Node *node1, Node *node2) {
     // unplug root from tree
     Node *root_dad = root->neighbors[0]->node;
@@ -4898,7 +5187,9 @@ void PhyloTree::computeNNIPatternLh(double cur_lh, double &lh2, double *pattern_
     params->nni5 = true; // always optimize 5 branches for accurate SH-aLRT
     nniMoves[0].node1 = nniMoves[1].node1 = NULL;
     nniMoves[0].node2 = nniMoves[1].node2 = NULL;
+    double start_time = Profiler::getInstance().startTime();
     getBestNNIForBran(node1, node2, nniMoves);
+    Profiler::getInstance().addSince(PROF_NNI_EVAL, 2, 2*getAlnNPattern(), start_time);
     params->nni5 = nni5;
     lh2 = nniMoves[0].newloglh;
     lh3 = nniMoves[1].newloglh;
@@ -5756,7 +6047,7 @@ void PhyloTree::reorientPartialLh(PhyloNeighbor* dad_branch, Node *dad) {
             break;
         }
     }
-    if (params->lh_mem_save == LM_PER_NODE)
+    if (params->lh_mem_save != LM_MEM_SAVE)
         ASSERT(dad_branch->partial_lh && "partial_lh is not re-oriented");
 }
 
@@ -5802,6 +6093,7 @@ bool PhyloTree::computeTraversalInfo(PhyloNeighbor *dad_branch, PhyloNode *dad,
     // prepare information for this branch
     TraversalInfo info(dad_branch, dad);
     info.echildren = info.partial_lh_leaves = NULL;
+    info.recompute = mem_slots.recomputing(dad_branch);
 
     // re-orient partial_lh
     reorientPartialLh(dad_branch, dad);
@@ -5856,6 +6148,9 @@ bool PhyloTree::computeTraversalInfo(PhyloNeighbor *dad_branch, PhyloNode *dad,
             }
     }
 
+    if (site_repeat)
+        info.site_repeat = getSiteRepeat(dad_branch);
+
     if (!model->isSiteSpecificModel() && !Params::getInstance().buffer_mem_save) {
         //------- normal model -----
         info.echildren = buffer;
@@ -5871,6 +6166,102 @@ bool PhyloTree::computeTraversalInfo(PhyloNeighbor *dad_branch, PhyloNode *dad,
     return mem_slots.lock(dad_branch);
 }
 
+size_t PhyloTree::computeSiteRepeats(TraversalInfo &info, size_t ptn_lower, size_t ptn_upper, int thread_id) {
+    // above this fraction of classes, compression does not pay off for the gathering in the kernel
+    const double MAX_CLASS_RATIO = 0.8;
+    // maximal number of classes visited per pattern, beyond that the pattern simply gets its own class
+    const size_t MAX_WALK = 8;
+    const UINT EMPTY = UINT_MAX;
+    UINT *ptn_repeat = info.site_repeat;
+    PhyloNode *node = (PhyloNode*)info.dad_branch->node;
+    size_t orig_nptn = aln->size();
+    size_t ptn, num_ptn = ptn_upper - ptn_lower;
+    size_t max_classes = (size_t)(MAX_CLASS_RATIO * num_ptn);
+
+    PhyloNeighbor *left = NULL, *right = NULL;
+    FOR_NEIGHBOR_IT(node, info.dad, it) {
+        if (!left) left = (PhyloNeighbor*)*it; else right = (PhyloNeighbor*)*it;
+    }
+
+    // site-specific models and multifurcating nodes are not compressed
+    bool all_unique = model->isSiteSpecificModel() || node->degree() != 3;
+    UINT *left_repeat = NULL, *right_repeat = NULL;
+    if (!all_unique) {
+        // the leaf is always the left child
+        if (!left->node->isLeaf() && right->node->isLeaf())
+            swap(left, right);
+        if (!left->node->isLeaf())
+            left_repeat = getSiteRepeat(left);
+        if (!right->node->isLeaf())
+            right_repeat = getSiteRepeat(right);
+    }
+
+    // patterns unique in a subtree remain unique in the whole subtree above
+    if (right_repeat) {
+        for (ptn = ptn_lower; ptn < ptn_upper && right_repeat[ptn] == ptn; ptn++);
+        all_unique = (ptn == ptn_upper);
+    }
+    if (left_repeat && !all_unique) {
+        for (ptn = ptn_lower; ptn < ptn_upper && left_repeat[ptn] == ptn; ptn++);
+        all_unique = (ptn == ptn_upper);
+    }
+
+    size_t num_classes = 0;
+    if (!all_unique) {
+        // classes are found by the class of the right child (or the states of two leaves),
+        // then by walking a short chain of classes with the same key, matching the left class
+        size_t num_states = aln->STATE_UNKNOWN+1;
+        size_t num_keys = right_repeat ? num_ptn : num_states*num_states;
+        vector<UINT> &buffer = site_repeat_buffer[thread_id];
+        buffer.resize(num_keys + 2*num_ptn);
+        UINT *first = &buffer[0], *next = first + num_keys, *left_class = next + num_ptn;
+        fill(first, first + num_keys, EMPTY);
+        int left_id = left->node->id, right_id = right->node->id;
+
+        for (ptn = ptn_lower; ptn < ptn_upper && num_classes <= max_classes; ptn++) {
+            ptn_repeat[ptn] = ptn;
+            // padding, unobserved and invariant patterns (different scaling) always form their own class
+            if (ptn >= orig_nptn || ptn_invar[ptn] != 0.0) {
+                num_classes++;
+                continue;
+            }
+            UINT lclass = left_repeat ? left_repeat[ptn] : aln->at(ptn)[left_id];
+            size_t key;
+            if (right_repeat) {
+                // the class of the child may start outside of the range if computed with other ranges
+                if (right_repeat[ptn] < ptn_lower) {
+                    num_classes++;
+                    continue;
+                }
+                key = right_repeat[ptn] - ptn_lower;
+            } else {
+                key = aln->at(ptn)[right_id]*num_states + lclass;
+            }
+            UINT *rep = &first[key];
+            for (size_t walk = 0; *rep != EMPTY && left_class[*rep-ptn_lower] != lclass && walk < MAX_WALK; walk++)
+                rep = &next[*rep-ptn_lower];
+            if (*rep != EMPTY && left_class[*rep-ptn_lower] == lclass) {
+                ptn_repeat[ptn] = *rep;
+                continue;
+            }
+            if (*rep == EMPTY) {
+                *rep = ptn;
+                next[ptn-ptn_lower] = EMPTY;
+                left_class[ptn-ptn_lower] = lclass;
+            }
+            num_classes++;
+        }
+        all_unique = (num_classes > max_classes);
+    }
+
+    if (all_unique) {
+        for (ptn = ptn_lower; ptn < ptn_upper; ptn++)
+            ptn_repeat[ptn] = ptn;
+        num_classes = num_ptn;
+    }
+    return num_classes;
+}
+
 void PhyloTree::writeSiteLh(ostream &out, SiteLoglType wsl, int partid) {
     // error checking
     if (!getModel()->isMixture()) {
@@ -12,6 +12,7 @@
 #include "model/modelmixture.h"
 #include "model/ratefree.h"
 #include "utils/MPIHelper.h"
+#include "utils/profiler.h"
 
 #ifdef USE_CPPOPTLIB
 #include "cppoptlib/solver/newtondescentsolver.h"
@@ -735,7 +736,9 @@ void PhyloTreeMixlen::computeFuncDerv(double value, double &df, double &ddf) {
     current_it->setLength(cur_mixture, value);
     current_it_back->setLength(cur_mixture, value);
 
+    double start_time = Profiler::getInstance().startTime();
     (this->*computeLikelihoodDervMixlenPointer)(current_it, (PhyloNode*) current_it_back->node, df, ddf);
+    Profiler::getInstance().addSince(PROF_DERV_LH, 1, aln->getNPattern(), start_time);
 
 	df = -df;
     ddf = -ddf;
@@ -911,7 +911,7 @@ void PhyloTree::create3TaxonTree(IntVector &taxon_order, int *rand_stream) {
     root = newNode(nseq);
     
     // create star tree
-    for (int leafNum = 0; leafNum < 3; ++leafNum) {
+    for (leafNum = 0; leafNum < 3; ++leafNum) {
         if (leafNum < 3 && verbose_mode >= VB_MAX)
             cout << "Add " << aln->getSeqName(taxon_order[leafNum]) << " to the tree" << endl;
         Node *new_taxon = newNode(taxon_order[leafNum], aln->getSeqName(taxon_order[leafNum]).c_str());
@@ -1152,6 +1152,9 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
 
     nodeNum = 2 * leafNum - 2;
     initializeTree();
+    // refine by parsimony SPR on request (--pars-spr), which would break the constraint tree
+    if (params && params->pars_spr && params->sprDist > 0 && constraintTree.empty() && leafNum >= 5)
+        best_pars_score = optimizeSPRParsimony(params->sprDist);
     // parsimony tree is always unrooted
     bool orig_rooted = rooted;
     rooted = false;
@@ -1200,6 +1203,147 @@ int PhyloTree::addTaxonMPFast(Node *added_taxon, Node* added_node, Node* node, N
 
 }
 
+/** clear the partial parsimony pointing towards node from at most radius branches away */
+static void clearReversePartialParsNear(PhyloNode *node, PhyloNode *dad, int radius) {
+    if (radius <= 0)
+        return;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        ((PhyloNeighbor*)(*it)->node->findNeighbor(node))->clearPartialLh();
+        clearReversePartialParsNear((PhyloNode*)(*it)->node, node, radius-1);
+    }
+}
+
+/** collect the branches at most radius branches away from node, in the direction away from dad */
+static void getSPRTargetBranches(Node *node, Node *dad, int radius, NodeVector &nodes1, NodeVector &nodes2) {
+    if (radius <= 0)
+        return;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        nodes1.push_back((*it)->node);
+        nodes2.push_back(node);
+        getSPRTargetBranches((*it)->node, node, radius-1, nodes1, nodes2);
+    }
+}
+
+int PhyloTree::doParsimonySPR(PhyloNode *node, PhyloNode *dad, int radius, int cur_score) {
+    if (dad->degree() != 3)
+        return cur_score;
+
+    // like insertNode2Branch(), but the partial parsimony of the subtree is kept
+    auto attachSubtree = [dad](PhyloNode *target_node, PhyloNode *target_dad) {
+        target_node->updateNeighbor(target_dad, dad, -1.0);
+        target_dad->updateNeighbor(target_node, dad, -1.0);
+        dad->updateNeighbor((Node*) 1, target_node, -1.0);
+        dad->updateNeighbor((Node*) 2, target_dad, -1.0);
+        // the vectors towards the branch ends are those of the branch itself
+        PhyloNeighbor *nei = (PhyloNeighbor*)dad->findNeighbor(target_node);
+        PhyloNeighbor *from = (PhyloNeighbor*)target_dad->findNeighbor(dad);
+        nei->partial_pars = from->partial_pars;
+        nei->partial_lh_computed = from->partial_lh_computed;
+        nei = (PhyloNeighbor*)dad->findNeighbor(target_dad);
+        from = (PhyloNeighbor*)target_node->findNeighbor(dad);
+        nei->partial_pars = from->partial_pars;
+        nei->partial_lh_computed = from->partial_lh_computed;
+        ((PhyloNeighbor*)dad->neighbors[0]->node->findNeighbor(dad))->clearPartialLh();
+    };
+    // undo attachSubtree(), the branch vectors were computed while attached
+    auto detachSubtree = [dad](PhyloNode *target_node, PhyloNode *target_dad) {
+        target_node->updateNeighbor(dad, target_dad, -1.0);
+        target_dad->updateNeighbor(dad, target_node, -1.0);
+        dad->updateNeighbor(target_node, (Node*) 1, -1.0);
+        dad->updateNeighbor(target_dad, (Node*) 2, -1.0);
+        ((PhyloNeighbor*)target_node->findNeighbor(target_dad))->partial_lh_computed |= 2;
+        ((PhyloNeighbor*)target_dad->findNeighbor(target_node))->partial_lh_computed |= 2;
+    };
+
+    // the subtree becomes the first neighbor of dad, as in the stepwise addition
+    NeighborVec::iterator it = dad->findNeighborIt(node);
+    std::swap(*it, dad->neighbors[0]);
+    PhyloNode *node1 = (PhyloNode*)dad->neighbors[1]->node;
+    PhyloNode *node2 = (PhyloNode*)dad->neighbors[2]->node;
+
+    // prune the subtree: node1 and node2 become neighbors, their vectors towards dad are free
+    PhyloNeighbor *nei1 = (PhyloNeighbor*)node1->findNeighbor(dad);
+    PhyloNeighbor *nei2 = (PhyloNeighbor*)node2->findNeighbor(dad);
+    UINT *free_pars1 = nei1->partial_pars, *free_pars2 = nei2->partial_pars;
+    nei1->partial_pars = ((PhyloNeighbor*)dad->neighbors[2])->partial_pars;
+    nei1->partial_lh_computed = ((PhyloNeighbor*)dad->neighbors[2])->partial_lh_computed;
+    nei2->partial_pars = ((PhyloNeighbor*)dad->neighbors[1])->partial_pars;
+    nei2->partial_lh_computed = ((PhyloNeighbor*)dad->neighbors[1])->partial_lh_computed;
+    node1->updateNeighbor(dad, node2, -1.0);
+    node2->updateNeighbor(dad, node1, -1.0);
+    dad->updateNeighbor(node1, (Node*) 1, -1.0);
+    dad->updateNeighbor(node2, (Node*) 2, -1.0);
+    // only the vectors towards the pruned branch within the radius are needed for the insertions
+    clearReversePartialParsNear(node1, node2, radius+1);
+    clearReversePartialParsNear(node2, node1, radius+1);
+
+    NodeVector nodes1, nodes2;
+    getSPRTargetBranches(node1, node2, radius, nodes1, nodes2);
+    getSPRTargetBranches(node2, node1, radius, nodes1, nodes2);
+
+    // score all insertions from the vectors of the pruned tree, one partial vector each
+    PhyloNode *best_node = node1, *best_dad = node2;
+    int best_score = cur_score;
+    PhyloNeighbor *dad_branch = (PhyloNeighbor*)node->findNeighbor(dad);
+    for (size_t i = 0; i < nodes1.size(); i++) {
+        attachSubtree((PhyloNode*)nodes1[i], (PhyloNode*)nodes2[i]);
+        int score = computeParsimonyBranch(dad_branch, node);
+        detachSubtree((PhyloNode*)nodes1[i], (PhyloNode*)nodes2[i]);
+        if (score < best_score) {
+            best_score = score;
+            best_node = (PhyloNode*)nodes1[i];
+            best_dad = (PhyloNode*)nodes2[i];
+        }
+    }
+
+    // regraft at the best branch, which may be the original one
+    attachSubtree(best_node, best_dad);
+    nei1 = (PhyloNeighbor*)best_node->findNeighbor(dad);
+    nei1->partial_pars = free_pars1;
+    nei1->clearPartialLh();
+    nei2 = (PhyloNeighbor*)best_dad->findNeighbor(dad);
+    nei2->partial_pars = free_pars2;
+    nei2->clearPartialLh();
+    if (best_node == node1) {
+        clearReversePartialParsNear(node1, dad, radius+1);
+        clearReversePartialParsNear(node2, dad, radius+1);
+        return cur_score;
+    }
+    // moved: every vector whose subtree contains the old or the new position is outdated
+    ((PhyloNeighbor*)node1->findNeighbor(node2))->clearPartialLh();
+    ((PhyloNeighbor*)node2->findNeighbor(node1))->clearPartialLh();
+    node1->clearReversePartialLh(node2);
+    node2->clearReversePartialLh(node1);
+    dad->clearReversePartialLh(node);
+    node->clearReversePartialLh(dad);
+    return best_score;
+}
+
+int PhyloTree::optimizeSPRParsimony(int radius) {
+    clearAllPartialLH();
+    int score = computeParsimony();
+    int start_score = score;
+    for (int round = 1; ; round++) {
+        int round_score = score;
+        NodeVector nodes1, nodes2;
+        getBranches(nodes1, nodes2);
+        for (size_t i = 0; i < nodes1.size(); i++) {
+            // earlier moves of this round may have separated the nodes
+            if (nodes1[i]->isNeighbor(nodes2[i]))
+                score = doParsimonySPR((PhyloNode*)nodes1[i], (PhyloNode*)nodes2[i], radius, score);
+            if (nodes2[i]->isNeighbor(nodes1[i]))
+                score = doParsimonySPR((PhyloNode*)nodes2[i], (PhyloNode*)nodes1[i], radius, score);
+        }
+        if (verbose_mode >= VB_MAX)
+            cout << "Parsimony SPR round " << round << ": " << score << endl;
+        if (score >= round_score)
+            break;
+    }
+    if (verbose_mode >= VB_MED)
+        cout << "Parsimony SPR (radius " << radius << "): " << start_score << " -> " << score << endl;
+    return score;
+}
+
 void PhyloTree::extractBifurcatingSubTree(NeighborVec &removed_nei, NodeVector &attached_node, int *rand_stream) {
     NodeVector nodes;
     getMultifurcatingNodes(nodes);
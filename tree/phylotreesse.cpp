@@ -34,6 +34,9 @@
 
 #include "model/modelmarkov.h"
 #include "model/modelset.h"
+#include "phylosupertree.h"
+#include "utils/profiler.h"
+#include "utils/mmaparena.h"
 
 /* BQM: to ignore all-gapp subtree at an alignment site */
 //#define IGNORE_GAP_LH
@@ -49,6 +52,12 @@ void PhyloTree::setNumThreads(int num_threads) {
     this->num_threads = num_threads;
 }
 
+void PhyloTree::setPatternLayoutThreads(int num_threads) {
+    if (!isSuperTree() && aln && num_threads > 1 && num_threads > aln->getNPattern()/8)
+        num_threads = max(aln->getNPattern()/8,1UL);
+    pattern_layout_threads = num_threads;
+}
+
 void PhyloTree::setParsimonyKernel(LikelihoodKernel lk) {
     
     if (cost_matrix) {
@@ -90,14 +99,28 @@ void PhyloTree::setLikelihoodKernel(LikelihoodKernel lk) {
 
 	sse = lk;
     vector_size = 1;
+    computeSensitivityBlockPointer = NULL;
     safe_numeric = (params && (params->lk_safe_scaling || leafNum >= params->numseq_safe_scaling)) ||
         (aln && aln->num_states != 4 && aln->num_states != 20);
 
+    // single-precision partial_lh is only implemented by the reversible SIMD kernels;
+    // the storage layout is fixed once partial_lh vectors are allocated
+    bool float_lh_supported = params && aln && model_factory && lk >= LK_SSE2 &&
+        model_factory->model->isReversible() && !model_factory->model->isSiteSpecificModel() &&
+        !params->kernel_nonrev && !isMixlen();
+    if (!central_partial_lh)
+        float_lh = params && params->float_lh && !force_double_lh && float_lh_supported;
+    else if (float_lh && !float_lh_supported)
+        outError("Single-precision partial likelihoods (--float-lh) not supported by this likelihood kernel");
+    // site repeat classes are stored with scale_num, so also fixed once allocated
+    if (!central_partial_lh)
+        site_repeat = isSiteRepeatWanted() && lk >= LK_SSE2;
+
     //--- parsimony kernel ---
     setParsimonyKernel(lk);
 
     //--- dot-product kernel ---
-#ifdef __AVX512KNL
+#ifdef __AVX512KERNEL
     if (lk >= LK_AVX512) {
 		setDotProductAVX512();
     } else
@@ -117,6 +140,7 @@ void PhyloTree::setLikelihoodKernel(LikelihoodKernel lk) {
 //		dotProduct = &PhyloTree::dotProductSIMD<float, Vec1f>;
 #else
 		dotProduct = &PhyloTree::dotProductSIMD<double, Vec1d>;
+		rellProduct = &PhyloTree::rellProductSIMD<double, Vec1d>;
 #endif
         dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec1d>;
 #endif
@@ -152,7 +176,7 @@ void PhyloTree::setLikelihoodKernel(LikelihoodKernel lk) {
 
     //--- SIMD kernel ---
     if (lk >= LK_SSE2) {
-#ifdef __AVX512KNL
+#ifdef __AVX512KERNEL
     	if (lk >= LK_AVX512) {
     		setLikelihoodKernelAVX512();
     		return;
@@ -201,6 +225,51 @@ void PhyloTree::changeLikelihoodKernel(LikelihoodKernel lk) {
     setLikelihoodKernel(lk);
 }
 
+void PhyloTree::checkFloatLh() {
+    // a super tree keeps its partial_lh in the partition trees
+    if (!float_lh && !isSuperTree()) {
+        cout << "Single-precision partial likelihoods not used for this model, nothing to check" << endl;
+        return;
+    }
+    clearAllPartialLH();
+    double float_score = computeLikelihood();
+    double double_score = computeLikelihoodDoubleLh();
+
+    cout.precision(10);
+    cout << "Log-likelihood with float partial_lh:  " << float_score << endl;
+    cout << "Log-likelihood with double partial_lh: " << double_score << endl;
+    cout << "Absolute difference: " << fabs(float_score - double_score)
+        << " (relative " << fabs((float_score - double_score) / double_score) << ")" << endl;
+    cout.precision(3);
+}
+
+double PhyloTree::computeLikelihoodDoubleLh() {
+    if (isSuperTree()) {
+        double score = 0.0;
+        PhyloSuperTree *stree = (PhyloSuperTree*)this;
+        for (PhyloSuperTree::iterator it = stree->begin(); it != stree->end(); it++)
+            score += (*it)->computeLikelihoodDoubleLh();
+        return score;
+    }
+    if (!float_lh)
+        return computeLikelihood();
+    // float_lh is never used with mixlen, so a plain PhyloTree copy computes the same likelihood
+    PhyloTree *tree = new PhyloTree;
+    tree->copyPhyloTree(this);
+    NodeVector node_map;
+    mapCopiedNodes(tree, node_map);
+    tree->setParams(params);
+    tree->force_double_lh = true;
+    tree->setModelFactory(getModelFactory());
+    tree->setLikelihoodKernel(sse);
+    tree->setNumThreads(num_threads);
+    tree->initializeAllPartialLh();
+    double score = tree->computeLikelihood();
+    tree->setModelFactory(NULL);
+    delete tree;
+    return score;
+}
+
 /*******************************************************
  *
  * master function: wrapper for other optimized functions
@@ -211,13 +280,74 @@ void PhyloTree::computePartialLikelihood(TraversalInfo &info, size_t ptn_left, s
 	(this->*computePartialLikelihoodPointer)(info, ptn_left, ptn_right, thread_id);
 }
 
-double PhyloTree::computeLikelihoodBranch(PhyloNeighbor *dad_branch, PhyloNode *dad) {
-	return (this->*computeLikelihoodBranchPointer)(dad_branch, dad);
+size_t PhyloTree::getKernelTileSize(size_t vector_size) {
+    if (!params || params->kernel_tile == 0)
+        return 0;
+    size_t tile;
+    if (params->kernel_tile > 0) {
+        tile = params->kernel_tile;
+    } else {
+        // a tile of the dad and its two children should take at most half of the L2 cache,
+        // leaving the rest for eigenvectors, tip likelihoods and buffers
+        size_t ncat_mix = site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+        size_t ptn_bytes = model->num_states * ncat_mix * (float_lh ? sizeof(float) : sizeof(double));
+        tile = getL2CacheSize() / (2*3*ptn_bytes);
+    }
+    return max(tile / vector_size, (size_t)1) * vector_size;
+}
+
+void PhyloTree::computeTraversalPartialLikelihood(size_t ptn_lower, size_t ptn_upper, size_t vector_size, int thread_id) {
+    double start_time = Profiler::getInstance().startTime();
+    size_t tile = getKernelTileSize(vector_size);
+    if (tile == 0 || traversal_info.size() <= 1)
+        tile = ptn_upper - ptn_lower;
+    bool prefetch = (params->lh_mem_save == LM_MMAP);
+    for (size_t tile_lower = ptn_lower; tile_lower < ptn_upper; tile_lower += tile) {
+        size_t tile_upper = min(tile_lower + tile, ptn_upper);
+        if (prefetch && !traversal_info.empty())
+            prefetchPartialLh(traversal_info.front(), tile_lower, tile_upper);
+        for (vector<TraversalInfo>::iterator it = traversal_info.begin(); it != traversal_info.end(); it++) {
+            // page in the next step while computing this one
+            if (prefetch && it+1 != traversal_info.end())
+                prefetchPartialLh(*(it+1), tile_lower, tile_upper);
+            if (it->recompute) {
+                double recompute_start = getRealTime();
+                computePartialLikelihood(*it, tile_lower, tile_upper, thread_id);
+                double recompute_time = getRealTime() - recompute_start;
+                mem_slots.addRecomputeTime(recompute_time);
+                Profiler::getInstance().add(PROF_MEMSLOT_RECOMPUTE, 0, tile_upper - tile_lower, recompute_time);
+            } else
+                computePartialLikelihood(*it, tile_lower, tile_upper, thread_id);
+        }
+    }
+    // calls and patterns are counted once per traversal in computeTraversalInfo
+    Profiler::getInstance().addSince(PROF_PARTIAL_LH, 0, 0, start_time);
+}
+
+void PhyloTree::prefetchPartialLh(TraversalInfo &info, size_t ptn_lower, size_t ptn_upper) {
+    size_t ncat_mix = (model_factory->fused_mix_rate) ? site_rate->getNRate() : site_rate->getNRate()*model->getNMixtures();
+    size_t ptn_bytes = aln->num_states * ncat_mix * (float_lh ? sizeof(float) : sizeof(double));
+    size_t offset = ptn_lower * ptn_bytes, size = (ptn_upper - ptn_lower) * ptn_bytes;
+    PhyloNode *node = (PhyloNode*)info.dad_branch->node;
+    mmap_prefetch((char*)info.dad_branch->partial_lh + offset, size);
+    FOR_NEIGHBOR_IT(node, info.dad, it) {
+        PhyloNeighbor *child = (PhyloNeighbor*)*it;
+        if (!child->node->isLeaf() && child->partial_lh)
+            mmap_prefetch((char*)child->partial_lh + offset, size);
+    }
+}
 
+double PhyloTree::computeLikelihoodBranch(PhyloNeighbor *dad_branch, PhyloNode *dad) {
+    double start_time = Profiler::getInstance().startTime();
+	double tree_lh = (this->*computeLikelihoodBranchPointer)(dad_branch, dad);
+    Profiler::getInstance().addSince(PROF_BRANCH_LH, 1, aln->getNPattern(), start_time);
+    return tree_lh;
 }
 
 void PhyloTree::computeLikelihoodDerv(PhyloNeighbor *dad_branch, PhyloNode *dad, double *df, double *ddf) {
+    double start_time = Profiler::getInstance().startTime();
 	(this->*computeLikelihoodDervPointer)(dad_branch, dad, df, ddf);
+    Profiler::getInstance().addSince(PROF_DERV_LH, 1, aln->getNPattern(), start_time);
 }
 
 
@@ -225,11 +355,15 @@ double PhyloTree::computeLikelihoodFromBuffer() {
 	ASSERT(current_it && current_it_back);
 
     // TODO: buffer stuff for mixlen model
+    double start_time = Profiler::getInstance().startTime();
+    double tree_lh;
 	if (computeLikelihoodFromBufferPointer && optimize_by_newton)
-		return (this->*computeLikelihoodFromBufferPointer)();
+		tree_lh = (this->*computeLikelihoodFromBufferPointer)();
 	else {
-		return (this->*computeLikelihoodBranchPointer)(current_it, (PhyloNode*)current_it_back->node);
+		tree_lh = (this->*computeLikelihoodBranchPointer)(current_it, (PhyloNode*)current_it_back->node);
     }
+    Profiler::getInstance().addSince(PROF_BRANCH_LH, 1, aln->getNPattern(), start_time);
+    return tree_lh;
 
 }
 
@@ -759,7 +893,7 @@ void PhyloTree::computePartialLikelihoodEigen(PhyloNeighbor *dad_branch, PhyloNo
             num_leaves ++;
 	}
 
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (params->lh_mem_save != LM_MEM_SAVE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
@@ -1798,7 +1932,7 @@ void PhyloTree::computeAncestralLikelihood(PhyloNeighbor *dad_branch, PhyloNode
     }
 
     // TODO mem save
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (params->lh_mem_save != LM_MEM_SAVE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
@@ -1987,5 +2121,333 @@ void PhyloTree::computeAncestralState(PhyloNeighbor *dad_branch, PhyloNode *dad,
         computeAncestralState((PhyloNeighbor*)(*it), node, C, ancestral_seqs);
 }
 
+/*******************************************************
+ *
+ * derivatives of the log-likelihood by model quantities
+ *
+ ******************************************************/
+
+bool PhyloTree::isLikelihoodSensitivitySupported() {
+    if (!model || !site_rate || !model_factory || !aln || !root)
+        return false;
+    // the pre-order pass needs the partial likelihoods of all subtrees away from the root at once
+    return model->isReversible() && !model->isMixture() && !model->isSiteSpecificModel() &&
+        !model->isPolymorphismAware() && !site_rate->isHeterotachy() &&
+        model_factory->unobserved_ptns.empty() && model->getEigenvectors() && model->getEigenvalues() &&
+        root->isLeaf() && params && params->lh_mem_save != LM_MEM_SAVE && computeSensitivityBlockPointer;
+}
+
+bool PhyloTree::isAnalyticGradientWanted(int ndim) {
+    if (!params || params->analytic_grad == 0 || !isLikelihoodSensitivitySupported())
+        return false;
+    // one sensitivity pass costs about as much as 4 likelihood evaluations
+    return params->analytic_grad > 0 || ndim >= 8;
+}
+
+double *PhyloTree::loadPatternBlockLh(PhyloNeighbor *dad_branch, PhyloNode *node, size_t ptn, double *buffer) {
+    size_t nstates = aln->num_states;
+    size_t ncat = site_rate->getNRate();
+    size_t block = ncat * nstates;
+    size_t vsize = vector_size;
+    size_t nptn = aln->size();
+    size_t c, i, lane;
+    if (node->isLeaf()) {
+        for (lane = 0; lane < vsize; lane++) {
+            int state = (ptn+lane < nptn) ? (*aln)[ptn+lane][node->id] : aln->STATE_UNKNOWN;
+            double *tip = tip_partial_lh + state*nstates;
+            for (c = 0; c < ncat; c++)
+                for (i = 0; i < nstates; i++)
+                    buffer[(c*nstates+i)*vsize+lane] = tip[i];
+        }
+        return buffer;
+    }
+    if (float_lh) {
+        float *partial_lh = (float*)dad_branch->partial_lh + ptn*block;
+        for (i = 0; i < block*vsize; i++)
+            buffer[i] = partial_lh[i];
+        return buffer;
+    }
+    return dad_branch->partial_lh + ptn*block;
+}
 
+void PhyloTree::loadPatternBlockScale(PhyloNeighbor *dad_branch, PhyloNode *node, size_t ptn, int *scale) {
+    size_t ncat = site_rate->getNRate();
+    size_t vsize = vector_size;
+    size_t c, lane;
+    if (node->isLeaf()) {
+        memset(scale, 0, sizeof(int)*ncat*vsize);
+        return;
+    }
+    int scaling_exp = float_lh ? SCALING_THRESHOLD_FLOAT_EXP : SCALING_THRESHOLD_EXP;
+    UBYTE *scale_num = dad_branch->scale_num;
+    for (lane = 0; lane < vsize; lane++)
+        for (c = 0; c < ncat; c++)
+            scale[c*vsize+lane] = scaling_exp *
+                (safe_numeric ? scale_num[(ptn+lane)*ncat+c] : scale_num[ptn+lane]);
+}
 
+size_t PhyloTree::getSensitivityBufferSize(size_t nsrc) {
+    size_t ncat = site_rate->getNRate();
+    return ((2*nsrc+3)*ncat*aln->num_states + 3*ncat) * vector_size;
+}
+
+/** @return number of leaves in the subtree below node, also stored in leaves by node ID */
+static int countSubtreeLeaves(Node *node, Node *dad, IntVector &leaves) {
+    int num = node->isLeaf() ? 1 : 0;
+    FOR_NEIGHBOR_IT(node, dad, it)
+        num += countSubtreeLeaves((*it)->node, node, leaves);
+    leaves[node->id] = num;
+    return num;
+}
+
+void PhyloTree::computeLikelihoodSensitivity(LikelihoodSensitivity &sens) {
+    ASSERT(isLikelihoodSensitivitySupported());
+    size_t nstates = aln->num_states;
+    size_t ncat = site_rate->getNRate();
+    size_t block = ncat * nstates;
+    size_t nsquare = nstates * nstates;
+    size_t nptn = aln->size();
+    size_t vsize = vector_size;
+    size_t nblocks = (nptn+vsize-1)/vsize;
+    size_t c, i, j, k, lane;
+
+    // post-order pass: the partial likelihoods of all subtrees away from the root
+    PhyloNode *first_node = (PhyloNode*)root->neighbors[0]->node;
+    computeLikelihoodBranch((PhyloNeighbor*)root->neighbors[0], (PhyloNode*)root);
+
+    size_t nbranch = nodeNum-1;
+    IntVector leaves(nodeNum, 0);
+    countSubtreeLeaves(first_node, root, leaves);
+
+    sens.nstates = nstates;
+    sens.ncat = ncat;
+    sens.branch_len.resize(nbranch*ncat);
+    sens.trans.assign(nbranch*ncat*nsquare, 0.0);
+    sens.freq.assign(nstates, 0.0);
+    sens.prop.assign(ncat, 0.0);
+    sens.invar.assign(nptn, 0.0);
+
+    double *eval = model->getEigenvalues();
+    double *evec = model->getEigenvectors();
+    double state_freq[nstates];
+    model->getStateFrequency(state_freq);
+
+    double cat_prop[ncat];
+    for (c = 0; c < ncat; c++)
+        cat_prop[c] = site_rate->getProp(c);
+
+    // per-thread sums per SIMD lane for the branch and its leaf children, reduced in thread order
+    // for reproducible results
+    int nthreads = max(num_threads, 1);
+    size_t grad_size = (ncat*nsquare + nstates + ncat) * vsize;
+
+    // pre-order pass: the outside partial likelihoods of a branch, i.e. the rest of the tree at its
+    // dad end, are computed from those of the dad branch and the subtrees of the siblings.
+    // The smaller subtree is visited first, so only O(log n) of them are kept at a time
+    struct OutsideEntry {
+        PhyloNode *node, *dad;
+        /** outside partial likelihoods and scaling exponents, NULL at the root */
+        double *partial_lh;
+        int *scale;
+    };
+    vector<OutsideEntry> stack;
+    vector<double*> free_lh;
+    vector<int*> free_scale;
+    OutsideEntry first = {first_node, (PhyloNode*)root, NULL, NULL};
+    stack.push_back(first);
+    size_t branch_id = 0;
+    while (!stack.empty()) {
+        OutsideEntry entry = stack.back();
+        stack.pop_back();
+        SensitivityBranchInfo info;
+        info.dad = entry.dad;
+        info.node = entry.node;
+        info.dad_branch = (PhyloNeighbor*)info.dad->findNeighbor(info.node);
+        info.node_branch = (PhyloNeighbor*)info.node->findNeighbor(info.dad);
+        info.outside_lh = entry.partial_lh;
+        info.outside_scale = entry.scale;
+        info.cat_prop = cat_prop;
+        info.root_branch = (branch_id == 0);
+        ASSERT(info.node->isLeaf() || (info.dad_branch->partial_lh_computed & 1));
+
+        // the neighbors of node: dad first, then the children. Internal children get outside partial
+        // likelihoods, the branches to leaves are finished by the kernel
+        vector<PhyloNeighbor*> children;
+        vector<OutsideEntry> child_entries;
+        FOR_NEIGHBOR_IT(info.node, info.dad, it)
+            children.push_back((PhyloNeighbor*)*it);
+        size_t nsrc = children.size()+1;
+        double *child_lh[nsrc];
+        int *child_scale[nsrc];
+        // index of the branch and of the branches to leaf children in sens
+        size_t ids[nsrc];
+        ids[0] = branch_id++;
+        for (k = 1; k < nsrc; k++) {
+            child_lh[k-1] = NULL;
+            child_scale[k-1] = NULL;
+            if (children[k-1]->node->isLeaf()) {
+                ids[k] = branch_id++;
+                continue;
+            }
+            OutsideEntry child = {(PhyloNode*)children[k-1]->node, info.node, NULL, NULL};
+            if (free_lh.empty()) {
+                child.partial_lh = aligned_alloc<double>(nblocks*vsize*block);
+                child.scale = aligned_alloc<int>(nblocks*vsize*ncat);
+            } else {
+                child.partial_lh = free_lh.back();
+                child.scale = free_scale.back();
+                free_lh.pop_back();
+                free_scale.pop_back();
+            }
+            child_lh[k-1] = child.partial_lh;
+            child_scale[k-1] = child.scale;
+            child_entries.push_back(child);
+        }
+        info.nsrc = nsrc;
+        info.children = children.data();
+        info.child_lh = child_lh;
+        info.child_scale = child_scale;
+
+        // exp(eigenvalue * time) of the branch and the child branches, and the eigenvectors times them
+        double exp_eval[nsrc*block];
+        double *echildren = aligned_alloc<double>(nsrc*ncat*nsquare);
+        for (k = 0; k < nsrc; k++)
+            for (c = 0; c < ncat; c++) {
+                double len = (k == 0) ? info.dad_branch->getLength(c) : children[k-1]->getLength(c);
+                double *this_exp = exp_eval + k*block + c*nstates;
+                for (i = 0; i < nstates; i++)
+                    this_exp[i] = exp(eval[i]*site_rate->getRate(c)*len);
+                double *echild = echildren + (k*ncat+c)*nsquare;
+                for (i = 0; i < nstates; i++)
+                    for (j = 0; j < nstates; j++)
+                        echild[i*nstates+j] = evec[i*nstates+j] * this_exp[j];
+                if (k == 0 || children[k-1]->node->isLeaf())
+                    sens.branch_len[ids[k]*ncat+c] = len;
+            }
+        info.exp_eval = exp_eval;
+        info.child_exp_eval = exp_eval + block;
+        info.echildren = echildren;
+        size_t thread_size = nsrc*grad_size;
+        double *thread_sum = aligned_alloc<double>(nthreads*thread_size);
+        memset(thread_sum, 0, sizeof(double)*nthreads*thread_size);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads)
+#endif
+        {
+#ifdef _OPENMP
+            int thread_id = omp_get_thread_num(), team_size = omp_get_num_threads();
+#else
+            int thread_id = 0, team_size = 1;
+#endif
+            double *buffer = aligned_alloc<double>(getSensitivityBufferSize(nsrc));
+            int *scale_buffer = aligned_alloc<int>((nsrc+2)*ncat*vsize);
+            size_t block_lower = nblocks*thread_id/team_size, block_upper = nblocks*(thread_id+1)/team_size;
+            for (size_t blk = block_lower; blk < block_upper; blk++)
+                (this->*computeSensitivityBlockPointer)(info, blk*vsize, buffer, scale_buffer,
+                    thread_sum + thread_id*thread_size, sens);
+            aligned_free(scale_buffer);
+            aligned_free(buffer);
+        }
+        aligned_free(echildren);
+
+        // reduce threads and lanes, then transform the eigen coordinates G to states: pi_x * (V G V^T)_xy
+        for (int t = 1; t < nthreads; t++)
+            for (i = 0; i < thread_size; i++)
+                thread_sum[i] += thread_sum[t*thread_size+i];
+        for (i = 0; i < thread_size/vsize; i++)
+            for (lane = 1; lane < vsize; lane++)
+                thread_sum[i*vsize] += thread_sum[i*vsize+lane];
+        double eigen_grad[nsquare], tmp[nsquare];
+        for (k = 0; k < nsrc; k++) {
+            if (k > 0 && !children[k-1]->node->isLeaf())
+                continue;
+            double *sum = thread_sum + k*grad_size;
+            for (c = 0; c < ncat; c++) {
+                for (i = 0; i < nsquare; i++)
+                    eigen_grad[i] = sum[(c*nsquare+i)*vsize];
+                double *trans_grad = &sens.trans[(ids[k]*ncat+c)*nsquare];
+                for (i = 0; i < nstates; i++)
+                    for (j = 0; j < nstates; j++) {
+                        double val = 0.0;
+                        for (size_t m = 0; m < nstates; m++)
+                            val += evec[i*nstates+m] * eigen_grad[m*nstates+j];
+                        tmp[i*nstates+j] = val;
+                    }
+                for (i = 0; i < nstates; i++)
+                    for (j = 0; j < nstates; j++) {
+                        double val = 0.0;
+                        for (size_t m = 0; m < nstates; m++)
+                            val += tmp[i*nstates+m] * evec[j*nstates+m];
+                        trans_grad[i*nstates+j] = state_freq[i] * val;
+                    }
+            }
+        }
+        if (info.root_branch) {
+            for (i = 0; i < nstates; i++)
+                sens.freq[i] = thread_sum[(ncat*nsquare+i)*vsize];
+            for (c = 0; c < ncat; c++)
+                sens.prop[c] = thread_sum[(ncat*nsquare+nstates+c)*vsize];
+        }
+        aligned_free(thread_sum);
+
+        if (entry.partial_lh) {
+            free_lh.push_back(entry.partial_lh);
+            free_scale.push_back(entry.scale);
+        }
+        // the largest subtree last
+        for (k = 0; k < child_entries.size(); k++)
+            for (j = k+1; j < child_entries.size(); j++)
+                if (leaves[child_entries[j].node->id] > leaves[child_entries[k].node->id])
+                    swap(child_entries[j], child_entries[k]);
+        stack.insert(stack.end(), child_entries.begin(), child_entries.end());
+    }
+    ASSERT(branch_id == nbranch);
+
+    for (i = 0; i < free_lh.size(); i++) {
+        aligned_free(free_lh[i]);
+        aligned_free(free_scale[i]);
+    }
+}
+
+double PhyloTree::computeLinearLikelihood(LikelihoodSensitivity &sens) {
+    size_t nstates = sens.nstates;
+    size_t ncat = sens.ncat;
+    size_t nsquare = nstates * nstates;
+    size_t ntimes = sens.branch_len.size();
+    size_t i, c;
+
+    double *times = new double[ntimes];
+    for (i = 0; i < ntimes; i++)
+        times[i] = site_rate->getRate(i % ncat) * sens.branch_len[i];
+    double *trans_mat = aligned_alloc<double>(ntimes*nsquare);
+    model->computeTransMatrixBatch(ntimes, times, trans_mat);
+
+    double lh = 0.0;
+    for (i = 0; i < ntimes*nsquare; i++)
+        lh += sens.trans[i] * trans_mat[i];
+
+    double state_freq[nstates];
+    model->getStateFrequency(state_freq);
+    for (i = 0; i < nstates; i++)
+        lh += sens.freq[i] * state_freq[i];
+    for (c = 0; c < ncat; c++)
+        lh += sens.prop[c] * site_rate->getProp(c);
+
+    if (site_rate->getPInvar() != 0.0) {
+        // ptn_invar of the current model, the one of the tree is kept
+        size_t nptn = sens.invar.size();
+        size_t maxptn = get_safe_upper_limit(nptn);
+        double *saved_invar = aligned_alloc<double>(maxptn);
+        memcpy(saved_invar, ptn_invar, maxptn*sizeof(double));
+        computePtnInvar();
+        for (i = 0; i < nptn; i++)
+            lh += sens.invar[i] * ptn_invar[i];
+        memcpy(ptn_invar, saved_invar, maxptn*sizeof(double));
+        aligned_free(saved_invar);
+    }
+
+    aligned_free(trans_mat);
+    delete [] times;
+    return lh;
+}
@@ -0,0 +1,170 @@
+/*
+ * mmaparena.cpp
+ * Memory-mapped arenas for the large likelihood buffers: file-backed memory for partial
+ * likelihood vectors that do not fit into RAM (--mem-mmap option) and huge pages (--mem-huge option)
+ */
+
+#include "mmaparena.h"
+#include "tools.h"
+
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#define IQTREE_HAVE_MMAP
+#endif
+
+/** kinds of mapped regions */
+enum MappedKind {
+    MAPPED_FILE, MAPPED_HUGETLB, MAPPED_THP
+};
+
+/** a mapped region, to unmap it and report the usage */
+struct MappedRegion {
+    size_t size;
+    size_t requested;
+    MappedKind kind;
+};
+
+/** all mapped regions by their start; trees are allocated and freed concurrently,
+    so the map is only accessed in the critical section mmap_regions */
+static map<void*, MappedRegion> mmap_regions;
+
+const size_t HUGE_PAGE_2MB = (size_t)1 << 21;
+const size_t HUGE_PAGE_1GB = (size_t)1 << 30;
+
+void *mmap_alloc_bytes(size_t size, const char *dir) {
+#ifdef IQTREE_HAVE_MMAP
+    if (size == 0)
+        size = 1;
+    string file_name = string(dir) + "/iqtree-lh-XXXXXX";
+    vector<char> file_name_buf(file_name.begin(), file_name.end());
+    file_name_buf.push_back(0);
+    int fd = mkstemp(&file_name_buf[0]);
+    if (fd < 0)
+        outError("Cannot create memory-mapped file in ", dir);
+    // nobody else needs the file, it is removed once unmapped
+    unlink(&file_name_buf[0]);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        outError("Cannot reserve " + convertInt64ToString(size) + " bytes for memory-mapped file in " + dir);
+    }
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        outError("Memory-mapping of " + convertInt64ToString(size) + " bytes failed in " + dir);
+    MappedRegion region = {size, size, MAPPED_FILE};
+#pragma omp critical(mmap_regions)
+    mmap_regions[mem] = region;
+    return mem;
+#else
+    outError("--mem-mmap is not supported on this platform");
+    return NULL;
+#endif
+}
+
+#ifdef IQTREE_HAVE_MMAP
+/** round size up to a multiple of page_size (a power of 2) */
+static inline size_t round_up_page(size_t size, size_t page_size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+#endif
+
+#if defined(IQTREE_HAVE_MMAP) && defined(MAP_HUGETLB)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+/**
+    map explicit huge pages of a given size from the reserved pool
+    @return the memory or MAP_FAILED if no such pages are available
+*/
+static void *map_hugetlb(size_t size, size_t page_size, int page_shift) {
+    return mmap(NULL, round_up_page(size, page_size), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+}
+#endif
+
+void *huge_alloc_bytes(size_t size) {
+#ifdef IQTREE_HAVE_MMAP
+    if (size < HUGE_PAGE_2MB)
+        return NULL;
+    MappedRegion region = {0, size, MAPPED_HUGETLB};
+    void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (size >= HUGE_PAGE_1GB) {
+        mem = map_hugetlb(size, HUGE_PAGE_1GB, 30);
+        region.size = round_up_page(size, HUGE_PAGE_1GB);
+    }
+    if (mem == MAP_FAILED) {
+        mem = map_hugetlb(size, HUGE_PAGE_2MB, 21);
+        region.size = round_up_page(size, HUGE_PAGE_2MB);
+    }
+#endif
+    if (mem == MAP_FAILED) {
+        // no reserved huge pages: map 2 MB-aligned memory and ask for transparent huge pages
+        region.kind = MAPPED_THP;
+        region.size = round_up_page(size, HUGE_PAGE_2MB);
+        size_t map_size = region.size + HUGE_PAGE_2MB;
+        char *raw = (char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == (char*)MAP_FAILED)
+            return NULL;
+        char *start = (char*)round_up_page((size_t)raw, HUGE_PAGE_2MB);
+        // give back the unaligned head and the unused tail
+        if (start > raw)
+            munmap(raw, start - raw);
+        if (raw + map_size > start + region.size)
+            munmap(start + region.size, (raw + map_size) - (start + region.size));
+        mem = start;
+#ifdef MADV_HUGEPAGE
+        madvise(mem, region.size, MADV_HUGEPAGE);
+#endif
+    }
+#pragma omp critical(mmap_regions)
+    mmap_regions[mem] = region;
+    return mem;
+#else
+    return NULL;
+#endif
+}
+
+void huge_alloc_usage(uint64_t &requested, uint64_t &mapped, uint64_t &explicit_huge) {
+    requested = mapped = explicit_huge = 0;
+#pragma omp critical(mmap_regions)
+    for (auto it = mmap_regions.begin(); it != mmap_regions.end(); it++) {
+        if (it->second.kind == MAPPED_FILE)
+            continue;
+        requested += it->second.requested;
+        mapped += it->second.size;
+        if (it->second.kind == MAPPED_HUGETLB)
+            explicit_huge += it->second.size;
+    }
+}
+
+bool mmap_free(void *mem) {
+#ifdef IQTREE_HAVE_MMAP
+    size_t size = 0;
+#pragma omp critical(mmap_regions)
+    {
+        auto it = mmap_regions.find(mem);
+        if (it != mmap_regions.end()) {
+            size = it->second.size;
+            mmap_regions.erase(it);
+        }
+    }
+    if (size == 0)
+        return false;
+    munmap(mem, size);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void mmap_prefetch(void *mem, size_t size) {
+#ifdef IQTREE_HAVE_MMAP
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)mem & ~(page_size-1);
+    size_t end = (size_t)mem + size;
+    madvise((void*)start, end - start, MADV_WILLNEED);
+#endif
+}
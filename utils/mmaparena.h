@@ -0,0 +1,71 @@
+/*
+ * mmaparena.h
+ * Memory-mapped arenas for the large likelihood buffers: file-backed memory for partial
+ * likelihood vectors that do not fit into RAM (--mem-mmap option) and huge pages (--mem-huge option)
+ */
+
+#ifndef MMAPARENA_H
+#define MMAPARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+    map a new file of at least size bytes in directory dir into memory.
+    The file is unlinked right away, so it disappears when the memory is freed or the program ends.
+    @param size number of bytes
+    @param dir directory of the backing file, preferably on a local SSD
+    @return page-aligned, zero-initialized memory
+*/
+void *mmap_alloc_bytes(size_t size, const char *dir);
+
+/**
+    allocate file-backed memory for size elements of type T, see mmap_alloc_bytes()
+*/
+template< class T>
+inline T *mmap_alloc(size_t size, const char *dir) {
+    return (T*)mmap_alloc_bytes(size*sizeof(T), dir);
+}
+
+/**
+    map anonymous memory of at least size bytes backed by huge pages: explicit 1 GB or 2 MB pages
+    if the system has them reserved, otherwise transparent huge pages via madvise(MADV_HUGEPAGE).
+    Physical pages are only assigned on first touch, so the thread writing a page first decides its NUMA node.
+    @param size number of bytes
+    @return 2 MB-aligned, zero-initialized memory, or NULL if size is below one huge page or
+        huge pages are not supported on this platform
+*/
+void *huge_alloc_bytes(size_t size);
+
+/**
+    allocate huge-page memory for size elements of type T, see huge_alloc_bytes()
+*/
+template< class T>
+inline T *huge_alloc(size_t size) {
+    return (T*)huge_alloc_bytes(size*sizeof(T));
+}
+
+/**
+    unmap memory allocated by mmap_alloc() or huge_alloc()
+    @param mem start of the memory
+    @return TRUE if mem was allocated by mmap_alloc() or huge_alloc() and is now freed, FALSE otherwise
+*/
+bool mmap_free(void *mem);
+
+/**
+    hint the OS to page in a memory range of mmap_alloc() soon, without waiting for it
+    @param mem start of the range, does not need to be page-aligned
+    @param size number of bytes
+*/
+void mmap_prefetch(void *mem, size_t size);
+
+/**
+    get the memory currently held by huge_alloc()
+    @param[out] requested number of bytes requested
+    @param[out] mapped number of bytes mapped, rounded up to the page size
+    @param[out] explicit_huge number of mapped bytes in explicit (hugetlbfs) 1 GB or 2 MB pages,
+        the rest relies on transparent huge pages
+*/
+void huge_alloc_usage(uint64_t &requested, uint64_t &mapped, uint64_t &explicit_huge);
+
+#endif
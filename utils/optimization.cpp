@@ -857,7 +857,7 @@ void Optimization::dfpmin(double p[], int n, double lower[], double upper[], dou
 
 
 /**
-	the approximated derivative function
+	the approximated derivative function, or the analytic one if computeGradient() provides it
 	@param x the input vector x
 	@param dfx the derivative at x
 	@return the function value at x
@@ -867,11 +867,14 @@ double Optimization::derivativeFunk(double x[], double dfx[]) {
 	if (!checkRange(x))
 		return INFINITIVE;
 	*/
+	double fx;
+	if (computeGradient(x, dfx, fx))
+		return fx;
 	int ndim = getNDim();
 	double *h = new double[ndim+1];
     double temp;
     int dim;
-	double fx = targetFunk(x);
+	fx = targetFunk(x);
 	for (dim = 1; dim <= ndim; dim++ ){
 		temp = x[dim];
 		h[dim] = ERROR_X * fabs(temp);
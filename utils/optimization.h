@@ -13,6 +13,7 @@
 #define OPTIMIZATION_H
 
 #include <iostream>
+#include <math.h>
 
 /**
 Optimization class, implement some methods like Brent, Newton-Raphson (for 1 variable function), BFGS (for multi-dimensional function)
@@ -144,6 +145,23 @@ public:
 	*/
 	virtual double derivativeFunk(double x[], double dfx[]);
 
+	/**
+		analytic derivative of targetFunk, used by derivativeFunk instead of finite differences
+		@param x the input vector x
+		@param dfx (OUT) the derivative at x
+		@param fx (OUT) the function value at x
+		@return true if computed, false if not available for the current function
+	*/
+	virtual bool computeGradient(double x[], double dfx[], double &fx) { return false; }
+
+	/**
+		@return step for central differences of an inexpensive function of x, as used by computeGradient()
+	*/
+	static double getGradientStep(double x) {
+		double h = 1e-5 * fabs(x);
+		return (h == 0.0) ? 1e-5 : h;
+	}
+
 	/**
 	        Controls restarting of optimization if optimization gets
                 stuck on the boundary. Models are free to override this
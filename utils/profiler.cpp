@@ -0,0 +1,96 @@
+/*
+ * profiler.cpp
+ * Counters and timers of the hot paths (--profile option), reported per phase in <prefix>.profile.json
+ */
+
+#include "profiler.h"
+#include "tools.h"
+
+const char *prof_phase_names[PROF_NUM_PHASES] = {
+    "other", "modelfinder", "initial_trees", "search", "ufboot", "support"
+};
+
+const char *prof_counter_names[PROF_NUM_COUNTERS] = {
+    "partial_lh", "branch_lh", "derv_lh", "trans_matrix_hit", "trans_matrix_miss", "memslot_evict", "memslot_recompute", "nni_eval"
+};
+
+Profiler &Profiler::getInstance() {
+    static Profiler instance;
+    return instance;
+}
+
+Profiler::Profiler() {
+    memset(entries, 0, sizeof(entries));
+    memset(phase_seconds, 0, sizeof(phase_seconds));
+    phase = PROF_PHASE_OTHER;
+    phase_start_time = getRealTime();
+    enabled = false;
+}
+
+void Profiler::setEnabled(bool enable) {
+    if (enable && !enabled)
+        phase_start_time = getRealTime();
+    enabled = enable;
+}
+
+ProfilePhase Profiler::enterPhase(ProfilePhase new_phase) {
+    ProfilePhase old_phase = phase;
+    if (enabled) {
+        double now = getRealTime();
+        phase_seconds[phase] += now - phase_start_time;
+        phase_start_time = now;
+    }
+    phase = new_phase;
+    return old_phase;
+}
+
+/** print one section of the profile report */
+static void writeProfileSection(ostream &out, const char *name, double wall_seconds,
+    uint64_t calls[], uint64_t patterns[], double seconds[])
+{
+    out << "  \"" << name << "\": {" << endl;
+    out << "    \"wall_seconds\": " << wall_seconds;
+    for (int c = 0; c < PROF_NUM_COUNTERS; c++) {
+        out << "," << endl << "    \"" << prof_counter_names[c] << "\": {\"calls\": " << calls[c]
+            << ", \"patterns\": " << patterns[c] << ", \"seconds\": " << seconds[c] << "}";
+    }
+    out << endl << "  }";
+}
+
+void Profiler::writeJSON(const char *file_name, int num_threads) {
+    // account the running phase up to now
+    enterPhase(phase);
+    uint64_t total_calls[PROF_NUM_COUNTERS], total_patterns[PROF_NUM_COUNTERS];
+    double total_seconds[PROF_NUM_COUNTERS];
+    double total_wall = 0.0;
+    memset(total_calls, 0, sizeof(total_calls));
+    memset(total_patterns, 0, sizeof(total_patterns));
+    memset(total_seconds, 0, sizeof(total_seconds));
+    try {
+        ofstream out;
+        out.exceptions(ios::failbit | ios::badbit);
+        out.open(file_name);
+        out << "{" << endl;
+        for (int p = 0; p < PROF_NUM_PHASES; p++) {
+            uint64_t calls[PROF_NUM_COUNTERS], patterns[PROF_NUM_COUNTERS];
+            double seconds[PROF_NUM_COUNTERS];
+            for (int c = 0; c < PROF_NUM_COUNTERS; c++) {
+                calls[c] = entries[p][c].calls;
+                patterns[c] = entries[p][c].patterns;
+                seconds[c] = entries[p][c].seconds;
+                total_calls[c] += calls[c];
+                total_patterns[c] += patterns[c];
+                total_seconds[c] += seconds[c];
+            }
+            total_wall += phase_seconds[p];
+            writeProfileSection(out, prof_phase_names[p], phase_seconds[p], calls, patterns, seconds);
+            out << "," << endl;
+        }
+        out << "  \"threads\": " << num_threads << "," << endl;
+        writeProfileSection(out, "total", total_wall, total_calls, total_patterns, total_seconds);
+        out << endl << "}" << endl;
+        out.close();
+    } catch (ios::failure) {
+        outError(ERR_WRITE_OUTPUT, file_name);
+    }
+}
@@ -0,0 +1,159 @@
+/*
+ * profiler.h
+ * Counters and timers of the hot paths (--profile option), reported per phase in <prefix>.profile.json
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include "timeutil.h"
+
+/** hot paths counted by the Profiler */
+enum ProfileCounter {
+    PROF_PARTIAL_LH,        // partial likelihood vectors updated, seconds summed over threads and
+                            // also contained in the branch/derivative evaluation that triggered them
+    PROF_BRANCH_LH,         // likelihood evaluations at a branch
+    PROF_DERV_LH,           // first and second derivative evaluations at a branch
+    PROF_TRANS_MATRIX_HIT,  // ModelFactory::computeTransMatrix/computeTransDerv served from the cache
+    PROF_TRANS_MATRIX_MISS, // ModelFactory::computeTransMatrix/computeTransDerv computed by the model
+    PROF_MEMSLOT_EVICT,     // partial likelihood vectors evicted from a memory slot (-mem option)
+    PROF_MEMSLOT_RECOMPUTE, // evicted partial likelihood vectors computed again, seconds summed over threads
+    PROF_NNI_EVAL,          // NNI moves evaluated
+    PROF_NUM_COUNTERS
+};
+
+/** phases of a run, top-level sections of the profile report */
+enum ProfilePhase {
+    PROF_PHASE_OTHER,
+    PROF_PHASE_MODELFINDER,
+    PROF_PHASE_INITIAL_TREES,
+    PROF_PHASE_SEARCH,
+    PROF_PHASE_UFBOOT,
+    PROF_PHASE_SUPPORT,
+    PROF_NUM_PHASES
+};
+
+/**
+    Counts calls, patterns and wall-clock seconds of the hot paths, split by the current phase.
+    Disabled by default: add() then returns at once and startTime() does not read the clock.
+    add() is thread-safe; the phase and enabled state must only be changed outside parallel regions.
+    Seconds of calls running concurrently (partition trees in parallel, blocks of a
+    partial likelihood update) are summed, so they may exceed the wall-clock time of the phase.
+*/
+class Profiler {
+public:
+    /**
+        Singleton method: get one and only one getInstance of the class
+    */
+    static Profiler &getInstance();
+
+    /**
+        add to a counter of the current phase
+        @param counter hot path
+        @param calls number of calls
+        @param patterns number of alignment patterns processed
+        @param seconds wall-clock time spent
+    */
+    inline void add(ProfileCounter counter, uint64_t calls, uint64_t patterns, double seconds) {
+        if (!enabled)
+            return;
+        ProfileEntry &entry = entries[phase][counter];
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+        entry.calls += calls;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+        entry.patterns += patterns;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+        entry.seconds += seconds;
+    }
+
+    /**
+        add to a counter of the current phase the seconds since start_time
+        @param start_time value of startTime() when the hot path was entered
+    */
+    inline void addSince(ProfileCounter counter, uint64_t calls, uint64_t patterns, double start_time) {
+        if (enabled)
+            add(counter, calls, patterns, getRealTime() - start_time);
+    }
+
+    /** @return current wall-clock time if profiling is enabled, 0 otherwise */
+    inline double startTime() {
+        return enabled ? getRealTime() : 0.0;
+    }
+
+    /** @return TRUE if the hot paths are profiled */
+    inline bool isEnabled() {
+        return enabled;
+    }
+
+    /** enable or disable profiling */
+    void setEnabled(bool enable);
+
+    /**
+        switch to a new phase
+        @return the previous phase
+    */
+    ProfilePhase enterPhase(ProfilePhase new_phase);
+
+    /** @return current phase */
+    ProfilePhase getPhase() {
+        return phase;
+    }
+
+    /**
+        write all counters as JSON, one top-level section per phase plus "total"
+        @param file_name output file
+        @param num_threads number of threads used, reported in "total"
+    */
+    void writeJSON(const char *file_name, int num_threads);
+
+private:
+
+    Profiler();
+
+    /** one cache line per entry, so that threads adding to different counters do not share lines */
+    struct alignas(64) ProfileEntry {
+        uint64_t calls;
+        uint64_t patterns;
+        double seconds;
+    };
+
+    /** counters per phase */
+    ProfileEntry entries[PROF_NUM_PHASES][PROF_NUM_COUNTERS];
+
+    /** wall-clock seconds per phase, without the running one */
+    double phase_seconds[PROF_NUM_PHASES];
+
+    /** current phase */
+    ProfilePhase phase;
+
+    /** TRUE if counting (--profile option) */
+    bool enabled;
+
+    /** time when the current phase was entered */
+    double phase_start_time;
+};
+
+/**
+    enter a phase for the lifetime of this object and go back to the previous one afterwards,
+    so that nested phases (e.g. initial trees inside the search) are attributed to the inner one
+*/
+class ProfilePhaseScope {
+public:
+    ProfilePhaseScope(ProfilePhase phase) {
+        saved_phase = Profiler::getInstance().enterPhase(phase);
+    }
+    ~ProfilePhaseScope() {
+        Profiler::getInstance().enterPhase(saved_phase);
+    }
+private:
+    ProfilePhase saved_phase;
+};
+
+#endif
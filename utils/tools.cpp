@@ -28,6 +28,9 @@
 #include "MPIHelper.h"
 #include <dirent.h>
 #include <thread>
+#if !defined(WIN32) && !defined(_WIN32)
+#include <unistd.h>
+#endif
 
 #if defined(Backtrace_FOUND)
 #include <execinfo.h>
@@ -840,6 +843,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.gurobi_threads = 1;
     params.num_bootstrap_samples = 0;
     params.bootstrap_spec = NULL;
+    params.bootstrap_reweight = false;
     params.transfer_bootstrap = 0;
 
     params.aln_file = NULL;
@@ -926,6 +930,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.optimize_mixmodel_weight = false;
     params.optimize_rate_matrix = false;
     params.store_trans_matrix = false;
+    params.trans_cache_mem = 64 << 20;
     //params.freq_type = FREQ_EMPIRICAL;
     params.freq_type = FREQ_UNKNOWN;
     params.keep_zero_freq = true;
@@ -941,6 +946,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.optimize_by_newton = true;
     params.optimize_alg = "2-BFGS,EM";
     params.optimize_alg_mixlen = "EM";
+    params.optimize_alg_brlen = "NR";
     params.optimize_alg_gammai = "EM";
     params.optimize_from_given_params = false;
     params.fixed_branch_length = BRLEN_OPTIMIZE;
@@ -965,7 +971,8 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.aLRT_test = false;
     params.aBayes_test = false;
     params.localbp_replicates = 0;
-#ifdef __AVX512KNL
+#ifdef __AVX512KERNEL
+    // capped at runtime by the instruction set detected on the CPU
     params.SSE = LK_AVX512;
 #else
     params.SSE = LK_AVX_FMA;
@@ -1067,6 +1074,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.numSupportTrees = 20;
 //    params.sprDist = 20;
     params.sprDist = 6;
+    params.pars_spr = false;
     params.sankoff_cost_file = NULL;
     params.numNNITrees = 20;
     params.avh_test = 0;
@@ -1077,6 +1085,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.num_threads = 1;
     params.num_threads_max = 10000;
     params.openmp_by_model = false;
+    params.model_group_threads = 0;
     params.model_test_criterion = MTC_BIC;
 //    params.model_test_stop_rule = MTC_ALL;
     params.model_test_sample_size = 0;
@@ -1093,7 +1102,19 @@ void parseArg(int argc, char *argv[], Params &params) {
 	params.pomo_pop_size = 9;
 	params.print_branch_lengths = false;
 	params.lh_mem_save = LM_PER_NODE; // auto detect
+    params.lh_huge_pages = false;
     params.buffer_mem_save = false;
+    params.mem_evict_policy = MEM_EVICT_COST;
+    params.kernel_schedule = KS_STATIC;
+    params.kernel_schedule_bench = false;
+    params.kernel_tile = -1;
+    params.float_lh = false;
+    params.site_repeat = 0;
+    params.profile = false;
+    params.analytic_grad = -1;
+    params.nni_branch_parallel = false;
+    params.search_trajectories = 1;
+    params.float_lh_check = false;
 	params.start_tree = STT_PLL_PARSIMONY;
     params.modelfinder_ml_tree = true;
     params.final_model_opt = true;
@@ -1261,6 +1282,13 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.optimize_alg_mixlen = argv[cnt];
 				continue;
 			}
+            if (strcmp(argv[cnt], "--brlen-opt") == 0) {
+                cnt++;
+                if (cnt >= argc || (strcmp(argv[cnt], "NR") != 0 && strcmp(argv[cnt], "LBFGS") != 0))
+                    throw "Use --brlen-opt NR|LBFGS";
+                params.optimize_alg_brlen = argv[cnt];
+                continue;
+            }
             if (strcmp(argv[cnt], "-optalg_gammai") == 0) {
                 cnt++;
                 if (cnt >= argc)
@@ -2455,6 +2483,13 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.store_trans_matrix = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-mstore-mem") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -mstore-mem <MB>";
+				params.trans_cache_mem = (uint64_t)convert_int(argv[cnt]) << 20;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-nni_lh") == 0) {
 				params.nni_lh = true;
 				continue;
@@ -2481,9 +2516,13 @@ void parseArg(int argc, char *argv[], Params &params) {
                     params.SSE = LK_AVX;
                 else if (strcmp(argv[cnt], "FMA") == 0)
                     params.SSE = LK_AVX_FMA;
-                else if (strcmp(argv[cnt], "AVX512") == 0)
+                else if (strcmp(argv[cnt], "AVX512") == 0) {
+#ifdef __AVX512KERNEL
                     params.SSE = LK_AVX512;
-                else
+#else
+                    throw "AVX512 likelihood kernel was not compiled into this binary";
+#endif
+                } else
                     throw "Incorrect -lk likelihood kernel option";
 				continue;
 			}
@@ -2801,6 +2840,10 @@ void parseArg(int argc, char *argv[], Params &params) {
                 params.remove_empty_seq = false;
 				continue;
 			}
+            if (strcmp(argv[cnt], "--boot-reweight") == 0) {
+                params.bootstrap_reweight = true;
+                continue;
+            }
             
             if (strcmp(argv[cnt], "--subsample") == 0) {
                 cnt++;
@@ -3371,6 +3414,32 @@ void parseArg(int argc, char *argv[], Params &params) {
                 }
 				continue;
 			}
+            if (strcmp(argv[cnt], "--mem-mmap") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --mem-mmap DIR";
+                params.lh_mem_save = LM_MMAP;
+                params.mmap_dir = argv[cnt];
+                continue;
+            }
+            if (strcmp(argv[cnt], "--mem-huge") == 0) {
+                params.lh_huge_pages = true;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--mem-evict") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --mem-evict cost|lru|hybrid";
+                if (strcmp(argv[cnt], "cost") == 0)
+                    params.mem_evict_policy = MEM_EVICT_COST;
+                else if (strcmp(argv[cnt], "lru") == 0)
+                    params.mem_evict_policy = MEM_EVICT_LRU;
+                else if (strcmp(argv[cnt], "hybrid") == 0)
+                    params.mem_evict_policy = MEM_EVICT_HYBRID;
+                else
+                    throw "Use --mem-evict cost|lru|hybrid";
+                continue;
+            }
             if (strcmp(argv[cnt], "--save-mem-buffer") == 0) {
                 params.buffer_mem_save = true;
                 continue;
@@ -3379,6 +3448,77 @@ void parseArg(int argc, char *argv[], Params &params) {
                 params.buffer_mem_save = false;
                 continue;
             }
+            if (strcmp(argv[cnt], "--kernel-sched") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --kernel-sched static|steal";
+                if (strcmp(argv[cnt], "static") == 0)
+                    params.kernel_schedule = KS_STATIC;
+                else if (strcmp(argv[cnt], "steal") == 0)
+                    params.kernel_schedule = KS_STEAL;
+                else
+                    throw "Use --kernel-sched static|steal";
+                continue;
+            }
+            if (strcmp(argv[cnt], "--kernel-sched-bench") == 0) {
+                params.kernel_schedule_bench = true;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--kernel-tile") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --kernel-tile AUTO|NUM_PATTERNS";
+                if (strcmp(argv[cnt], "AUTO") == 0)
+                    params.kernel_tile = -1;
+                else {
+                    params.kernel_tile = convert_int(argv[cnt]);
+                    if (params.kernel_tile < 0)
+                        throw "--kernel-tile must be AUTO or non-negative";
+                }
+                continue;
+            }
+            if (strcmp(argv[cnt], "--float-lh") == 0) {
+                params.float_lh = true;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--float-lh-check") == 0) {
+                params.float_lh = true;
+                params.float_lh_check = true;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--site-repeat") == 0) {
+                params.site_repeat = 1;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--no-site-repeat") == 0) {
+                params.site_repeat = 0;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--profile") == 0) {
+                params.profile = true;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--analytic-grad") == 0) {
+                params.analytic_grad = 1;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--no-analytic-grad") == 0) {
+                params.analytic_grad = 0;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--nni-branch-par") == 0) {
+                params.nni_branch_parallel = true;
+                continue;
+            }
+            if (strcmp(argv[cnt], "--search-traj") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --search-traj <number_of_trajectories>";
+                params.search_trajectories = convert_int(argv[cnt]);
+                if (params.search_trajectories < 1)
+                    throw "--search-traj must be positive";
+                continue;
+            }
 //			if (strcmp(argv[cnt], "-storetrees") == 0) {
 //				params.store_candidate_trees = true;
 //				continue;
@@ -3842,6 +3982,16 @@ void parseArg(int argc, char *argv[], Params &params) {
                 continue;
             }
 
+            if (strcmp(argv[cnt], "--model-group-threads") == 0) {
+                cnt++;
+                if (cnt >= argc)
+                    throw "Use --model-group-threads NUM";
+                params.model_group_threads = convert_int(argv[cnt]);
+                if (params.model_group_threads < 0)
+                    throw "--model-group-threads must be non-negative";
+                continue;
+            }
+
 //			if (strcmp(argv[cnt], "-rootstate") == 0) {
 //                cnt++;
 //                if (cnt >= argc)
@@ -3861,6 +4011,10 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.sprDist = convert_int(argv[cnt]);
 				continue;
 			}
+			if (strcmp(argv[cnt], "--pars-spr") == 0) {
+				params.pars_spr = true;
+				continue;
+			}
             
             if (strcmp(argv[cnt], "--mpcost") == 0) {
                 cnt++;
@@ -4235,9 +4389,18 @@ void parseArg(int argc, char *argv[], Params &params) {
     
     if (params.lh_mem_save == LM_MEM_SAVE && params.partition_file)
         outError("-mem option does not work with partition models yet");
+
+    if (params.float_lh && params.print_ancestral_sequence)
+        outError("--float-lh option does not work with ancestral sequence reconstruction yet");
+
+    if (params.float_lh && params.partition_file && params.partition_type != BRLEN_OPTIMIZE && params.partition_type != TOPO_UNLINKED)
+        outError("--float-lh option does not work with edge-linked partition model (-spp or -q) yet");
     
     if (params.gbo_replicates && params.num_bootstrap_samples)
         outError("UFBoot (-bb) and standard bootstrap (-b) must not be specified together");
+
+    if (params.openmp_by_model && params.model_group_threads > 0)
+        outError("--thread-model and --model-group-threads must not be specified together");
     
     if ((params.model_name.find("ONLY") != string::npos || (params.model_name.substr(0,2) == "MF" && params.model_name.substr(0,3) != "MFP")) && (params.gbo_replicates || params.num_bootstrap_samples))
         outError("ModelFinder only cannot be combined with bootstrap analysis");
@@ -4395,6 +4558,9 @@ void usage_iqtree(char* argv[], bool full_command) {
     << "  --seed NUM           Random seed number, normally used for debugging purpose" << endl
     << "  --safe               Safe likelihood kernel to avoid numerical underflow" << endl
     << "  --mem NUM[G|M|%]     Maximal RAM usage in GB | MB | %" << endl
+    << "  --mem-evict STR      cost|lru|hybrid eviction under --mem (default: cost)" << endl
+    << "  --mem-mmap DIR       Keep partial likelihoods in memory-mapped files in DIR" << endl
+    << "  --mem-huge           Allocate partial likelihoods in huge pages, first touched per thread" << endl
     << "  --runs NUM           Number of indepedent runs (default: 1)" << endl
     << "  -v, --verbose        Verbose mode, printing more messages to screen" << endl
     << "  -V, --version        Display version number" << endl
@@ -4404,7 +4570,24 @@ void usage_iqtree(char* argv[], bool full_command) {
 #ifdef _OPENMP
     << "  -T NUM|AUTO          No. cores/threads or AUTO-detect (default: 1)" << endl
     << "  --threads-max NUM    Max number of threads for -T AUTO (default: all cores)" << endl
+    << "  --kernel-sched STR   static|steal pattern scheduling in kernels (default: static)" << endl
+    << "  --kernel-sched-bench Benchmark kernel scheduling up to --threads-max threads" << endl
+    << "  --nni-branch-par     Evaluate NNIs of different branches in parallel threads," << endl
+    << "                       each on a tree copy, needs more RAM (default: OFF)" << endl
+    << "  --search-traj NUM    Concurrent tree search trajectories, -T/NUM threads each (default: 1)" << endl
+    << "  --model-group-threads NUM Threads per group of ModelFinder models run concurrently" << endl
+    << "                       (default: 0 = off, not with --thread-model)" << endl
 #endif
+    << "  --kernel-tile AUTO|NUM Patterns per cache tile of partial likelihoods, 0 = off (default: AUTO)" << endl
+    << "  --float-lh           Store partial likelihoods in single precision (half memory)" << endl
+    << "  --float-lh-check     Like --float-lh, and compare final log-likelihood with double" << endl
+    << "  --site-repeat        Compute partial likelihoods once per repeated subtree pattern" << endl
+    << "                       (saves time, not memory: all patterns are still stored)" << endl
+    << "  --no-site-repeat     Disable --site-repeat (default)" << endl
+    << "  --analytic-grad      Optimize model parameters with analytic gradients" << endl
+    << "  --no-analytic-grad   Disable --analytic-grad (default: only for >= 8 parameters)" << endl
+    << "  --brlen-opt NR|LBFGS Optimize branch lengths one by one or jointly (default: NR)" << endl
+    << "  --profile            Write calls and times of likelihood hot paths to .profile.json" << endl
     << endl << "CHECKPOINT:" << endl
     << "  --redo               Redo both ModelFinder and tree search" << endl
     << "  --redo-tree          Restore ModelFinder and only redo tree search" << endl
@@ -4431,6 +4614,7 @@ void usage_iqtree(char* argv[], bool full_command) {
     << "  --nstop NUM          Number of unsuccessful iterations to stop (default: 100)" << endl
     << "  --perturb NUM        Perturbation strength for randomized NNI (default: 0.5)" << endl
     << "  --radius NUM         Radius for parsimony SPR search (default: 6)" << endl
+    << "  --pars-spr           Refine native parsimony trees by SPR (default: OFF)" << endl
     << "  --allnni             Perform more thorough NNI search (default: OFF)" << endl
     << "  -g FILE              (Multifurcating) topological constraint tree file" << endl
     << "  --fast               Fast search to resemble FastTree" << endl
@@ -4462,6 +4646,7 @@ void usage_iqtree(char* argv[], bool full_command) {
     << "  --jack-prop NUM      Subsampling proportion for jackknife (default: 0.5)" << endl
     << "  --bcon NUM           Replicates for bootstrap + consensus tree" << endl
     << "  --bonly NUM          Replicates for bootstrap only" << endl
+    << "  --boot-reweight      Reweight patterns of the input alignment per replicate" << endl
 #ifdef USE_BOOSTER
     << "  --tbe                Transfer bootstrap expectation" << endl
 #endif
@@ -5241,6 +5426,23 @@ int countPhysicalCPUCores() {
      */
 }
 
+/** @return L2 cache size reported by the system, or a typical size if it does not tell */
+static size_t detectL2CacheSize() {
+    const size_t DEFAULT_L2_CACHE_SIZE = 256*1024;
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0)
+        return size;
+#endif
+    return DEFAULT_L2_CACHE_SIZE;
+}
+
+size_t getL2CacheSize() {
+    // called from the kernels inside parallel regions, the static initialization is thread-safe
+    static const size_t l2_size = detectL2CacheSize();
+    return l2_size;
+}
+
 // stacktrace.h (c) 2008, Timo Bingmann from http://idlebox.net/
 // published under the WTFPL v2.0
 
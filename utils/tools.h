@@ -243,6 +243,9 @@ typedef vector<string> StrVector;
  */
 #define mmatrix(T) vector< vector<T> >
 
+/** size of a cache line in bytes, to separate data written by different threads */
+const size_t CACHE_LINE_SIZE = 64;
+
 /**
         matrix of double
  */
@@ -473,7 +476,26 @@ enum LikelihoodKernel {
 };
 
 enum LhMemSave {
-	LM_PER_NODE, LM_MEM_SAVE
+	LM_PER_NODE, LM_MEM_SAVE, LM_MMAP
+};
+
+/**
+    which partial likelihood vector to evict when all memory slots are used (-mem option)
+    MEM_EVICT_COST: the one with the smallest subtree, which is cheapest to recompute
+    MEM_EVICT_LRU: the least recently used one
+    MEM_EVICT_HYBRID: the least recently used one, with larger subtrees kept longer
+*/
+enum MemEvictPolicy {
+    MEM_EVICT_COST, MEM_EVICT_LRU, MEM_EVICT_HYBRID
+};
+
+/**
+    scheduling of alignment patterns over threads in the likelihood kernels
+    KS_STATIC: one contiguous pattern range per thread
+    KS_STEAL: smaller pattern blocks with work stealing between threads
+*/
+enum KernelSchedule {
+    KS_STATIC, KS_STEAL
 };
 
 enum SiteLoglType {
@@ -652,6 +674,9 @@ public:
 	 */
 	int sprDist;
 
+    /** TRUE to refine native parsimony trees by a parsimony SPR search within sprDist (--pars-spr) */
+    bool pars_spr;
+
     /** cost matrix file for Sankoff parsimony */
     char *sankoff_cost_file;
     
@@ -1489,6 +1514,11 @@ public:
      */
     bool store_trans_matrix;
 
+    /**
+            maximal memory in bytes of the transition matrix caches of all models together (-mstore-mem)
+     */
+    uint64_t trans_cache_mem;
+
     /**
             state frequency type
      */
@@ -1551,6 +1581,9 @@ public:
     /** optimization algorithm for mixture (heterotachy) branch length models */
     string optimize_alg_mixlen;
 
+    /** optimization algorithm for all branch lengths: NR (branch by branch) or LBFGS (joint) */
+    string optimize_alg_brlen;
+
     /**
      *  Optimization algorithm for +I+G
      */
@@ -1610,6 +1643,11 @@ public:
     */
     char *bootstrap_spec;
 
+    /** TRUE to run each standard bootstrap replicate on the input alignment with
+        resampled pattern frequencies instead of a new alignment of the drawn patterns
+        (--boot-reweight). Zero-weight patterns are still computed by the kernels */
+    bool bootstrap_reweight;
+
     /** 1 or 2 to perform transfer boostrap expectation (TBE) */
     int transfer_bootstrap;
     
@@ -2060,6 +2098,15 @@ public:
     /** true to parallel ModelFinder by models instead of sites */
     bool openmp_by_model;
 
+    /**
+        number of threads per group of candidate models evaluated concurrently by ModelFinder,
+        0 (default) to evaluate one model after another with all threads. Models are evaluated with
+        this many threads, except those only known after the substitution models and heterotachy
+        models (all threads). The kernels lay out the patterns for all threads, so the results are
+        the same as without groups. Not with openmp_by_model
+    */
+    int model_group_threads;
+
     /** either MTC_AIC, MTC_AICc, MTC_BIC */
     ModelTestCriterion model_test_criterion;
 
@@ -2112,12 +2159,65 @@ public:
 
 	/* -1 (auto-detect): will be set to 0 if there is enough memory, 1 otherwise
 	 * 0: store all partial likelihood vectors
-	 * 1: only store 1 partial likelihood vector per node */
+	 * 1: only store 1 partial likelihood vector per node
+	 * 2: like 0, but in memory-mapped files in mmap_dir */
 	LhMemSave lh_mem_save;
+
+    /** directory of the memory-mapped partial likelihood files for lh_mem_save = LM_MMAP */
+    string mmap_dir;
+
+    /** true to allocate the central likelihood buffers from huge pages with NUMA-aware first touch (--mem-huge) */
+    bool lh_huge_pages;
     
     /** true to save buffer, default: false */
     bool buffer_mem_save;
 
+    /** eviction policy of memory slots for lh_mem_save = LM_MEM_SAVE, default: MEM_EVICT_COST */
+    MemEvictPolicy mem_evict_policy;
+
+    /** scheduling of patterns over threads in likelihood kernels, default: KS_STATIC */
+    KernelSchedule kernel_schedule;
+
+    /** true to benchmark static vs. work-stealing kernel schedule over number of threads */
+    bool kernel_schedule_bench;
+
+    /**
+        number of patterns per tile, for which the partial likelihoods of the whole traversal
+        are computed before the next tile. 0 to disable tiling, -1 (default) to fit a tile into L2 cache
+    */
+    int kernel_tile;
+
+    /** true to store partial likelihoods in single precision, default: false */
+    bool float_lh;
+
+    /** true to compare the final log-likelihood of single- vs. double-precision partial likelihoods */
+    bool float_lh_check;
+
+    /**
+        1 to compute partial likelihoods only once per site repeat class of a subtree, 0 (default) to disable.
+        This saves kernel work only: partial likelihoods are still stored for every pattern, so that slots keep
+        one size for all nodes, and the classes take 4 extra bytes per pattern in every slot
+    */
+    int site_repeat;
+
+    /** TRUE to count and time the hot paths per phase and write them to <prefix>.profile.json */
+    bool profile;
+
+    /**
+        1 to optimize model parameters with analytic instead of finite-difference gradients, 0 to disable,
+        -1 (default) to use them for models with at least 8 free parameters, where they pay off
+    */
+    int analytic_grad;
+
+    /**
+        TRUE to evaluate the NNIs of different branches in parallel, each thread on its own tree copy
+        with all partial likelihoods, FALSE (default) to parallelize each likelihood computation over patterns
+    */
+    bool nni_branch_parallel;
+
+    /** number of tree search trajectories run concurrently, each with num_threads/search_trajectories threads */
+    int search_trajectories;
+
     /** maximum size of memory allowed to use */
     double max_mem_size;
 
@@ -2823,6 +2923,11 @@ void trimString(string &str);
 */
 int countPhysicalCPUCores();
 
+/**
+    @return size of the level-2 cache in bytes, 256 KB if unknown
+*/
+size_t getL2CacheSize();
+
 void print_stacktrace(ostream &out, unsigned int max_frames = 63);
 
 /**